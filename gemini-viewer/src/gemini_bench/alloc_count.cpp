@@ -0,0 +1,43 @@
+#include "alloc_count.h"
+#include <atomic>
+#include <cstdlib> // for malloc free abort
+#include <new>
+
+// Replacements for the global operators, kept out of the benchmark's own
+// source so that they aren't inlined into their callers
+static std::atomic<uint64_t> numAllocs(0);
+
+void * operator new(size_t size)
+{
+    numAllocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if(!p)
+        abort(); // built without exceptions
+    return p;
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    numAllocs.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+uint64_t getNumAllocs()
+{
+    return numAllocs.load(std::memory_order_relaxed);
+}
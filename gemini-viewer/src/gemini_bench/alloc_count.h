@@ -0,0 +1,12 @@
+/* Count of the heap allocations the program makes through operator new (and
+ * so new[]) and its nothrow form, from any thread, for the benchmarks to
+ * report.
+ */
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <cstdint>
+
+uint64_t getNumAllocs();
+
+#endif
@@ -0,0 +1,217 @@
+#include "gem_server.h"
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+#define GEMVER 1
+#define CNX_SEQ 1 // server sequence number given in CNX ACK
+#define LOSS_SEED 1
+
+enum class Srv_cmd:uint8_t {CNX=1, READ_R, READ_I, WRITE_R, WRITE_I
+                            , ACK=0x10, NACKT=0x20, NACKP=0x40};
+
+// on-wire order of Gemini packet header
+struct Srv_hdr
+{
+    uint8_t ver;
+    Srv_cmd op;
+    uint8_t cli_seq;
+    uint8_t svr_seq;
+    uint32_t base_addr;
+    uint16_t num_regs;
+    uint16_t fail_code;
+};
+// on-wire order of Gemini connect response payload
+struct Srv_cnx_ack
+{
+    uint32_t maxpdu;
+    uint32_t pipeline;
+    uint32_t cnxid;
+};
+
+Gem_server::Gem_server(uint16_t port, uint32_t numRegs
+                       , uint32_t maxPayloadWords, uint32_t pipelineLen)
+    : m_skt(nullptr)
+    , m_port(port)
+    , m_regs(numRegs, 0)
+    , m_maxPayloadWords(maxPayloadWords)
+    , m_pipelineLen(pipelineLen)
+    , m_isConnected(false)
+    , m_cliPort(0)
+    , m_lastSeq(CNX_SEQ)
+    , m_replies(256)
+    , m_rxBuf(sizeof(Srv_hdr) + 4*maxPayloadWords + 64, 0)
+    , m_numExecuted(0)
+    , m_numReplayed(0)
+    , m_numNackt(0)
+    , m_numDropped(0)
+    , m_numReplies(0)
+    , m_dropReplyNum(0)
+    , m_lossProb(0.0)
+    , m_rng(LOSS_SEED)
+    , m_lossDist(0.0, 1.0)
+{
+}
+
+void Gem_server::start()
+{
+    m_skt = new QUdpSocket(this);
+    if(!m_skt->bind(QHostAddress::LocalHost, m_port))
+    {
+        qCritical() << "Gem_server can't bind to port" << m_port;
+        return;
+    }
+    connect(m_skt, &QUdpSocket::readyRead, this, &Gem_server::onRxReady);
+    emit ready(m_skt->localPort());
+}
+
+void Gem_server::onRxReady()
+{
+    char *buf = m_rxBuf.data();
+    while(m_skt->hasPendingDatagrams())
+    {
+        QHostAddress addr;
+        uint16_t port;
+        qint64 len = m_skt->readDatagram(buf, m_rxBuf.size(), &addr, &port);
+        if(len < static_cast<qint64>(sizeof(Srv_hdr)))
+            continue;
+        const Srv_hdr *hdr = reinterpret_cast<const Srv_hdr *>(buf);
+        if(hdr->ver != GEMVER)
+            continue;
+        if(hdr->op == Srv_cmd::CNX)
+            onCnx(buf, len, addr, port);
+        else if(m_isConnected && (addr == m_cliAddr) && (port == m_cliPort)
+                && !isLost())
+            onRequest(buf, len);
+    }
+}
+
+void Gem_server::onCnx(const char *buf, qint64 len, QHostAddress &addr
+                       , uint16_t port)
+{
+    Q_UNUSED(len);
+    const Srv_hdr *req = reinterpret_cast<const Srv_hdr *>(buf);
+    m_isConnected = true;
+    m_cliAddr = addr;
+    m_cliPort = port;
+    m_lastSeq = CNX_SEQ;
+    for(auto &r: m_replies)
+        r.clear();
+
+    char pkt[sizeof(Srv_hdr) + sizeof(Srv_cnx_ack)];
+    Srv_hdr *hdr = reinterpret_cast<Srv_hdr *>(pkt);
+    Srv_cnx_ack *ack = reinterpret_cast<Srv_cnx_ack *>(hdr+1);
+    hdr->ver = GEMVER;
+    hdr->op = Srv_cmd::ACK;
+    hdr->cli_seq = req->cli_seq;
+    hdr->svr_seq = CNX_SEQ;
+    hdr->base_addr = 0;
+    hdr->num_regs = qToLittleEndian(static_cast<uint16_t>(3));
+    hdr->fail_code = 0;
+    ack->maxpdu = qToLittleEndian(m_maxPayloadWords);
+    ack->pipeline = qToLittleEndian(m_pipelineLen);
+    ack->cnxid = qToLittleEndian(static_cast<uint32_t>(1));
+    m_skt->writeDatagram(pkt, sizeof(pkt), m_cliAddr, m_cliPort);
+}
+
+void Gem_server::onRequest(const char *buf, qint64 len)
+{
+    const Srv_hdr *req = reinterpret_cast<const Srv_hdr *>(buf);
+    uint8_t seq = req->cli_seq;
+
+    // Next in sequence: execute it and keep the reply in case of retry
+    if(static_cast<uint8_t>(seq - m_lastSeq) == 1)
+    {
+        m_replies[seq] = execute(buf, len);
+        m_lastSeq = seq;
+        ++m_numExecuted;
+        sendReply(m_replies[seq]);
+        return;
+    }
+
+    // Retry of a recent request: same reply again, without re-executing
+    uint8_t age = m_lastSeq - seq;
+    if((age < m_pipelineLen) && !m_replies[seq].isEmpty())
+    {
+        ++m_numReplayed;
+        sendReply(m_replies[seq]);
+        return;
+    }
+
+    // Out of order (an earlier request was lost)
+    Srv_hdr nack = *req;
+    nack.op = Srv_cmd::NACKT;
+    nack.svr_seq = m_lastSeq;
+    nack.num_regs = 0;
+    ++m_numNackt;
+    sendReply(QByteArray(reinterpret_cast<const char *>(&nack), sizeof(nack)));
+}
+
+QByteArray Gem_server::execute(const char *buf, qint64 len)
+{
+    const Srv_hdr *req = reinterpret_cast<const Srv_hdr *>(buf);
+    uint32_t base = qFromLittleEndian(req->base_addr);
+    uint32_t numRegs = qFromLittleEndian(req->num_regs);
+    bool isRead = (req->op == Srv_cmd::READ_I) || (req->op == Srv_cmd::READ_R);
+    bool isInc = (req->op == Srv_cmd::READ_I) || (req->op == Srv_cmd::WRITE_I);
+
+    Srv_hdr hdr = *req;
+    hdr.svr_seq = req->cli_seq;
+    hdr.fail_code = 0;
+    QByteArray reply;
+
+    uint32_t span = isInc ? numRegs : 1;
+    bool isBad = (numRegs > m_maxPayloadWords)
+            || (static_cast<uint64_t>(base) + span
+                > static_cast<uint64_t>(m_regs.size()))
+            || (!isRead && (len < static_cast<qint64>(sizeof(Srv_hdr)
+                                                      + 4*numRegs)));
+    if(isBad)
+    {
+        hdr.op = Srv_cmd::NACKP;
+        hdr.fail_code = qToLittleEndian(static_cast<uint16_t>(1));
+        hdr.num_regs = 0;
+        reply.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        return reply;
+    }
+
+    hdr.op = Srv_cmd::ACK;
+    reply.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    const char *data = buf + sizeof(Srv_hdr);
+    for(uint32_t i=0; i<numRegs; i++)
+    {
+        uint32_t addr = isInc ? base + i : base;
+        if(isRead)
+        {
+            uint32_t val = qToLittleEndian(m_regs[addr]);
+            reply.append(reinterpret_cast<const char *>(&val), sizeof(val));
+        }
+        else
+        {
+            uint32_t val;
+            memcpy(&val, data + 4*i, sizeof(val));
+            m_regs[addr] = qFromLittleEndian(val);
+        }
+    }
+    return reply;
+}
+
+bool Gem_server::isLost()
+{
+    if((m_lossProb <= 0.0) || (m_lossDist(m_rng) >= m_lossProb))
+        return false;
+    ++m_numDropped;
+    return true;
+}
+
+void Gem_server::sendReply(const QByteArray &reply)
+{
+    if(++m_numReplies == m_dropReplyNum)
+    {
+        ++m_numDropped;
+        return;
+    }
+    if(isLost())
+        return;
+    m_skt->writeDatagram(reply, m_cliAddr, m_cliPort);
+}
@@ -0,0 +1,77 @@
+/* Stand-in for a Gemini server (FPGA) so that Gemini_comms can be exercised
+ * on the local host without hardware.
+ *   - accepts one client connection (CNX), advertising the given maximum
+ *     payload and pipeline length
+ *   - executes requests only in sequence number order against an array of
+ *     registers, keeping the replies to the last 'pipeline' requests so that
+ *     a retried request gets the same reply without being executed again
+ *   - answers an out-of-order request with NACKT carrying the sequence
+ *     number of the last request it executed
+ *   - optionally drops requests and replies at random (but not CNX) to
+ *     emulate a lossy link, or drops just one chosen reply
+ */
+#ifndef GEM_SERVER_H
+#define GEM_SERVER_H
+
+#include <cstdint>
+#include <random>
+#include <QUdpSocket>
+#include <QVector>
+#include <QByteArray>
+
+class Gem_server: public QObject
+{
+    Q_OBJECT
+
+    private:
+        QUdpSocket *m_skt;
+        uint16_t m_port;
+        QVector<uint32_t> m_regs;
+        uint32_t m_maxPayloadWords;
+        uint32_t m_pipelineLen;
+        bool m_isConnected;
+        QHostAddress m_cliAddr;
+        uint16_t m_cliPort;
+        uint8_t m_lastSeq; // of last request executed
+        QVector<QByteArray> m_replies; // by sequence number, for retries
+        QByteArray m_rxBuf;
+        uint64_t m_numExecuted;
+        uint64_t m_numReplayed;
+        uint64_t m_numNackt;
+        uint64_t m_numDropped;
+        uint64_t m_numReplies;
+        uint64_t m_dropReplyNum; // reply to drop, 0 for none
+        double m_lossProb;
+        std::mt19937 m_rng; // fixed seed so that lossy runs repeat
+        std::uniform_real_distribution<double> m_lossDist;
+
+        bool isLost();
+
+        void onCnx(const char *buf, qint64 len, QHostAddress &addr
+                   , uint16_t port);
+        void onRequest(const char *buf, qint64 len);
+        QByteArray execute(const char *buf, qint64 len);
+        void sendReply(const QByteArray &reply);
+    private slots:
+        void onRxReady();
+    public:
+        Gem_server(uint16_t port, uint32_t numRegs, uint32_t maxPayloadWords
+                   , uint32_t pipelineLen);
+        Gem_server(const Gem_server&) = delete; // no copy
+        Gem_server& operator=(const Gem_server &) = delete; // no assign
+        uint64_t getNumExecuted() { return m_numExecuted; }
+        uint64_t getNumReplayed() { return m_numReplayed; }
+        uint64_t getNumNackt() { return m_numNackt; }
+        uint64_t getNumDropped() { return m_numDropped; }
+        // Probability (0..1) of dropping each request and each reply. Set
+        // before start()
+        void setLoss(double prob) { m_lossProb = prob; }
+        // Drop only the num'th reply (from 1). Set before start()
+        void setDropReply(uint64_t num) { m_dropReplyNum = num; }
+    public slots:
+        void start(); // bind socket, from the thread the server runs in
+    signals:
+        void ready(quint16 port);
+};
+
+#endif
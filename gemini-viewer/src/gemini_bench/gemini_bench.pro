@@ -0,0 +1,16 @@
+DESTDIR = ../../bin
+TARGET = gemini-bench
+
+CONFIG += console c++14 warn_on exceptions_off rtti_off
+CONFIG -= app_bundle
+
+QT -= gui
+QT += network
+
+LIBS += -L../../lib -lgemini_comms -lgemini_core
+INCLUDEPATH += ../gemini_comms ../gemini_core
+
+SOURCES += main.cpp gem_server.cpp alloc_count.cpp
+HEADERS += gem_server.h alloc_count.h
+
+PRE_TARGETDEPS += ../../lib/libgemini_comms.a ../../lib/libgemini_core.a
@@ -0,0 +1,490 @@
+/* Benchmark of Gemini transaction handling
+ *
+ *   gemini-bench [transactions [regs_per_transaction [loss_percent]]]
+ *
+ * 1. Queue: queueing, serialising and retiring transactions the way
+ *    Gemini_comms did with heap-allocated QList entries, and with the
+ *    pooled transaction ring it uses now (no network involved)
+ * 2. Loopback: register writes through Gemini_comms to a stand-in Gemini
+ *    server running in another thread on the local host, then reads of the
+ *    same registers checked against what was written. The server can drop
+ *    the given percentage of requests and replies to exercise retries.
+ *    Heap allocations made meanwhile, by any thread, are counted too
+ * 3. The same through a Gem_core driven by its own poll() in this thread,
+ *    as a headless tool would use it, without Qt's event loop
+ */
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QList>
+#include <QDebug>
+#include <cstdio>
+#include "gemini_comms.h"
+#include "gem_server.h"
+#include "alloc_count.h"
+
+#define DEFAULT_TRANSACTIONS 100000
+#define DEFAULT_REGS 1
+#define GEM_HDR_BYTES 12
+#define QUEUE_DEPTH 16 // transactions waiting for a reply in queue bench
+#define SERVER_REGS 65536
+#define SERVER_MAX_PAYLOAD_WORDS 1984
+#define SERVER_PIPELINE 8
+#define LOOPBACK_OUTSTANDING 64 // rw() calls kept queued in loopback bench
+#define GEM_TIMEOUT_MSEC 500
+#define GEM_RETRIES 3
+#define GEM_LOSSY_RETRIES 10 // enough that a lossy run shouldn't give up
+#define DEEP_PIPELINE 32 // server pipeline for the single lost reply run
+#define DEEP_DROP_REPLY 100 // reply dropped in that run
+
+// Transaction record as queued by Gemini_comms before the transaction ring
+struct Heap_transaction
+{
+    Gem_rw_type rwType;
+    uint32_t base;
+    uint32_t numRegs;
+    uint32_t sendCount;
+    qint64 timeoutTimeMs;
+    uint8_t cli_seq;
+    uint32_t ctx;
+    QByteArray data;
+};
+
+static void quietMsgHndlr(QtMsgType msgType, const QMessageLogContext &ctx
+        , const QString &msg)
+{
+    Q_UNUSED(ctx);
+    if(msgType != QtDebugMsg)
+        fprintf(stderr, "%s\n", msg.toLatin1().data());
+}
+
+// Value written to each register, so reads can be checked
+static uint32_t pattern(uint32_t addr)
+{
+    return addr * 2654435761u;
+}
+
+// Address of the nth write, and of the read that checks it
+static uint32_t loopbackBase(uint32_t n, uint32_t numTrans, uint32_t numRegs)
+{
+    return ((n % numTrans) * numRegs) % (SERVER_REGS - numRegs);
+}
+
+static bool isBadRead(uint32_t base, uint32_t num, const Reg_view &rd)
+{
+    bool isBad = (rd.size() != num);
+    for(uint32_t i=0; !isBad && (i<num); i++)
+        isBad = (rd.at(i) != pattern(base + i));
+    return isBad;
+}
+
+// Loopback writes and reads through Gem_core, issuing a new request from
+// each result as the Gemini_comms loopback does
+class Core_loopback: public Gem_core_listener
+{
+    private:
+        Gem_core m_core;
+        uint32_t m_numTrans;
+        uint32_t m_numTotal;
+        QVector<uint32_t> m_regs;
+        bool m_isFinished;
+
+        void issue()
+        {
+            uint32_t base = loopbackBase(numIssued, m_numTrans, m_regs.size());
+            if(numIssued < m_numTrans)
+            {
+                for(int i=0; i<m_regs.size(); i++)
+                    m_regs[i] = pattern(base + i);
+                m_core.rw(base, m_regs.size(), m_regs.data()
+                          , Gem_rw_type::WR_INC, 0);
+            }
+            else
+                m_core.rw(base, m_regs.size(), nullptr, Gem_rw_type::READ_INC
+                          , 0);
+            ++numIssued;
+        }
+
+        void onCnxResult(Gem_cnx_rslt rslt) override
+        {
+            if(rslt != Gem_cnx_rslt::OK)
+            {
+                fprintf(stderr, "Gem_core can't connect to stand-in server\n");
+                isFailed = true;
+                m_isFinished = true;
+                return;
+            }
+            timer.start();
+            m_core.beginBatch();
+            while((numIssued < m_numTotal)
+                  && (numIssued < LOOPBACK_OUTSTANDING))
+                issue();
+            m_core.endBatch();
+        }
+        void onCnxFailed() override
+        {
+            fprintf(stderr, "Gem_core connection to stand-in server failed\n");
+            isFailed = true;
+            m_isFinished = true;
+        }
+        void onRwResult(const Gem_rw_result &res) override
+        {
+            ++numDone;
+            if(res.timedOut || !res.isAck)
+                ++numFailed;
+            else if((res.op == Gem_rw_type::READ_INC)
+                    && isBadRead(res.base, res.numRegs, res.regs))
+                ++numBadReads;
+            // Failed results of a lost connection are given from within the
+            // core, which would fail any new request straight back
+            if(!m_core.isConnected())
+                return;
+            if(numIssued < m_numTotal)
+                issue();
+            else if(numDone == m_numTotal)
+                m_isFinished = true;
+        }
+
+    public:
+        uint32_t numIssued;
+        uint32_t numDone;
+        uint32_t numFailed;
+        uint32_t numBadReads;
+        bool isFailed;
+        QElapsedTimer timer;
+
+        Core_loopback(uint16_t port, uint32_t retries, uint32_t numTrans
+                      , uint32_t numRegs)
+            : m_core(0x7f000001, port, GEM_TIMEOUT_MSEC, retries, this)
+            , m_numTrans(numTrans)
+            , m_numTotal(2 * numTrans)
+            , m_regs(numRegs)
+            , m_isFinished(false)
+            , numIssued(0)
+            , numDone(0)
+            , numFailed(0)
+            , numBadReads(0)
+            , isFailed(false)
+        {
+        }
+
+        void run()
+        {
+            m_core.udpConnect();
+            while(!m_isFinished)
+            {
+                if(!m_core.poll(-1))
+                {
+                    isFailed = true;
+                    break;
+                }
+            }
+        }
+        uint64_t getNumResent() { return m_core.getNumResent(); }
+        uint64_t getNumGoBacks() { return m_core.getNumGoBacks(); }
+};
+
+static double rate(uint64_t count, QElapsedTimer &timer)
+{
+    double secs = timer.nsecsElapsed() * 1e-9;
+    return (secs > 0.0) ? count / secs : 0.0;
+}
+
+// new + QByteArray copy per transaction, another QByteArray per send
+static double benchHeapQueue(uint32_t numTrans, QVector<uint32_t> &regs)
+{
+    QList<Heap_transaction*> transList;
+    uint64_t sentBytes = 0;
+    uint8_t seq = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for(uint32_t i=0; i<numTrans; i++)
+    {
+        Heap_transaction *t = new Heap_transaction;
+        t->rwType = Gem_rw_type::WR_INC;
+        t->base = i;
+        t->numRegs = regs.size();
+        t->data = QByteArray(reinterpret_cast<char *>(regs.data())
+                             , regs.size()*4);
+        t->sendCount = 0;
+        t->cli_seq = 0;
+        t->ctx = 0;
+        transList.push_back(t);
+
+        char hdr[GEM_HDR_BYTES] = {0};
+        hdr[2] = static_cast<char>(++seq);
+        QByteArray send_buf;
+        send_buf.append(hdr, sizeof(hdr));
+        send_buf.append(t->data);
+        sentBytes += send_buf.size();
+        t->sendCount++;
+
+        if(transList.size() > QUEUE_DEPTH)
+        {
+            Heap_transaction *done = transList.front();
+            transList.pop_front();
+            delete done;
+        }
+    }
+    double r = rate(numTrans, timer);
+    while(transList.size() > 0)
+    {
+        delete transList.front();
+        transList.pop_front();
+    }
+    if(sentBytes == 0)
+        printf("  (nothing sent)\n");
+    return r;
+}
+
+// Header and data copied once into a recycled slot's wire buffer
+static double benchRingQueue(uint32_t numTrans, QVector<uint32_t> &regs)
+{
+    Trans_ring transList;
+    uint64_t sentBytes = 0;
+    uint8_t seq = 0;
+    uint32_t dataBytes = regs.size()*4;
+    QElapsedTimer timer;
+    timer.start();
+    for(uint32_t i=0; i<numTrans; i++)
+    {
+        Gemini_transaction &t = transList.pushBack();
+        t.rwType = Gem_rw_type::WR_INC;
+        t.base = i;
+        t.numRegs = regs.size();
+        t.sendCount = 0;
+        t.cli_seq = 0;
+        t.ctx = 0;
+        char *wire = t.reserveWire(GEM_HDR_BYTES + dataBytes);
+        memset(wire, 0, GEM_HDR_BYTES);
+        memcpy(wire + GEM_HDR_BYTES, regs.data(), dataBytes);
+
+        wire[2] = static_cast<char>(++seq);
+        sentBytes += t.wireLen;
+        t.sendCount++;
+
+        if(transList.size() > QUEUE_DEPTH)
+            transList.popFront();
+    }
+    double r = rate(numTrans, timer);
+    if(sentBytes == 0)
+        printf("  (nothing sent)\n");
+    return r;
+}
+
+int main(int argc, char * argv[])
+{
+    qInstallMessageHandler(quietMsgHndlr);
+    QCoreApplication app(argc, argv);
+
+    QStringList args = QCoreApplication::arguments();
+    uint32_t numTrans = DEFAULT_TRANSACTIONS;
+    uint32_t numRegs = DEFAULT_REGS;
+    double lossPct = 0.0;
+    if(args.size() > 1)
+        numTrans = args.at(1).toUInt();
+    if(args.size() > 2)
+        numRegs = args.at(2).toUInt();
+    if(args.size() > 3)
+        lossPct = args.at(3).toDouble();
+    if((numTrans == 0) || (numRegs == 0)
+            || (numRegs > SERVER_MAX_PAYLOAD_WORDS)
+            || (lossPct < 0.0) || (lossPct >= 100.0))
+    {
+        fprintf(stderr, "usage: gemini-bench [transactions"
+                " [regs_per_transaction (1..%d) [loss_percent]]]\n"
+                , SERVER_MAX_PAYLOAD_WORDS);
+        return 1;
+    }
+
+    QVector<uint32_t> regs(numRegs);
+    for(uint32_t i=0; i<numRegs; i++)
+        regs[i] = i;
+
+    printf("%u transactions of %u registers\n", numTrans, numRegs);
+    printf("queue, heap entries:   %12.0f transactions/s\n"
+           , benchHeapQueue(numTrans, regs));
+    printf("queue, pooled ring:    %12.0f transactions/s\n"
+           , benchRingQueue(numTrans, regs));
+
+    // Loopback through Gemini_comms to a stand-in server
+    QThread srvThread;
+    Gem_server *srv = new Gem_server(0, SERVER_REGS
+                                     , SERVER_MAX_PAYLOAD_WORDS
+                                     , SERVER_PIPELINE);
+    srv->setLoss(lossPct / 100.0);
+    srv->moveToThread(&srvThread);
+    QObject::connect(&srvThread, &QThread::started, srv, &Gem_server::start);
+
+    Gemini_comms *gem = nullptr;
+    RwChannel *chan = nullptr;
+    uint32_t numIssued = 0;
+    uint32_t numDone = 0;
+    uint32_t numFailed = 0;
+    uint32_t numBadReads = 0;
+    uint32_t numTotal = 2 * numTrans; // writes, then reads of the same regs
+    uint16_t srvPort = 0;
+    QElapsedTimer timer;
+    uint64_t loopAllocs = 0;
+    int rv = 0;
+
+    // Responses come back in order, so all writes are done before the reads
+    // they're checked by
+    auto issue = [&]()
+    {
+        uint32_t base = loopbackBase(numIssued, numTrans, numRegs);
+        if(numIssued < numTrans)
+        {
+            for(uint32_t i=0; i<numRegs; i++)
+                regs[i] = pattern(base + i);
+            chan->rw(base, numRegs, regs.data(), Gem_rw_type::WR_INC);
+        }
+        else
+            chan->rw(base, numRegs, nullptr, Gem_rw_type::READ_INC);
+        ++numIssued;
+    };
+
+    QObject::connect(srv, &Gem_server::ready, &app, [&](quint16 port)
+    {
+        srvPort = port;
+        gem = new Gemini_comms(QHostAddress(QHostAddress::LocalHost), port
+                               , GEM_TIMEOUT_MSEC
+                               , (lossPct > 0.0) ? GEM_LOSSY_RETRIES
+                                                 : GEM_RETRIES);
+        QObject::connect(gem, &Gemini_comms::cnx_result, &app
+                         , [&](Gem_cnx_rslt rslt)
+        {
+            if(rslt != Gem_cnx_rslt::OK)
+            {
+                fprintf(stderr, "Can't connect to stand-in server\n");
+                rv = 1;
+                app.quit();
+                return;
+            }
+            chan = gem->openChannel();
+            QObject::connect(chan, &RwChannel::result, &app
+                     , [&](bool timedOut, uint32_t base, uint32_t num
+                           , const Reg_view &rd, Gem_rw_type op, bool isAck
+                           , uint8_t)
+            {
+                ++numDone;
+                if(timedOut || !isAck)
+                    ++numFailed;
+                else if((op == Gem_rw_type::READ_INC)
+                        && isBadRead(base, num, rd))
+                    ++numBadReads;
+                if(numIssued < numTotal)
+                    issue();
+                else if(numDone == numTotal)
+                {
+                    loopAllocs += getNumAllocs();
+                    app.quit();
+                }
+            });
+            timer.start();
+            loopAllocs -= getNumAllocs();
+            while((numIssued < numTotal)
+                  && (numIssued < LOOPBACK_OUTSTANDING))
+                issue();
+        });
+        QObject::connect(gem, &Gemini_comms::cnx_failed, &app, [&]()
+        {
+            fprintf(stderr, "Connection to stand-in server failed\n");
+            rv = 1;
+            app.quit();
+        });
+        gem->udpConnect();
+    });
+
+    srvThread.start();
+    app.exec();
+
+    double loopRate = rate(numDone, timer);
+    uint64_t numResent = gem ? gem->getNumResent() : 0;
+    uint64_t numGoBacks = gem ? gem->getNumGoBacks() : 0;
+    int64_t srttUs = gem ? gem->getSrttUsec() : 0;
+    int64_t rttVarUs = gem ? gem->getRttVarUsec() : 0;
+    int64_t rtoUs = gem ? gem->getRtoUsec() : 0;
+    if(chan)
+        chan->dispose();
+    delete gem;
+    // Server has nothing left to do, so its counters are steady
+    uint64_t srvDropped = srv->getNumDropped();
+    uint64_t srvExecuted = srv->getNumExecuted();
+    uint64_t srvReplayed = srv->getNumReplayed();
+    uint64_t srvNackt = srv->getNumNackt();
+
+    // Same again through Gem_core, reconnecting to the server
+    Core_loopback core(srvPort, (lossPct > 0.0) ? GEM_LOSSY_RETRIES
+                                                : GEM_RETRIES
+                       , numTrans, numRegs);
+    if(rv == 0)
+        core.run();
+    double coreRate = rate(core.numDone, core.timer);
+    srvThread.quit();
+    srvThread.wait();
+
+    // A single lost reply with a deep pipeline, and only as many retries as
+    // the GUI allows: every later reply arrives before the retry's does
+    QThread deepThread;
+    Gem_server *deepSrv = new Gem_server(0, SERVER_REGS
+                                         , SERVER_MAX_PAYLOAD_WORDS
+                                         , DEEP_PIPELINE);
+    deepSrv->setDropReply(DEEP_DROP_REPLY);
+    deepSrv->moveToThread(&deepThread);
+    uint16_t deepPort = 0;
+    QObject::connect(&deepThread, &QThread::started, deepSrv
+                     , &Gem_server::start);
+    QObject::connect(deepSrv, &Gem_server::ready, &app, [&](quint16 port)
+    {
+        deepPort = port;
+        app.quit();
+    });
+    deepThread.start();
+    app.exec();
+    Core_loopback deep(deepPort, GEM_RETRIES, numTrans, numRegs);
+    if(rv == 0)
+        deep.run();
+    deepThread.quit();
+    deepThread.wait();
+    delete deepSrv;
+
+    if(rv == 0)
+    {
+        printf("loopback, Gemini_comms: %11.0f transactions/s"
+               " (%u failed, %u bad reads)\n", loopRate, numFailed
+               , numBadReads);
+        printf("  %.1f%% loss: %llu dropped, %llu resent, %llu go-backs"
+               ", server executed %llu, replayed %llu, NACKT %llu\n"
+               , lossPct
+               , static_cast<unsigned long long>(srvDropped)
+               , static_cast<unsigned long long>(numResent)
+               , static_cast<unsigned long long>(numGoBacks)
+               , static_cast<unsigned long long>(srvExecuted)
+               , static_cast<unsigned long long>(srvReplayed)
+               , static_cast<unsigned long long>(srvNackt));
+        printf("  round trip %lld us (variation %lld us), timeout %lld us\n"
+               , static_cast<long long>(srttUs)
+               , static_cast<long long>(rttVarUs)
+               , static_cast<long long>(rtoUs));
+        printf("  %.2f heap allocations per transaction\n"
+               , static_cast<double>(loopAllocs) / numTotal);
+        printf("loopback, Gem_core poll: %10.0f transactions/s"
+               " (%u failed, %u bad reads)\n", coreRate, core.numFailed
+               , core.numBadReads);
+        printf("  %llu resent, %llu go-backs\n"
+               , static_cast<unsigned long long>(core.getNumResent())
+               , static_cast<unsigned long long>(core.getNumGoBacks()));
+        printf("pipeline %d, one reply lost, %d retries: %s"
+               " (%u failed, %llu resent)\n", DEEP_PIPELINE, GEM_RETRIES
+               , deep.isFailed ? "connection FAILED" : "ok", deep.numFailed
+               , static_cast<unsigned long long>(deep.getNumResent()));
+        if((numFailed != 0) || (numBadReads != 0) || core.isFailed
+                || (core.numFailed != 0) || (core.numBadReads != 0)
+                || deep.isFailed || (deep.numFailed != 0)
+                || (deep.numBadReads != 0))
+            rv = 1;
+    }
+    delete srv;
+    return rv;
+}
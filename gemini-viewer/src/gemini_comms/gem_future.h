@@ -0,0 +1,182 @@
+/* Futures for the results of asynchronous register reads and writes.
+ *
+ * RwChannel::rwAsync() returns a Gem_future that completes with the
+ * request's Gem_reply once all of its transactions are answered (or have
+ * timed out). A continuation given to then() runs at that point, or at once
+ * if the future has already completed. whenAll() combines futures into one
+ * that completes when they all have, so that many requests can be issued
+ * together and handled together. RwChannel::readRegions() reads many regions
+ * that way, and completes with a Gem_regions_reply.
+ *
+ * Futures complete in the thread that owns the RwChannel, from its event
+ * loop, so there's no blocking wait: waiting in that thread would stop the
+ * results from arriving. Each future takes one continuation.
+ */
+#ifndef GEM_FUTURE_H
+#define GEM_FUTURE_H
+
+#include <QVector>
+#include <algorithm> // for min
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility> // for move
+#include <vector>
+#include "gem_regions.h"
+#include "reply_pool.h"
+#include "trans_ring.h"
+
+// Outcome of one rw request, however many transactions it was split into
+struct Gem_reply
+{
+    bool timedOut;  // any of the transactions
+    bool isAck;     // all of the transactions
+    uint8_t failCode; // first non-zero fail code
+    uint32_t base;
+    uint32_t numRegs;
+    Gem_rw_type op;
+    QVector<Reg_view> regs; // values read, one view per transaction
+
+    Gem_reply()
+        : timedOut(false), isAck(true), failCode(0), base(0), numRegs(0)
+        , op(Gem_rw_type::READ_INC)
+    {}
+    bool isOk() const { return !timedOut && isAck; }
+    // Number of register values read, and the value at index i of them
+    uint32_t size() const
+    {
+        uint32_t n = 0;
+        for(const Reg_view &part: regs)
+            n += part.size();
+        return n;
+    }
+    uint32_t at(uint32_t i) const
+    {
+        for(const Reg_view &part: regs)
+        {
+            if(i < part.size())
+                return part.at(i);
+            i -= part.size();
+        }
+        return 0;
+    }
+};
+
+// Registers of a list of regions, in the replies of the reads covering them
+struct Gem_regions_reply
+{
+    bool timedOut;  // any of the reads
+    bool isAck;     // all of the reads
+    uint8_t failCode; // first non-zero fail code
+    std::vector<Gem_region> regions; // as requested
+    QVector<Gem_reply> reads;
+    std::vector<uint32_t> readOfRegion;
+
+    Gem_regions_reply() : timedOut(false), isAck(true), failCode(0) {}
+    bool isOk() const { return !timedOut && isAck; }
+    // Number of values read for a region, and the value at index i of them
+    uint32_t size(uint32_t region) const
+    {
+        const Gem_reply &rd = reads.at(readOfRegion[region]);
+        uint32_t offset = regions[region].base - rd.base;
+        uint32_t n = rd.size();
+        if(n <= offset)
+            return 0;
+        return std::min(n - offset, regions[region].numRegs);
+    }
+    uint32_t at(uint32_t region, uint32_t i) const
+    {
+        const Gem_reply &rd = reads.at(readOfRegion[region]);
+        return rd.at(regions[region].base - rd.base + i);
+    }
+};
+
+template<class T>
+struct Gem_future_state
+{
+    bool isReady;
+    T value;
+    std::function<void(const T &)> then;
+
+    Gem_future_state() : isReady(false) {}
+};
+
+template<class T>
+class Gem_future
+{
+    private:
+        std::shared_ptr<Gem_future_state<T>> m_state;
+
+    public:
+        Gem_future() {}
+        explicit Gem_future(std::shared_ptr<Gem_future_state<T>> state)
+            : m_state(std::move(state))
+        {}
+
+        bool isValid() const { return m_state != nullptr; }
+        bool isReady() const { return m_state && m_state->isReady; }
+        // Only once ready
+        const T & get() const { return m_state->value; }
+        // Call fn with the value when ready, which may be now
+        void then(std::function<void(const T &)> fn)
+        {
+            if(m_state->isReady)
+                fn(m_state->value);
+            else
+                m_state->then = std::move(fn);
+        }
+};
+
+template<class T>
+class Gem_promise
+{
+    private:
+        std::shared_ptr<Gem_future_state<T>> m_state;
+
+    public:
+        Gem_promise() : m_state(std::make_shared<Gem_future_state<T>>()) {}
+
+        Gem_future<T> future() const { return Gem_future<T>(m_state); }
+        void set(T value)
+        {
+            m_state->value = std::move(value);
+            m_state->isReady = true;
+            // The continuation may drop the last other reference to state
+            std::shared_ptr<Gem_future_state<T>> keep = m_state;
+            std::function<void(const T &)> fn = std::move(keep->then);
+            keep->then = nullptr;
+            if(fn)
+                fn(keep->value);
+        }
+};
+
+// Future of all the values, in the order of the futures given
+template<class T>
+Gem_future<QVector<T>> whenAll(const QVector<Gem_future<T>> &futures)
+{
+    struct All
+    {
+        QVector<T> values;
+        int numLeft;
+        Gem_promise<QVector<T>> promise;
+    };
+    std::shared_ptr<All> all = std::make_shared<All>();
+    all->values.resize(futures.size());
+    all->numLeft = futures.size();
+    Gem_future<QVector<T>> result = all->promise.future();
+    if(futures.isEmpty())
+        all->promise.set(all->values);
+    for(int i=0; i<futures.size(); i++)
+    {
+        Gem_future<T> f = futures.at(i);
+        f.then([all, i](const T &value)
+        {
+            all->values[i] = value;
+            if(--all->numLeft == 0)
+                all->promise.set(std::move(all->values));
+        });
+    }
+    return result;
+}
+
+#endif
@@ -2,46 +2,75 @@
 #define gemini_comms_h
 
 #include <QHostAddress>
-#include <QUdpSocket>
-#include <QTimer>
+#include <QThread>
 #include <QVector>
 #include <cstdint>
+#include <deque>
+#include <vector>
+#include "gemini_engine.h"
+#include "gem_future.h"
 
-enum class Gem_cnx_rslt{OK, FAIL_TEMP, FAIL_PERM, TIMEOUT};
-enum class Gem_rw_type{READ_INC, READ_FIFO, WR_INC, WR_FIFO};
-class Gemini_transaction;
 class Gemini_comms;
 
-struct Packet_record;
-
 // Instances of this class are used to read/write Gemini Servers, multiplexing
 // access to a single Gemini_comms object that connects to the server because
 // Gemini servers can only accept a limited number of connections (ie 3)
 // * Create them by calling Gemini_comms::openChannel()
 // * Call RwChannel::dispose() to release resources and delete them
+// Results of rw() are signalled by 'result', one per transaction. Those of
+// rwAsync() complete its future instead, once per request
+// A channel's requests are sent in order, but channels of a higher priority
+// class go first and those in the same class take turns (see Trans_sched)
 class RwChannel: public QObject
 {
     Q_OBJECT
 
     friend class Gemini_comms;
     private:
+        // Request made by rwAsync(), and its reply so far
+        struct Async_rw
+        {
+            uint64_t idx; // among all requests made on the channel
+            Gem_promise<Gem_reply> promise;
+            Gem_reply reply;
+        };
+
         Gemini_comms * m_gemComms;
         uint32_t m_ctx;
+        Gem_priority m_priority;
+        uint64_t m_numIssued; // requests, which complete in order
+        uint64_t m_numDone;
+        std::deque<Async_rw> m_async;
 
         RwChannel(Gemini_comms* comms, uint32_t ctx);
         void onRwDone(bool timeout, uint32_t base, uint32_t numregs
-                      , QByteArray regs, Gem_rw_type op, bool isAck
-                      , uint8_t fail_code);
+                      , const Reg_view &regs, Gem_rw_type op, bool isAck
+                      , uint8_t fail_code, bool isLast);
 
     public:
+        // POLLING unless set. Takes effect from the next request
+        void setPriority(Gem_priority prio) { m_priority = prio; }
+        Gem_priority getPriority() const { return m_priority; }
         void rw(uint32_t base, uint32_t numRegs, uint32_t *regs
                       , Gem_rw_type opType);
+        // Futures of requests still pending when the channel is disposed of
+        // never complete
+        Gem_future<Gem_reply> rwAsync(uint32_t base, uint32_t numRegs
+                                      , uint32_t *regs, Gem_rw_type opType);
+        // Read all the regions, in as few transactions as planRegionReads()
+        // can, all issued at once. Holes of up to maxHoleRegs registers
+        // between regions are read too, so must be readable
+        Gem_future<Gem_regions_reply> readRegions(
+                const std::vector<Gem_region> &regions
+                , uint32_t maxHoleRegs = 0);
         void dispose();
         ~RwChannel();
 
     signals:
+        // regs: values read (none for writes), in the buffer the reply was
+        // received into, which is kept for as long as a copy of regs is
         void result(bool timedOut, uint32_t base, uint32_t numregs
-                    , QByteArray regs, Gem_rw_type op, bool isAck
+                    , const Reg_view &regs, Gem_rw_type op, bool isAck
                     , uint8_t fail_code);
 };
 
@@ -50,50 +79,30 @@ class RwChannel: public QObject
 //   Gemini_comms::cnx_result.
 // * If the udpConnect() succeeds, create RwChannels for sending/receiving using
 //   Gemini_comms::openChannel()
+// The protocol runs in a Gemini_engine in a thread of its own. Gemini_comms
+// and its channels belong to the thread that created them, and results are
+// signalled in that thread
 class Gemini_comms: public QObject
 {
     Q_OBJECT
 
     friend class RwChannel;
     private:
-        QHostAddress m_addr;
-        uint16_t m_port;
-        uint64_t m_timeoutmsec;
-        uint32_t m_maxRetries;
-        QUdpSocket * m_skt;
-        QTimer *m_timer;
-        uint32_t m_cnxRetryCount;
+        Gem_queues m_queues;
+        QThread *m_ioThread; // runs m_engine
+        Gemini_engine *m_engine;
         bool m_isConnected;
-        uint32_t m_numInTransit;
-        bool m_waitingForRetryResponse;
-        uint32_t m_pipelineLen;
-        uint32_t m_maxPduBytes;
-        uint32_t m_maxPayloadWords;
-
-        uint8_t m_cli_seq;
-        uint8_t m_svr_seq;
+        uint32_t m_maxPayloadWords; // registers per PDU, once connected
 
         QVector<RwChannel *> m_chans;
+        QVector<uint32_t> m_numPending; // requests not yet completed, by ctx
 
-        QList<Gemini_transaction*> m_transList;
-        QList<Packet_record*> m_received_trace;
-
-        void startTimeoutTimer(Gemini_transaction * trans);
-        void trySendTransactions();
-        void resendOldestTransaction();
-        void sendGeminiTransaction(Gemini_transaction * trans);
-        void sendPdu(char *data, uint32_t len);
-        void closeConnection();
         void rw(uint32_t base, uint32_t numRegs, uint32_t *regs
-                      , Gem_rw_type opType, uint32_t ctx);
-        void recordRxPacket(char buf[], qint64 len);
-        void printRxTraceToLog();
+                      , Gem_rw_type opType, uint32_t ctx, Gem_priority prio);
     private slots:
-        void onCnxTimeout();
-        void onCnxRxReady();
-
-        void onPktRxReady();
-        void onPktTimeout();
+        void onCnxResult(Gem_cnx_rslt rslt);
+        void onCnxFailed();
+        void onResultsReady();
     public:
         Gemini_comms(const Gemini_comms&) = delete; // no copy
         Gemini_comms& operator=(const Gemini_comms &) = delete; // no assign
@@ -104,6 +113,13 @@ class Gemini_comms: public QObject
 
 
         RwChannel* openChannel();
+        uint64_t getNumResent() { return m_engine->getNumResent(); }
+        uint64_t getNumGoBacks() { return m_engine->getNumGoBacks(); }
+        // Current round trip estimates, and the timeout they give for a
+        // transaction's first send (microseconds)
+        int64_t getSrttUsec() { return m_engine->getSrttUsec(); }
+        int64_t getRttVarUsec() { return m_engine->getRttVarUsec(); }
+        int64_t getRtoUsec() { return m_engine->getRtoUsec(); }
     public slots:
         void udpConnect(); // Initiate connection to FPGA server
     signals:
@@ -111,6 +127,8 @@ class Gemini_comms: public QObject
         void cnx_failed(); // comms failure
         void read_complete(uint32_t base, uint32_t numregs, QByteArray ba);
         void write_complete(uint32_t base, uint32_t numregs);
+        void connectRequested(); // to m_engine, in the I/O thread
+        void requestsQueued();   // to m_engine, in the I/O thread
 };
 
 #endif
@@ -10,7 +10,9 @@ QT += network
 
 DESTDIR = ../../lib
 
-HEADERS += gemini_comms.h pub_client.h
+INCLUDEPATH += ../gemini_core
 
-SOURCES += gemini_comms.cpp pub_client.cpp
+HEADERS += gemini_comms.h pub_client.h gemini_engine.h gem_future.h
+
+SOURCES += gemini_comms.cpp pub_client.cpp gemini_engine.cpp
 
@@ -0,0 +1,143 @@
+#include "gemini_engine.h"
+#include <QDebug>
+
+Gemini_engine::Gemini_engine(QHostAddress addr, const uint16_t port
+                , const uint64_t timeout_msec
+                , const uint32_t retries, Gem_queues *queues)
+    : m_queues(queues)
+    , m_core(addr.toIPv4Address(), port, timeout_msec, retries, this)
+    , m_notifier(nullptr)
+    , m_timer(nullptr)
+    , m_hasNewResults(false)
+    , m_maxPayloadWords(0)
+{
+}
+
+// Timer and socket notifier belong to the I/O thread, so are created and
+// deleted there
+void Gemini_engine::start()
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &Gemini_engine::onTimeout);
+}
+
+void Gemini_engine::stop()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    delete m_timer;
+    m_timer = nullptr;
+}
+
+// Initiate connection to Gemini server (FPGA)
+void Gemini_engine::udpConnect()
+{
+    m_core.udpConnect();
+    // Core's socket is created by its first connection attempt
+    if(!m_notifier && (m_core.getFd() >= 0))
+    {
+        m_notifier = new QSocketNotifier(m_core.getFd()
+                                         , QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated
+                , this, &Gemini_engine::onReadable);
+    }
+    update();
+}
+
+void Gemini_engine::onReadable()
+{
+    m_core.onReadable();
+    update();
+}
+
+void Gemini_engine::onTimeout()
+{
+    m_core.onTimer();
+    update();
+}
+
+// Take all the requests queued by Gemini_comms before sending any, like a
+// batch of replies, so that a burst from the caller fills the pipeline
+void Gemini_engine::onRequestsQueued()
+{
+    m_queues->isRequestPosted = false;
+    m_core.beginBatch();
+    while(Gem_request *req = m_queues->requests.pop())
+    {
+        // Write data is sent from the request's buffer, which is swapped for
+        // a used one to go back with the request
+        if((req->opType == Gem_rw_type::WR_INC)
+                || (req->opType == Gem_rw_type::WR_FIFO))
+            m_core.write(req->base, req->numRegs, req->wire, req->wireCap
+                         , req->opType, req->ctx, req->prio, req->isLast);
+        else
+            m_core.rw(req->base, req->numRegs, nullptr, req->opType
+                      , req->ctx, req->prio);
+        m_queues->requestPool.put(req);
+    }
+    m_core.endBatch();
+    update();
+}
+
+// Pass on the results of the last call into the core, and follow any change
+// to its timeout
+void Gemini_engine::update()
+{
+    flushResults();
+    int msec = m_core.getTimeoutMsec();
+    if(msec < 0)
+        m_timer->stop();
+    else
+        m_timer->start(msec);
+}
+
+// Signal Gemini_comms once for all the results queued since it last looked,
+// unless it hasn't yet drained the queue after the previous signal
+void Gemini_engine::flushResults()
+{
+    if(!m_hasNewResults)
+        return;
+    m_hasNewResults = false;
+    if(!m_queues->isResultPosted.exchange(true))
+        emit resultsReady();
+}
+
+void Gemini_engine::onCnxResult(Gem_cnx_rslt rslt)
+{
+    // Only an accepted connection has a payload size
+    if(rslt == Gem_cnx_rslt::OK)
+        m_maxPayloadWords = m_core.getMaxPayloadWords();
+    emit cnx_result(rslt);
+}
+
+// Deliver the failed transactions before the failure
+void Gemini_engine::onCnxFailed()
+{
+    flushResults();
+    emit cnx_failed();
+}
+
+void Gemini_engine::onRwResult(const Gem_rw_result &res)
+{
+    Gem_result *r = m_queues->resultPool.get();
+    *static_cast<Gem_rw_result *>(r) = res;
+    m_queues->results.push(r);
+    m_hasNewResults = true;
+}
+
+void Gemini_engine::onLog(Gem_log_level level, const char *msg)
+{
+    switch(level)
+    {
+    case Gem_log_level::DEBUG:
+        qDebug().noquote() << msg;
+        break;
+    case Gem_log_level::WARNING:
+        qWarning().noquote() << msg;
+        break;
+    default:
+        qCritical().noquote() << msg;
+        break;
+    }
+}
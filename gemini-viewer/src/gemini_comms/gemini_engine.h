@@ -0,0 +1,160 @@
+/* Qt adapter running a Gem_core for Gemini_comms, in an I/O thread of its own
+ * so that the protocol isn't held up by (and doesn't hold up) the thread
+ * using it. The core's socket is watched with a QSocketNotifier and its
+ * timeouts with a QTimer.
+ *
+ * Requests come in through a lock-free queue from RwChannel::rw, and results
+ * go back through another, with the other thread signalled once per batch
+ * rather than once per item. Queue entries are recycled, and write data is
+ * copied once, into a buffer laid out as the packet that Gem_core sends
+ * straight from, so neither allocates once traffic has got going.
+ */
+#ifndef GEMINI_ENGINE_H
+#define GEMINI_ENGINE_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <cstdint>
+#include <atomic>
+#include <memory> // for unique_ptr
+#include "gem_core.h"
+#include "mpsc_queue.h"
+
+// Most unused queue entries of each kind kept for reuse
+#define GEM_POOL_MAX_NODES 1024
+
+Q_DECLARE_METATYPE(Gem_cnx_rslt)
+
+// Read or write request from a RwChannel, or the part of one that fits a PDU
+// if it's a write
+struct Gem_request
+{
+    std::atomic<Gem_request*> next;
+    uint32_t base;
+    uint32_t numRegs;
+    Gem_rw_type opType;
+    uint32_t ctx;
+    Gem_priority prio;
+    bool isLast;                  // last part of the RwChannel's request
+    std::unique_ptr<char[]> wire; // write data, after GEM_WIRE_HDR_BYTES
+    uint32_t wireCap;             // bytes allocated for wire, kept on reuse
+
+    Gem_request() : wireCap(0) {}
+};
+
+// Result of a request, for the RwChannel that made it
+struct Gem_result: Gem_rw_result
+{
+    std::atomic<Gem_result*> next;
+};
+
+// Queue entries one thread has finished with, for reuse by the thread that
+// fills the queue, which is the pool's only consumer. No more than
+// GEM_POOL_MAX_NODES are kept, so a burst doesn't hold on to memory for good
+template<class T>
+class Node_pool
+{
+    private:
+        Mpsc_queue<T> m_free;
+        std::atomic<uint32_t> m_size; // about right while in use
+
+    public:
+        Node_pool() : m_size(0) {}
+        ~Node_pool()
+        {
+            while(T *node = m_free.pop())
+                delete node;
+        }
+        Node_pool(const Node_pool&) = delete; // no copy
+        Node_pool& operator=(const Node_pool &) = delete; // no assign
+
+        // Consumer thread only. A used node, or a new one if none is free
+        T * get()
+        {
+            T *node = m_free.pop();
+            if(!node)
+                return new T;
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            return node;
+        }
+
+        // Any thread
+        void put(T *node)
+        {
+            if(m_size.load(std::memory_order_relaxed) >= GEM_POOL_MAX_NODES)
+            {
+                delete node;
+                return;
+            }
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            m_free.push(node);
+        }
+};
+
+// Queues between Gemini_comms (and its channels) and the engine. Each
+// 'posted' flag is set by the side that queues when it signals the other,
+// and cleared by the other side before it drains the queue. Entries taken
+// off a queue go back to the side that fills it through its pool
+struct Gem_queues
+{
+    Mpsc_queue<Gem_request> requests;
+    std::atomic<bool> isRequestPosted;
+    Mpsc_queue<Gem_result> results;
+    std::atomic<bool> isResultPosted;
+    Node_pool<Gem_request> requestPool;
+    Node_pool<Gem_result> resultPool;
+
+    Gem_queues() : isRequestPosted(false), isResultPosted(false) {}
+};
+
+class Gemini_engine: public QObject, private Gem_core_listener
+{
+    Q_OBJECT
+
+    private:
+        Gem_queues *m_queues;
+        Gem_core m_core;
+        QSocketNotifier *m_notifier;
+        QTimer *m_timer;
+        bool m_hasNewResults; // results queued but other side not signalled
+        std::atomic<uint32_t> m_maxPayloadWords; // core's, for other threads
+
+        void flushResults();
+        void update(); // after each call into the core
+
+        // Gem_core_listener
+        void onCnxResult(Gem_cnx_rslt rslt) override;
+        void onCnxFailed() override;
+        void onRwResult(const Gem_rw_result &res) override;
+        void onLog(Gem_log_level level, const char *msg) override;
+    private slots:
+        void onReadable();
+        void onTimeout();
+    public:
+        Gemini_engine(const Gemini_engine&) = delete; // no copy
+        Gemini_engine& operator=(const Gemini_engine &) = delete; // no assign
+        Gemini_engine(QHostAddress addr, const uint16_t port
+                , const uint64_t timeout_msec
+                , const uint32_t retries, Gem_queues *queues);
+
+        uint64_t getNumResent() { return m_core.getNumResent(); }
+        uint64_t getNumGoBacks() { return m_core.getNumGoBacks(); }
+        int64_t getSrttUsec() { return m_core.getSrttUsec(); }
+        int64_t getRttVarUsec() { return m_core.getRttVarUsec(); }
+        int64_t getRtoUsec() { return m_core.getRtoUsec(); }
+        // Set before cnx_result is signalled
+        uint32_t getMaxPayloadWords() { return m_maxPayloadWords; }
+    public slots:
+        void start(); // create timer, in the I/O thread
+        void stop();  // delete it and the notifier, as the I/O thread finishes
+        void udpConnect(); // Initiate connection to FPGA server
+        void onRequestsQueued();
+    signals:
+        void cnx_result(Gem_cnx_rslt); // Callback result of CNX attempt
+        void cnx_failed(); // comms failure
+        void resultsReady(); // results queued for Gemini_comms
+};
+
+#endif
@@ -0,0 +1,966 @@
+#include "gem_core.h"
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <utility> // for swap
+#include <cerrno>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define GEMVER 1
+#define MIN_GEMCNX_BYTES 12
+
+#define PKT_OVERHEAD_BYTES 54 // Ethernet+IP+UDP+Gemini header total size
+#define LOG_MSG_BYTES 256
+
+enum class GemCmd:uint8_t {CNX=1, READ_R, READ_I, WRITE_R, WRITE_I
+                           , ACK=0x10, NACKT=0x20, NACKP=0x40, PUB=0x80};
+
+// Trace data for received packets
+#define RECORD_LEN 8  // number of recent packets to keep as debug trace
+#define RECORD_NBYTES 64 // max number of bytes from each packet for debug
+struct Packet_record
+{
+    uint32_t len;
+    uint8_t data[RECORD_NBYTES];
+};
+
+static const char * toCmdName(GemCmd cmd)
+{
+    switch(cmd)
+    {
+    case GemCmd::CNX:
+        return "CNX";
+    case GemCmd::READ_R:
+        return "READ_FIFO";
+    case GemCmd::READ_I:
+        return "READ";
+    case GemCmd::WRITE_R:
+        return "WRITE_FIFO";
+    case GemCmd::WRITE_I:
+        return "WRITE";
+    case GemCmd::ACK:
+        return "ACK";
+    case GemCmd::NACKT:
+        return "NACKT";
+    case GemCmd::NACKP:
+        return "NACKP";
+    case GemCmd::PUB:
+        return "PUBLISH";
+    default:
+        return "UNKNOWN_CMD";
+    }
+}
+
+// Between host order and the little-endian order of Gemini header fields.
+// Swapping is its own inverse, so these convert either way
+static inline uint16_t le16(uint16_t v)
+{
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&v);
+    return static_cast<uint16_t>(b[0] | (b[1] << 8));
+}
+static inline uint32_t le32(uint32_t v)
+{
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(&v);
+    return static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8)
+            | (static_cast<uint32_t>(b[2]) << 16)
+            | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+// on-wire order of Gemini packet header
+struct Gemini_comms_hdr
+{
+        uint8_t ver;
+        GemCmd op;
+        uint8_t cli_seq;
+        uint8_t svr_seq;
+        uint32_t base_addr;
+        uint16_t num_regs;
+        uint16_t fail_code;
+};
+// on-wire order of Gemini connect response payload
+struct Gemini_payload_cnx_ack
+{
+    uint32_t maxpdu;
+    uint32_t pipeline;
+    uint32_t cnxid;
+};
+
+static_assert(sizeof(Gemini_comms_hdr) == GEM_WIRE_HDR_BYTES
+              , "header must come before write data");
+#define CLI_SEQ_OFFSET 2 // byte offset of cli_seq in Gemini_comms_hdr
+// Later replies received before retrying a transaction without waiting for
+// its timeout. More than one, in case the network reorders packets
+#define FAST_RETRY_REPLIES 3
+// Clamps on retransmission timeout. Timeouts below the minimum would mostly
+// be spurious given timer resolution and host scheduling delays
+#define RTO_MIN_MSEC 10
+#define RTO_MAX_MSEC 2000
+
+void Gem_core_listener::onLog(Gem_log_level level, const char *msg)
+{
+    if(level != Gem_log_level::DEBUG)
+        fprintf(stderr, "%s\n", msg);
+}
+
+Gem_core::Gem_core(uint32_t addr, const uint16_t port
+                   , const uint64_t timeout_msec, const uint32_t retries
+                   , Gem_core_listener *listener)
+    : m_listener(listener)
+    , m_addr(addr)
+    , m_port(port)
+    , m_timeoutmsec(timeout_msec)
+    , m_maxRetries(retries)
+    , m_fd(-1)
+    , m_phase(Phase::IDLE)
+    , m_deadlineUs(-1)
+    , m_cnxRetryCount(0)
+    , m_isConnected(false)
+    , m_numInTransit(0)
+    , m_numSends(0)
+    , m_isRecovering(false)
+    , m_recoverSeq(0)
+    , m_isBatch(false)
+    , m_pipelineLen(0) // until the server gives them in its CNX ACK
+    , m_maxPduBytes(128) // initially only small packets sent
+    , m_maxPayloadWords(0)
+    , m_cli_seq(0)
+    , m_svr_seq(0)
+    , m_numResent(0)
+    , m_numGoBacks(0)
+    , m_srttUs(0)
+    , m_rttVarUs(0)
+    , m_rtoUs(0)
+    // Caller's timeout is used until round trips have been measured
+    , m_rtt(timeout_msec*1000, RTO_MIN_MSEC*1000
+            , ((timeout_msec > RTO_MAX_MSEC) ? timeout_msec : RTO_MAX_MSEC)*1000)
+{
+    snprintf(m_addrText, sizeof(m_addrText), "%u.%u.%u.%u:%u"
+             , (addr >> 24) & 0xff, (addr >> 16) & 0xff, (addr >> 8) & 0xff
+             , addr & 0xff, port);
+    m_sched.setPacketSize(m_maxPduBytes, PKT_OVERHEAD_BYTES);
+    updateRttStats();
+}
+
+Gem_core::~Gem_core()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);
+}
+
+void Gem_core::log(Gem_log_level level, const char *fmt, ...)
+{
+    char msg[LOG_MSG_BYTES];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    m_listener->onLog(level, msg);
+}
+
+int64_t Gem_core::nowUsec()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Non-blocking UDP socket, connected so that it only receives from the server
+bool Gem_core::openSocket()
+{
+    m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(m_fd < 0)
+    {
+        log(Gem_log_level::CRITICAL, "Can't create socket for %s: %s"
+            , m_addrText, strerror(errno));
+        return false;
+    }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(m_addr);
+    sa.sin_port = htons(m_port);
+    int flags = fcntl(m_fd, F_GETFL, 0);
+    if((flags < 0) || (fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+            || (connect(m_fd, reinterpret_cast<struct sockaddr *>(&sa)
+                        , sizeof(sa)) < 0))
+    {
+        log(Gem_log_level::CRITICAL, "Can't open socket to %s: %s"
+            , m_addrText, strerror(errno));
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Low-level packet write
+void Gem_core::sendPdu(const char *data, uint32_t len)
+{
+    if(len < m_maxPduBytes)
+        send(m_fd, data, len, 0);
+    else
+        log(Gem_log_level::CRITICAL, "Discard oversize PDU to %s (len = %u"
+            " bytes)", m_addrText, len);
+}
+
+/* ================  Methods for connecting to FPGA server ================= */
+// Initiate connection to Gemini server (FPGA)
+void Gem_core::udpConnect()
+{
+    if(m_isConnected)
+    {
+        m_listener->onCnxResult(Gem_cnx_rslt::OK);
+        return;
+    }
+    if((m_fd < 0) && !openSocket())
+    {
+        m_listener->onCnxResult(Gem_cnx_rslt::FAIL_PERM);
+        return;
+    }
+
+    m_cnxRetryCount = 0;
+    m_cli_seq = 0x1;
+    m_phase = Phase::CONNECTING;
+    onCnxTimeout();
+}
+// Sends both first Connect attempt and subsequent retries
+void Gem_core::onCnxTimeout()
+{
+
+    if(m_cnxRetryCount >= m_maxRetries)
+    {
+        m_phase = Phase::IDLE;
+        log(Gem_log_level::DEBUG, "Timeout on Connect to %s (%u tries)"
+            , m_addrText, m_cnxRetryCount);
+        m_listener->onCnxResult(Gem_cnx_rslt::TIMEOUT);
+        return;
+    }
+    ++m_cnxRetryCount;
+    startTimer(m_timeoutmsec);
+    Gemini_comms_hdr pkt = { GEMVER, GemCmd::CNX, m_cli_seq
+                             , 0x0, 0x0, 0x0, 0x0};
+    sendPdu(reinterpret_cast<char *>(&pkt), sizeof(pkt));
+}
+// Handles one packet while expecting a CNX response
+void Gem_core::onCnxReply(const char *buf, int64_t len)
+{
+    const Gemini_comms_hdr *pkt = reinterpret_cast<const Gemini_comms_hdr *>(buf);
+
+    // Is packet too small to be a Gemini connection response
+    if(len < static_cast<int64_t>(sizeof(Gemini_comms_hdr)
+                                + sizeof(Gemini_payload_cnx_ack)))
+    {
+        log(Gem_log_level::WARNING, "CNX packet RX %lld bytes"
+            , static_cast<long long>(len));
+        //return; //FIXME: uncomment when software simulation is fixed < ----------------
+    }
+
+    // Is the packet wrong version, wrong number of regs for CNX ACK/NACK
+    if((pkt->ver != GEMVER)
+            // FTODO: should server_seq always be 1, not just when ACK received?
+            || ((pkt->op == GemCmd::ACK) && (pkt->svr_seq != 1))
+            // FIXME: uncomment when software simulation is fixed  <---------------------
+            // || (le16(pkt->num_regs) != 3)
+            )
+    {
+        log(Gem_log_level::WARNING, "CNX packet RX, got ver=%u cmd=%u"
+            " svr_seq=%u cli_seq=%u num_regs=%u", pkt->ver
+            , static_cast<uint8_t>(pkt->op), pkt->svr_seq, pkt->cli_seq
+            , le16(pkt->num_regs));
+        return;
+    }
+
+    switch(pkt->op)
+    {
+    case GemCmd::ACK:
+        stopTimer();
+        {
+        const Gemini_payload_cnx_ack *ack_data =
+                reinterpret_cast<const Gemini_payload_cnx_ack*>(pkt+1);
+        m_maxPayloadWords = le32(ack_data->maxpdu);
+        // FPGAs used to advertise 1990 words payload, but really only handled
+        //   1985 words before ethernet MAC failed. Use 1984 if we detect this.
+        if(m_maxPayloadWords == 1990)
+        {
+            log(Gem_log_level::DEBUG, "FPGA workaround, using 1984 words"
+                " instead of 1990 for maximum register payload length");
+            m_maxPayloadWords = 1984;
+        }
+        m_maxPduBytes = m_maxPayloadWords*4; // words->bytes
+        m_sched.setPacketSize(m_maxPduBytes, PKT_OVERHEAD_BYTES);
+        m_rxBatch.reserve(m_maxPduBytes+PKT_OVERHEAD_BYTES);
+        m_pipelineLen = le32(ack_data->pipeline);
+
+        log(Gem_log_level::DEBUG, "Got CNX ACK ver=%u cmd=%u svr_seq=%u"
+            " cli_seq=%u num_regs=%u max_pdu=%u pipeline=%u cnxid=%u len=%lld"
+            , pkt->ver, static_cast<uint8_t>(pkt->op), pkt->svr_seq
+            , pkt->cli_seq, le16(pkt->num_regs), m_maxPayloadWords
+            , m_pipelineLen, le32(ack_data->cnxid)
+            , static_cast<long long>(len));
+
+        }
+        m_isConnected = true;
+        m_phase = Phase::CONNECTED;
+        m_cli_seq = pkt->svr_seq;
+        m_numInTransit = 0;
+        m_isRecovering = false;
+
+        m_listener->onCnxResult(Gem_cnx_rslt::OK);
+        break;
+
+    case GemCmd::NACKT:
+        stopTimer();
+        m_phase = Phase::IDLE;
+        log(Gem_log_level::DEBUG, "Got CNX NACKT ver=%u cmd=%u svr_seq=%u"
+            " cli_seq=%u len=%lld", pkt->ver, static_cast<uint8_t>(pkt->op)
+            , pkt->svr_seq, pkt->cli_seq, static_cast<long long>(len));
+        m_listener->onCnxResult(Gem_cnx_rslt::FAIL_TEMP);
+        break;
+
+    case GemCmd::NACKP:
+        stopTimer();
+        m_phase = Phase::IDLE;
+        log(Gem_log_level::DEBUG, "Got CNX NACKP ver=%u cmd=%u svr_seq=%u"
+            " cli_seq=%u len=%lld", pkt->ver, static_cast<uint8_t>(pkt->op)
+            , pkt->svr_seq, pkt->cli_seq, static_cast<long long>(len));
+        m_listener->onCnxResult(Gem_cnx_rslt::FAIL_PERM);
+        break;
+
+    default:
+        log(Gem_log_level::DEBUG, "Unexpected CNX response ver=%u cmd=%u"
+            " svr_seq=%u cli_seq=%u len=%lld", pkt->ver
+            , static_cast<uint8_t>(pkt->op), pkt->svr_seq, pkt->cli_seq
+            , static_cast<long long>(len));
+        // Wait to see if another packet arrives or timeout
+        break;
+    }
+}
+/* ===========  End of Methods for connecting to FPGA server ============== */
+
+// Gemini command for a kind of request. False if it's not one
+static bool toGemCmd(Gem_rw_type opType, GemCmd &op)
+{
+    switch(opType)
+    {
+    case Gem_rw_type::READ_INC:
+        op = GemCmd::READ_I;
+        return true;
+    case Gem_rw_type::READ_FIFO:
+        op = GemCmd::READ_R;
+        return true;
+    case Gem_rw_type::WR_INC:
+        op = GemCmd::WRITE_I;
+        return true;
+    case Gem_rw_type::WR_FIFO:
+        op = GemCmd::WRITE_R;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Serialise the header at the front of a transaction's wire buffer. Only
+// cli_seq changes when the packet is sent
+static void putHeader(char *wire, GemCmd op, uint32_t base, uint32_t numRegs)
+{
+    Gemini_comms_hdr *hdr = reinterpret_cast<Gemini_comms_hdr *>(wire);
+    hdr->ver = GEMVER;
+    hdr->op = op;
+    hdr->cli_seq = 0;
+    hdr->svr_seq = 0;
+    hdr->base_addr = le32(base);
+    hdr->num_regs = le16(static_cast<uint16_t>(numRegs));
+    hdr->fail_code = 0;
+}
+
+// Method to read/write remote FPGA registers
+void Gem_core::rw(uint32_t base, uint32_t numRegs, const uint32_t *regs
+                  , Gem_rw_type opType, uint32_t ctx, Gem_priority prio)
+{
+    queueRw(base, numRegs, regs, opType, ctx, prio, true);
+}
+
+void Gem_core::write(uint32_t base, uint32_t numRegs
+                     , std::unique_ptr<char[]> &wire, uint32_t &wireCap
+                     , Gem_rw_type opType, uint32_t ctx, Gem_priority prio
+                     , bool isLast)
+{
+    const uint32_t *regs = wire ? reinterpret_cast<const uint32_t *>(
+                wire.get() + GEM_WIRE_HDR_BYTES) : nullptr;
+    GemCmd op;
+    bool isWrite = (opType == Gem_rw_type::WR_INC)
+                    || (opType == Gem_rw_type::WR_FIFO);
+    if(!m_isConnected || !isWrite || (numRegs == 0)
+            || (numRegs > m_maxPayloadWords) || !toGemCmd(opType, op))
+    {
+        // Failed, or split into PDUs, like any other request
+        queueRw(base, numRegs, regs, opType, ctx, prio, isLast);
+        return;
+    }
+
+    // Swap buffers with the slot, which then only needs the header adding
+    Gemini_transaction &t = queueTrans(base, numRegs, opType, ctx, prio
+                                       , isLast);
+    std::swap(t.wire, wire);
+    std::swap(t.wireCap, wireCap);
+    t.wireLen = GEM_WIRE_HDR_BYTES + numRegs*4;
+    putHeader(t.wire.get(), op, base, numRegs);
+
+    if(!m_isBatch)
+        trySendTransactions();
+}
+
+// Queue the transactions for a request, copying any write data. isLast:
+// the request is the last part of the caller's
+void Gem_core::queueRw(uint32_t base, uint32_t numRegs, const uint32_t *regs
+                       , Gem_rw_type opType, uint32_t ctx, Gem_priority prio
+                       , bool isLast)
+{
+    if(!m_isConnected)
+    {
+        // Connection failed while the request was queued
+        postResult(ctx, isLast, true, base, numRegs, Reg_view(), opType
+                   , false, 0);
+        return;
+    }
+
+    GemCmd op;
+    if(!toGemCmd(opType, op))
+    {
+        log(Gem_log_level::WARNING, "Unknown Gemini_rw_type ... skipped");
+        postResult(ctx, isLast, false, base, numRegs, Reg_view(), opType
+                   , false, 0);
+        return;
+    }
+    bool isWrite = (opType == Gem_rw_type::WR_INC)
+                    || (opType == Gem_rw_type::WR_FIFO);
+
+    // Split write into transactions that don't exceed maximum PDU size
+    while(numRegs > 0)
+    {
+        uint32_t regs_sent = numRegs;
+        if(regs_sent > m_maxPayloadWords)
+            regs_sent = m_maxPayloadWords;
+
+        Gemini_transaction &t = queueTrans(base, regs_sent, opType, ctx, prio
+                                           , isLast && (regs_sent == numRegs));
+
+        // Serialise header straight into the slot's wire buffer, followed by
+        // the write data
+        uint32_t data_bytes = isWrite ? regs_sent*4 : 0;
+        char *wire = t.reserveWire(GEM_WIRE_HDR_BYTES + data_bytes);
+        putHeader(wire, op, base, regs_sent);
+        if(isWrite)
+            memcpy(wire + GEM_WIRE_HDR_BYTES, regs, data_bytes);
+
+        numRegs -= regs_sent;
+        if(isWrite)
+            regs += regs_sent;
+        base += regs_sent;
+
+    }
+
+    // Requests are sent once the whole batch they came in has been handled
+    if(!m_isBatch)
+        trySendTransactions();
+}
+
+// Queue a transaction, filling in everything but its wire buffer
+Gemini_transaction & Gem_core::queueTrans(uint32_t base, uint32_t numRegs
+                                          , Gem_rw_type opType, uint32_t ctx
+                                          , Gem_priority prio, bool isLast)
+{
+    Gemini_transaction &t = m_sched.pushBack(ctx, prio);
+    t.rwType = opType;
+    t.base = base;
+    t.numRegs = numRegs;
+    t.state = Trans_state::QUEUED;
+    t.sendCount = 0;
+    t.retryCount = 0;
+    t.cli_seq = 0;
+    t.ctx = ctx;
+    t.isLast = isLast;
+    return t;
+}
+
+void Gem_core::endBatch()
+{
+    m_isBatch = false;
+    if(m_isConnected)
+        trySendTransactions();
+}
+
+
+// Send more transactions if possible
+void Gem_core::trySendTransactions()
+{
+    // New requests would only be rejected by the server while it's missing
+    // the one we're recovering
+    if(m_isRecovering)
+        return;
+
+    // Transactions join the list as they're sent, in the order the scheduler
+    // picks, so they take their sequence numbers in list order. The span of
+    // sequence numbers awaiting replies mustn't exceed what the FPGA can
+    // buffer, which is also how many replies it keeps to replay to retries
+    bool isSent = false;
+    while(!m_sched.isEmpty() && (m_numInTransit < m_pipelineLen))
+    {
+        m_sched.moveNext(m_transList);
+        sendGeminiTransaction(m_transList.at(m_numInTransit));
+        isSent = true;
+    }
+    if(isSent)
+        startTimeoutTimer();
+}
+
+// Retry a transaction that the server didn't answer. Returns false if it has
+// run out of retries and the connection has been closed
+bool Gem_core::retryTransaction(Gemini_transaction &trans)
+{
+    if(trans.retryCount >= m_maxRetries)
+    {
+        // Exceeded the number of retries: connection failed
+        log(Gem_log_level::DEBUG, "Connection to %s FAILED on all %u retries"
+            , m_addrText, m_maxRetries);
+        closeConnection();
+        m_listener->onCnxFailed();
+        return false;
+    }
+    trans.retryCount++;
+    writeTransaction(trans);
+    return true;
+}
+
+// The server executes requests strictly in sequence, so when the request at
+// idx was lost it rejected every later one too. Retry it, then resend those
+// of the later ones that haven't been answered, with their original sequence
+// numbers. Requests the server did execute just get their replies again.
+bool Gem_core::goBack(uint32_t idx)
+{
+    if(!retryTransaction(m_transList.at(idx)))
+        return false;
+    m_isRecovering = true;
+    m_recoverSeq = m_transList.at(idx).cli_seq;
+    for(uint32_t i=idx+1; i<m_numInTransit; i++)
+    {
+        Gemini_transaction &trans = m_transList.at(i);
+        if(trans.state != Trans_state::DONE)
+            writeTransaction(trans);
+    }
+    m_numGoBacks++;
+    return true;
+}
+
+// First send of a transaction, giving it the next sequence number
+void Gem_core::sendGeminiTransaction(Gemini_transaction &trans)
+{
+    ++m_cli_seq;
+    // Header and data were placed in the wire buffer when the transaction
+    // was queued, only the sequence number remains to be filled in
+    trans.wire[CLI_SEQ_OFFSET] = static_cast<char>(m_cli_seq);
+    trans.cli_seq = m_cli_seq;
+    trans.state = Trans_state::SENT;
+    m_numInTransit++;
+    writeTransaction(trans);
+}
+
+void Gem_core::writeTransaction(Gemini_transaction &trans)
+{
+    // Send as UDP packet
+    send(m_fd, trans.wire.get(), trans.wireLen, 0);
+
+    // Update accounting info
+    if(trans.sendCount != 0)
+        m_numResent++;
+    trans.sendCount++;
+    trans.laterReplies = 0;
+    trans.sendNum = ++m_numSends;
+    // Each retry waits twice as long as the previous one
+    trans.sentTimeUs = nowUsec();
+    trans.timeoutTimeUs = trans.sentTimeUs
+            + m_rtt.getBackedOffRtoUsec(trans.retryCount);
+}
+
+void Gem_core::closeConnection()
+{
+    m_isConnected = false;
+    m_phase = Phase::IDLE;
+    stopTimer();
+    while(!m_sched.isEmpty())
+        m_sched.moveNext(m_transList);
+    for(uint32_t i=0; i<m_transList.size(); i++)
+    {
+        // Notify all pending transactions that timeout occurred
+        Gemini_transaction &trans = m_transList.at(i);
+        postResult(trans.ctx, trans.isLast, true, trans.base, trans.numRegs
+                   , Reg_view(), trans.rwType, false, 0);
+        trans.reply = Reg_view();
+    }
+    m_transList.clear();
+    m_numInTransit = 0;
+    m_isRecovering = false;
+}
+
+void Gem_core::onReadable()
+{
+    if(m_fd < 0)
+        return;
+    if(m_phase == Phase::CONNECTED)
+    {
+        onPktReadable();
+        return;
+    }
+
+    char buf[sizeof(Gemini_comms_hdr) + sizeof(Gemini_payload_cnx_ack)+8];
+    int64_t len;
+    while((len = recv(m_fd, buf, sizeof(buf), 0)) >= 0)
+    {
+        // Nobody is listening when not connecting
+        if(m_phase != Phase::CONNECTING)
+            continue;
+        onCnxReply(buf, len);
+        // Replies may follow the CNX ACK in the same wakeup
+        if(m_phase == Phase::CONNECTED)
+        {
+            onPktReadable();
+            return;
+        }
+    }
+}
+
+// Receive all the replies waiting, and only then send more requests
+void Gem_core::onPktReadable()
+{
+    m_isBatch = true;
+    while(true)
+    {
+        m_rxBatch.clear();
+#ifdef __linux__
+        m_rxBatch.receive(m_fd);
+#else
+        while(!m_rxBatch.isFull())
+        {
+            int64_t len = recv(m_fd, m_rxBatch.nextBuf()
+                               , m_rxBatch.getBufBytes(), 0);
+            if(len < 0)
+                break;
+            m_rxBatch.push(len);
+        }
+#endif
+        for(uint32_t i=0; (i<m_rxBatch.size()) && m_isConnected; i++)
+            processReply(m_rxBatch.replyBuf(i), m_rxBatch.len(i));
+
+        // A batch that isn't full means the socket has been drained
+        if(!m_isConnected || !m_rxBatch.isFull())
+            break;
+    }
+    m_isBatch = false;
+
+    if(!m_isConnected)
+        return;
+    trySendTransactions();
+    startTimeoutTimer();
+}
+
+void Gem_core::processReply(Reply_buf *rb, int64_t len)
+{
+    char *buf = rb->data;
+    // Discard if too small to have a Gemini header
+    if(len < static_cast<int64_t>(sizeof(Gemini_comms_hdr)))
+    {
+        log(Gem_log_level::WARNING, "Runt Packet RX %lld bytes"
+            , static_cast<long long>(len));
+        return;
+    }
+    Gemini_comms_hdr *pkt = reinterpret_cast<Gemini_comms_hdr *>(buf);
+
+    recordRxPacket(buf, len);
+
+    // Discard if wrong gemini version
+    if(pkt->ver != GEMVER)
+    {
+        log(Gem_log_level::WARNING, "Gemini protocol version mismatch (%u)"
+            , pkt->ver);
+        return;
+    }
+
+    // A late second reply to a retried request can arrive after all replies
+    if(m_numInTransit == 0)
+    {
+        log(Gem_log_level::DEBUG, "Discard Gemini packet, nothing in transit"
+            " (seq=%u %s)", pkt->svr_seq, toCmdName(pkt->op));
+        return;
+    }
+    uint8_t frontSeq = m_transList.front().cli_seq;
+
+    // NACKT carries the sequence number of the last request the server
+    // executed: the one after it was lost on the way to the FPGA. Several
+    // NACKTs arrive for one loss, one per later request in the pipeline, so
+    // only the first starts recovery
+    if(pkt->op == GemCmd::NACKT)
+    {
+        uint8_t missingSeq = pkt->svr_seq + 1;
+        uint32_t idx = static_cast<uint8_t>(missingSeq - frontSeq);
+        if((idx >= m_numInTransit)
+                || (m_transList.at(idx).state == Trans_state::DONE)
+                || (m_isRecovering && (missingSeq == m_recoverSeq)))
+            return;
+
+        log(Gem_log_level::DEBUG, "NACKT from Gemini server, resending from"
+            " seq=%u (oldest seq=%u)", missingSeq, frontSeq);
+
+        goBack(idx);
+        return;
+    }
+
+    if((pkt->op != GemCmd::ACK) && (pkt->op != GemCmd::NACKP))
+    {
+        log(Gem_log_level::WARNING, "Discard Gemini packet. Expected ACK but"
+            " got cmd=%d", static_cast<int>(pkt->op));
+        return;
+    }
+
+    // We have a response to a request (either ACK or NACKP). Ignore it if
+    // it's a second reply to a request we retried
+    uint32_t idx = static_cast<uint8_t>(pkt->svr_seq - frontSeq);
+    if((idx >= m_numInTransit)
+            || (m_transList.at(idx).state == Trans_state::DONE))
+        return;
+    Gemini_transaction &trans = m_transList.at(idx);
+    if(m_isRecovering && (trans.cli_seq == m_recoverSeq))
+        m_isRecovering = false;
+    // Only a transaction sent once tells the round trip time: a reply to a
+    // retried one might be answering any of its sends
+    if(trans.sendCount == 1)
+    {
+        m_rtt.addSample(nowUsec() - trans.sentTimeUs);
+        updateRttStats();
+    }
+
+    // read transactions should have matching number of registers returned
+    if(((trans.rwType == Gem_rw_type::READ_INC)
+        || (trans.rwType == Gem_rw_type::READ_FIFO))
+            && (trans.numRegs != le16(pkt->num_regs)))
+    {
+        log(Gem_log_level::WARNING, "Requested %u regs, but got reply with %u"
+            , trans.numRegs, le16(pkt->num_regs));
+        printRxTraceToLog();
+    }
+
+    // Replies are passed on in the order transactions were submitted. If an
+    // earlier reply is missing (lost on the way from the FPGA), keep this
+    // one with its transaction until the retry of the earlier one is answered
+    trans.state = Trans_state::DONE;
+    if(idx != 0)
+    {
+        trans.reply = Reg_view(rb, 0, (len+3)/4);
+        trans.replyLen = len;
+
+        // The server executes requests in order, so earlier transactions
+        // still waiting were executed and their replies most likely lost.
+        // The server replays them when asked again. Only replies to
+        // transactions sent after an earlier one's last send say anything
+        // about that send, so each send is fast retried at most once, and
+        // a retry that's lost again is left to the timeout
+        for(uint32_t i=0; i<idx; i++)
+        {
+            Gemini_transaction &earlier = m_transList.at(i);
+            if((earlier.state != Trans_state::SENT)
+                    || (trans.sendNum < earlier.sendNum)
+                    || (++earlier.laterReplies != FAST_RETRY_REPLIES))
+                continue;
+            if(!retryTransaction(earlier))
+                return;
+        }
+        return;
+    }
+
+    retireFront(Reg_view(rb, 0, (len+3)/4), len);
+    while((m_transList.size() > 0)
+          && (m_transList.front().state == Trans_state::DONE))
+    {
+        Gemini_transaction &held = m_transList.front();
+        Reg_view reply = std::move(held.reply);
+        retireFront(reply, held.replyLen);
+    }
+}
+
+// Retire the (answered) oldest transaction and pass the reply on, as a view
+// of the register values in the buffer it was received into
+void Gem_core::retireFront(const Reg_view &reply, int64_t len)
+{
+    const Gemini_comms_hdr *pkt =
+            reinterpret_cast<const Gemini_comms_hdr *>(reply.bytes());
+    // The slot will be reused, so keep what's needed to notify the requester
+    Gemini_transaction &trans = m_transList.front();
+    uint32_t ctx = trans.ctx;
+    bool isLast = trans.isLast;
+    uint32_t base = trans.base;
+    uint32_t numRegs = trans.numRegs;
+    Gem_rw_type rwType = trans.rwType;
+    bool isAck = (pkt->op == GemCmd::ACK);
+    uint8_t failCode = pkt->fail_code;
+    Reg_view regs;
+    if((rwType == Gem_rw_type::READ_FIFO) || (rwType == Gem_rw_type::READ_INC))
+        regs = reply.mid(sizeof(Gemini_comms_hdr)/4
+                         , (len-sizeof(Gemini_comms_hdr))/4);
+
+    m_transList.popFront();
+    m_numInTransit--;
+    postResult(ctx, isLast, false, base, numRegs, regs, rwType, isAck
+               , failCode);
+}
+
+void Gem_core::postResult(uint32_t ctx, bool isLast, bool timedOut
+                          , uint32_t base, uint32_t numRegs
+                          , const Reg_view &regs, Gem_rw_type op
+                          , bool isAck, uint8_t failCode)
+{
+    Gem_rw_result res;
+    res.ctx = ctx;
+    res.isLast = isLast;
+    res.timedOut = timedOut;
+    res.base = base;
+    res.numRegs = numRegs;
+    res.regs = regs;
+    res.op = op;
+    res.isAck = isAck;
+    res.failCode = failCode;
+    m_listener->onRwResult(res);
+}
+
+// Copies of the estimates that other threads can read
+void Gem_core::updateRttStats()
+{
+    m_srttUs = m_rtt.getSrttUsec();
+    m_rttVarUs = m_rtt.getRttVarUsec();
+    m_rtoUs = m_rtt.getRtoUsec();
+}
+
+// Keep a list of the last received packets as a debug trace
+void Gem_core::recordRxPacket(const char buf[], int64_t len)
+{
+    if(m_received_trace.size() >= RECORD_LEN)
+        m_received_trace.pop_front();
+    m_received_trace.emplace_back();
+    Packet_record &rec = m_received_trace.back();
+    rec.len = len;
+    uint32_t cpy_len = len;
+    if(cpy_len > RECORD_NBYTES)
+        cpy_len = RECORD_NBYTES;
+    memcpy(rec.data, buf, cpy_len);
+}
+
+void Gem_core::printRxTraceToLog()
+{
+    while(m_received_trace.size() > 0)
+    {
+        const Packet_record &rec = m_received_trace.front();
+
+        log(Gem_log_level::WARNING, "Packet trace");
+        uint32_t cnt = (rec.len < RECORD_NBYTES) ? rec.len : RECORD_NBYTES;
+        char txt[16*5 + 1];
+        uint32_t pos = 0;
+        for(uint32_t i=0; i<cnt; i++)
+        {
+            pos += snprintf(txt + pos, sizeof(txt) - pos, "0x%02x "
+                            , rec.data[i]);
+            if((i % 16) == 15)
+            {
+                log(Gem_log_level::WARNING, "%s", txt);
+                pos = 0;
+            }
+        }
+        if(pos != 0)
+            log(Gem_log_level::WARNING, "%s", txt);
+        log(Gem_log_level::WARNING, "    -----");
+        m_received_trace.pop_front();
+    }
+
+}
+
+// Time out at the earliest deadline of the transactions awaiting a reply
+void Gem_core::startTimeoutTimer()
+{
+    int64_t earliest = 0;
+    bool isWaiting = false;
+    for(uint32_t i=0; i<m_numInTransit; i++)
+    {
+        Gemini_transaction &trans = m_transList.at(i);
+        if(trans.state != Trans_state::SENT)
+            continue;
+        if(!isWaiting || (trans.timeoutTimeUs < earliest))
+            earliest = trans.timeoutTimeUs;
+        isWaiting = true;
+    }
+    m_deadlineUs = isWaiting ? earliest : -1;
+}
+
+// Retry only the transactions whose replies are overdue
+void Gem_core::onPktTimeout()
+{
+    int64_t now = nowUsec();
+    for(uint32_t i=0; i<m_numInTransit; i++)
+    {
+        Gemini_transaction &trans = m_transList.at(i);
+        if((trans.state != Trans_state::SENT) || (trans.timeoutTimeUs > now))
+            continue;
+
+        if(m_isRecovering && (trans.cli_seq == m_recoverSeq))
+        {
+            // Our retry of a lost request was lost too, so the later ones
+            // have been rejected again
+            if(!goBack(i))
+                return;
+            break;
+        }
+        if(!retryTransaction(trans))
+            return;
+    }
+    startTimeoutTimer();
+}
+
+void Gem_core::onTimer()
+{
+    if((m_deadlineUs < 0) || (nowUsec() < m_deadlineUs))
+        return;
+    m_deadlineUs = -1;
+    if(m_phase == Phase::CONNECTING)
+        onCnxTimeout();
+    else if(m_phase == Phase::CONNECTED)
+        onPktTimeout();
+}
+
+int Gem_core::getTimeoutMsec()
+{
+    if(m_deadlineUs < 0)
+        return -1;
+    // Round up to whole ms so the timer doesn't fire just before the deadline
+    int64_t now = nowUsec();
+    return (m_deadlineUs > now) ? (m_deadlineUs - now + 999) / 1000 : 0;
+}
+
+bool Gem_core::poll(int maxWaitMsec)
+{
+    if(m_fd < 0)
+        return false;
+    int waitMsec = getTimeoutMsec();
+    if((waitMsec < 0) || ((maxWaitMsec >= 0) && (maxWaitMsec < waitMsec)))
+        waitMsec = maxWaitMsec;
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int n = ::poll(&pfd, 1, waitMsec);
+    if(n < 0)
+        return (errno == EINTR);
+    if(n > 0)
+        onReadable();
+    onTimer();
+    return true;
+}
@@ -0,0 +1,187 @@
+/* Gemini protocol engine without Qt, for headless tools as well as for
+ * Gemini_comms, which runs one in a thread of its own.
+ *
+ * Gem_core connects to one Gemini server over UDP and does the CNX
+ * handshake, sequencing, pipelining, retries and splitting of requests into
+ * PDUs. Requests wait to be sent in a Trans_sched, by priority class. It
+ * has no event loop of its own, so any loop can drive it: watch getFd() for
+ * input and call onReadable(), and call onTimer() when getTimeoutMsec() has
+ * passed. Callers without a loop can call poll(), which waits for either.
+ * Results, connection events and log messages go to a Gem_core_listener,
+ * from within those calls.
+ *
+ * A Gem_core and its listener are used from one thread at a time; only the
+ * statistics may be read from others.
+ */
+#ifndef GEM_CORE_H
+#define GEM_CORE_H
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <memory> // for unique_ptr
+#include "trans_ring.h"
+#include "trans_sched.h"
+#include "rtt_estimator.h"
+#include "rx_batch.h"
+
+#define GEM_WIRE_HDR_BYTES 12 // Gemini header, before any write data
+
+enum class Gem_cnx_rslt{OK, FAIL_TEMP, FAIL_PERM, TIMEOUT};
+enum class Gem_log_level{DEBUG, WARNING, CRITICAL};
+
+struct Packet_record;
+
+// Result of a request, or of one of the transactions it was split into
+struct Gem_rw_result
+{
+    uint32_t ctx;
+    bool isLast; // no more results to come for the request
+    bool timedOut;
+    uint32_t base;
+    uint32_t numRegs;
+    Reg_view regs; // values read (none for writes)
+    Gem_rw_type op;
+    bool isAck;
+    uint8_t failCode;
+};
+
+class Gem_core_listener
+{
+    public:
+        virtual ~Gem_core_listener() {}
+        virtual void onCnxResult(Gem_cnx_rslt rslt) = 0;
+        // Connection given up after retries, once pending results are given
+        virtual void onCnxFailed() = 0;
+        virtual void onRwResult(const Gem_rw_result &res) = 0;
+        // Writes warnings and worse to stderr unless overridden
+        virtual void onLog(Gem_log_level level, const char *msg);
+};
+
+class Gem_core
+{
+    private:
+        enum class Phase{IDLE, CONNECTING, CONNECTED};
+
+        Gem_core_listener *m_listener;
+        uint32_t m_addr; // IPv4, host order
+        uint16_t m_port;
+        char m_addrText[24]; // "a.b.c.d:port" for log messages
+        uint64_t m_timeoutmsec;
+        uint32_t m_maxRetries;
+        int m_fd;
+        Phase m_phase;
+        int64_t m_deadlineUs; // for onTimer(), or -1 if none
+        uint32_t m_cnxRetryCount;
+        bool m_isConnected;
+        uint32_t m_numInTransit; // oldest transactions, sent and awaiting reply
+        uint64_t m_numSends; // of all transactions, numbering each send
+        bool m_isRecovering; // resending after server rejected out-of-order
+        uint8_t m_recoverSeq; // seq the server was missing when recovery began
+        bool m_isBatch; // handling a batch of received replies or requests
+        uint32_t m_pipelineLen;
+        uint32_t m_maxPduBytes;
+        uint32_t m_maxPayloadWords;
+
+        uint8_t m_cli_seq;
+        uint8_t m_svr_seq;
+        // Statistics, may be read from other threads
+        std::atomic<uint64_t> m_numResent; // transactions sent again
+        std::atomic<uint64_t> m_numGoBacks; // recoveries from server rejection
+        std::atomic<int64_t> m_srttUs;
+        std::atomic<int64_t> m_rttVarUs;
+        std::atomic<int64_t> m_rtoUs;
+        Rtt_estimator m_rtt;
+
+        Trans_sched m_sched;   // transactions waiting to be sent
+        Trans_ring m_transList; // sent, in sequence, awaiting replies
+        Rx_batch m_rxBatch;
+        std::deque<Packet_record> m_received_trace;
+
+        void log(Gem_log_level level, const char *fmt, ...)
+            __attribute__((format(printf, 3, 4)));
+        bool openSocket();
+        void startTimer(uint64_t msec) { m_deadlineUs = nowUsec() + msec*1000; }
+        void stopTimer() { m_deadlineUs = -1; }
+        void onCnxTimeout();
+        void onCnxReply(const char *buf, int64_t len);
+        void onPktReadable();
+        void onPktTimeout();
+        void startTimeoutTimer();
+        void trySendTransactions();
+        bool retryTransaction(Gemini_transaction & trans);
+        bool goBack(uint32_t idx);
+        void sendGeminiTransaction(Gemini_transaction & trans);
+        void writeTransaction(Gemini_transaction & trans);
+        void processReply(Reply_buf *rb, int64_t len);
+        void retireFront(const Reg_view &reply, int64_t len);
+        void postResult(uint32_t ctx, bool isLast, bool timedOut, uint32_t base
+                        , uint32_t numRegs, const Reg_view &regs
+                        , Gem_rw_type op, bool isAck, uint8_t failCode);
+        void updateRttStats();
+        void queueRw(uint32_t base, uint32_t numRegs, const uint32_t *regs
+                     , Gem_rw_type opType, uint32_t ctx, Gem_priority prio
+                     , bool isLast);
+        Gemini_transaction & queueTrans(uint32_t base, uint32_t numRegs
+                                        , Gem_rw_type opType, uint32_t ctx
+                                        , Gem_priority prio, bool isLast);
+        void sendPdu(const char *data, uint32_t len);
+        void closeConnection();
+        void recordRxPacket(const char buf[], int64_t len);
+        void printRxTraceToLog();
+
+    public:
+        Gem_core(const Gem_core&) = delete; // no copy
+        Gem_core& operator=(const Gem_core &) = delete; // no assign
+        // addr: server's IPv4 address, in host byte order
+        Gem_core(uint32_t addr, const uint16_t port
+                 , const uint64_t timeout_msec, const uint32_t retries
+                 , Gem_core_listener *listener);
+        ~Gem_core();
+
+        void udpConnect(); // Initiate connection to FPGA server
+        bool isConnected() const { return m_isConnected; }
+        // Registers per PDU, as the server gave when connecting (0 before)
+        uint32_t getMaxPayloadWords() const { return m_maxPayloadWords; }
+        // Queue a read or write of registers. Data to write is copied.
+        // Requests with the same ctx are sent in order, in the class of the
+        // latest of them
+        void rw(uint32_t base, uint32_t numRegs, const uint32_t *regs
+                , Gem_rw_type opType, uint32_t ctx
+                , Gem_priority prio = Gem_priority::POLLING);
+        // Queue a write whose data is already in 'wire', after
+        // GEM_WIRE_HDR_BYTES of room for the header. If it fits in one PDU
+        // the buffer is sent from as it is: it becomes the transaction's, and
+        // the slot's old buffer comes back in 'wire' and 'wireCap' for reuse.
+        // Otherwise the data is copied, as by rw(). isLast: the last part of
+        // a request split by the caller
+        void write(uint32_t base, uint32_t numRegs
+                   , std::unique_ptr<char[]> &wire, uint32_t &wireCap
+                   , Gem_rw_type opType, uint32_t ctx
+                   , Gem_priority prio = Gem_priority::POLLING
+                   , bool isLast = true);
+        // Requests made between these are sent together at the end
+        void beginBatch() { m_isBatch = true; }
+        void endBatch();
+
+        // Event loop integration. The socket exists from udpConnect() on
+        int getFd() const { return m_fd; }
+        void onReadable(); // read everything waiting on the socket
+        void onTimer(); // does nothing before the timeout is due
+        // Milliseconds until onTimer() is due, or -1 if nothing is waiting
+        int getTimeoutMsec();
+        // Wait up to maxWaitMsec (-1 for no limit) for the socket or the
+        // timeout, and handle whichever happens. False on error
+        bool poll(int maxWaitMsec);
+
+        int64_t nowUsec(); // monotonic clock that transactions are timed by
+        uint64_t getNumResent() { return m_numResent; }
+        uint64_t getNumGoBacks() { return m_numGoBacks; }
+        // Current round trip estimates, and the timeout they give for a
+        // transaction's first send (microseconds)
+        int64_t getSrttUsec() { return m_srttUs; }
+        int64_t getRttVarUsec() { return m_rttVarUs; }
+        int64_t getRtoUsec() { return m_rtoUs; }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "gem_regions.h"
+#include <algorithm>
+#include <numeric>
+
+// PDUs needed to read numRegs registers
+static uint64_t numPdus(uint64_t numRegs, uint32_t maxPayloadWords)
+{
+    return (numRegs + maxPayloadWords - 1)/maxPayloadWords;
+}
+
+std::vector<Gem_region> planRegionReads(const std::vector<Gem_region> &regions
+                                        , uint32_t maxPayloadWords
+                                        , uint32_t maxHoleRegs
+                                        , std::vector<uint32_t> &readOfRegion)
+{
+    if(maxPayloadWords == 0)
+        maxPayloadWords = 1; // not connected, no payload size known yet
+
+    std::vector<uint32_t> order(regions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&regions](uint32_t a
+                                                            , uint32_t b)
+    {
+        return regions[a].base < regions[b].base;
+    });
+
+    std::vector<Gem_region> reads;
+    readOfRegion.assign(regions.size(), 0);
+    uint64_t start = 0; // of the last read
+    uint64_t end = 0;
+    for(uint32_t idx: order)
+    {
+        uint64_t regStart = regions[idx].base;
+        uint64_t regEnd = regStart + regions[idx].numRegs;
+        if(!reads.empty())
+        {
+            uint64_t hole = (regStart > end) ? (regStart - end) : 0;
+            uint64_t newEnd = std::max(end, regEnd);
+            if((hole <= maxHoleRegs)
+                && (numPdus(newEnd - start, maxPayloadWords)
+                    <= numPdus(end - start, maxPayloadWords)
+                       + numPdus(regEnd - regStart, maxPayloadWords)))
+            {
+                end = newEnd;
+                reads.back().numRegs = static_cast<uint32_t>(end - start);
+                readOfRegion[idx] = reads.size() - 1;
+                continue;
+            }
+        }
+        reads.push_back(regions[idx]);
+        start = regStart;
+        end = regEnd;
+        readOfRegion[idx] = reads.size() - 1;
+    }
+    return reads;
+}
@@ -0,0 +1,28 @@
+/* Planning the reads of many register regions in few transactions.
+ *
+ * Regions are read in address order. Ones that touch or overlap are read
+ * together. Ones separated by a hole of no more than maxHoleRegs registers
+ * are read together along with the hole, if the caller knows that the hole
+ * can be read, but only where that doesn't take more PDUs than reading them
+ * apart. A read longer than the maximum payload is split by Gem_core::rw().
+ */
+#ifndef GEM_REGIONS_H
+#define GEM_REGIONS_H
+
+#include <cstdint>
+#include <vector>
+
+struct Gem_region
+{
+    uint32_t base;
+    uint32_t numRegs;
+};
+
+// Reads covering all the regions, given the server's maximum payload. Sets
+// readOfRegion to the index of the read that covers each region
+std::vector<Gem_region> planRegionReads(const std::vector<Gem_region> &regions
+                                        , uint32_t maxPayloadWords
+                                        , uint32_t maxHoleRegs
+                                        , std::vector<uint32_t> &readOfRegion);
+
+#endif
@@ -0,0 +1,16 @@
+TEMPLATE = lib
+
+CONFIG += staticlib \
+          c++14 \
+          warn_on \
+          exceptions_off \
+          rtti_off
+CONFIG -= qt
+
+DESTDIR = ../../lib
+
+HEADERS += gem_core.h trans_ring.h rtt_estimator.h rx_batch.h reply_pool.h \
+           mpsc_queue.h gem_regions.h trans_sched.h
+
+SOURCES += gem_core.cpp trans_ring.cpp rtt_estimator.cpp rx_batch.cpp \
+           reply_pool.cpp gem_regions.cpp trans_sched.cpp
@@ -0,0 +1,73 @@
+/* Lock-free queue passing items from any number of producer threads to one
+ * consumer thread (Vyukov's intrusive MPSC queue).
+ *
+ * Items are linked through their own 'next' member, a std::atomic<T*>, so
+ * pushing doesn't allocate. Pushing never blocks or fails. Popping can return
+ * nullptr while a producer is part way through a push; the producer will
+ * have completed by the time it wakes the consumer again, so a consumer that
+ * drains the queue each time it's woken misses nothing.
+ */
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+
+template<class T>
+class Mpsc_queue
+{
+    private:
+        std::atomic<T*> m_head; // most recently pushed
+        T *m_tail;              // next to pop, consumer only
+        T m_stub;               // keeps queue non-empty internally
+
+    public:
+        Mpsc_queue()
+            : m_head(&m_stub)
+            , m_tail(&m_stub)
+        {
+            m_stub.next.store(nullptr, std::memory_order_relaxed);
+        }
+        Mpsc_queue(const Mpsc_queue&) = delete; // no copy
+        Mpsc_queue& operator=(const Mpsc_queue &) = delete; // no assign
+
+        // Any thread
+        void push(T *item)
+        {
+            item->next.store(nullptr, std::memory_order_relaxed);
+            T *prev = m_head.exchange(item, std::memory_order_acq_rel);
+            prev->next.store(item, std::memory_order_release);
+        }
+
+        // Consumer thread only. Oldest item, or nullptr if none (yet)
+        T * pop()
+        {
+            T *tail = m_tail;
+            T *next = tail->next.load(std::memory_order_acquire);
+            if(tail == &m_stub)
+            {
+                if(!next)
+                    return nullptr;
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if(next)
+            {
+                m_tail = next;
+                return tail;
+            }
+            // tail is the last item, unless a push is in progress
+            if(tail != m_head.load(std::memory_order_acquire))
+                return nullptr;
+            push(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if(next)
+            {
+                m_tail = next;
+                return tail;
+            }
+            return nullptr;
+        }
+};
+
+#endif
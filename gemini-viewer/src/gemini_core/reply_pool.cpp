@@ -0,0 +1,79 @@
+#include "reply_pool.h"
+
+void Reply_buf::release()
+{
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pool->recycle(this);
+}
+
+// Buffers are a whole number of words so a view can cover a whole reply
+Reply_pool::Reply_pool(uint32_t bufBytes)
+    : m_bufBytes((bufBytes + 3) & ~3u)
+    , m_numOut(0)
+    , m_isClosed(false)
+{
+}
+
+Reply_pool::~Reply_pool()
+{
+    for(auto buf: m_free)
+        destroy(buf);
+}
+
+void Reply_pool::destroy(Reply_buf *buf)
+{
+    delete [] buf->data;
+    delete buf;
+}
+
+Reply_buf * Reply_pool::acquire()
+{
+    Reply_buf *buf = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        ++m_numOut;
+        if(!m_free.empty())
+        {
+            buf = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if(!buf)
+    {
+        buf = new Reply_buf;
+        buf->pool = this;
+        buf->data = new char[m_bufBytes];
+    }
+    buf->refs.store(1, std::memory_order_relaxed);
+    return buf;
+}
+
+void Reply_pool::recycle(Reply_buf *buf)
+{
+    bool isLast = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        --m_numOut;
+        if(!m_isClosed)
+        {
+            m_free.push_back(buf);
+            return;
+        }
+        isLast = (m_numOut == 0);
+    }
+    destroy(buf);
+    if(isLast)
+        delete this;
+}
+
+void Reply_pool::close()
+{
+    bool isUnused;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_isClosed = true;
+        isUnused = (m_numOut == 0);
+    }
+    if(isUnused)
+        delete this;
+}
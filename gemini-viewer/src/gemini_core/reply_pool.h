@@ -0,0 +1,136 @@
+/* Pooled buffers for received Gemini replies, and ref-counted views of the
+ * register values in them.
+ *
+ * Replies are received straight into buffers from a Reply_pool. A Reg_view
+ * refers to a span of little-endian 32-bit register values in one of those
+ * buffers and keeps it alive: the buffer goes back to the pool when the last
+ * view of it is dropped, so replies reach clients without being copied and
+ * without allocating. Views may be kept, copied and dropped in any thread,
+ * and may outlive the pool's owner.
+ */
+#ifndef REPLY_POOL_H
+#define REPLY_POOL_H
+
+#include <cstdint>
+#include <cstring> // for memcpy
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility> // for swap
+
+class Reply_pool;
+
+// One reply buffer, counting the references to it
+struct Reply_buf
+{
+    std::atomic<uint32_t> refs;
+    Reply_pool *pool;
+    char *data;
+
+    void addRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release(); // back to pool when no references remain
+};
+
+class Reply_pool
+{
+    private:
+        uint32_t m_bufBytes;
+        std::mutex m_mtx;
+        std::vector<Reply_buf*> m_free;
+        uint32_t m_numOut; // buffers not in free list
+        bool m_isClosed;   // owner has finished with pool
+
+        ~Reply_pool(); // deleted by close() or last release
+        static void destroy(Reply_buf *buf);
+
+    public:
+        explicit Reply_pool(uint32_t bufBytes);
+        Reply_pool(const Reply_pool&) = delete; // no copy
+        Reply_pool& operator=(const Reply_pool &) = delete; // no assign
+
+        uint32_t getBufBytes() const { return m_bufBytes; }
+        // Buffer holding one reference for the caller, new only if none free
+        Reply_buf * acquire();
+        void recycle(Reply_buf *buf); // called when buffer has no references
+        // Owner's release of the pool, which is freed once all the buffers
+        // still referenced by views have been returned
+        void close();
+};
+
+// Little-endian register values in a reply buffer
+class Reg_view
+{
+    private:
+        Reply_buf *m_buf;
+        const char *m_data;
+        uint32_t m_numWords;
+
+    public:
+        Reg_view() : m_buf(nullptr), m_data(nullptr), m_numWords(0) {}
+        // View of numWords words starting offsetBytes into the buffer
+        Reg_view(Reply_buf *buf, uint32_t offsetBytes, uint32_t numWords)
+            : m_buf(buf), m_data(buf->data + offsetBytes)
+            , m_numWords(numWords)
+        {
+            m_buf->addRef();
+        }
+        Reg_view(const Reg_view &other)
+            : m_buf(other.m_buf), m_data(other.m_data)
+            , m_numWords(other.m_numWords)
+        {
+            if(m_buf)
+                m_buf->addRef();
+        }
+        Reg_view(Reg_view &&other)
+            : m_buf(other.m_buf), m_data(other.m_data)
+            , m_numWords(other.m_numWords)
+        {
+            other.m_buf = nullptr;
+            other.m_data = nullptr;
+            other.m_numWords = 0;
+        }
+        Reg_view& operator=(Reg_view other)
+        {
+            std::swap(m_buf, other.m_buf);
+            std::swap(m_data, other.m_data);
+            std::swap(m_numWords, other.m_numWords);
+            return *this;
+        }
+        ~Reg_view()
+        {
+            if(m_buf)
+                m_buf->release();
+        }
+
+        uint32_t size() const { return m_numWords; }
+        bool isEmpty() const { return m_numWords == 0; }
+        // Raw bytes as received (little-endian words)
+        const char * bytes() const { return m_data; }
+        // Register value at idx, in host byte order
+        uint32_t at(uint32_t idx) const
+        {
+            const unsigned char *p =
+                    reinterpret_cast<const unsigned char *>(m_data + 4*idx);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+            uint32_t val;
+            memcpy(&val, p, sizeof(val));
+            return val;
+#else
+            return static_cast<uint32_t>(p[0])
+                    | (static_cast<uint32_t>(p[1]) << 8)
+                    | (static_cast<uint32_t>(p[2]) << 16)
+                    | (static_cast<uint32_t>(p[3]) << 24);
+#endif
+        }
+        uint32_t operator[](uint32_t idx) const { return at(idx); }
+        // View of part of this one, sharing the same buffer
+        Reg_view mid(uint32_t firstWord, uint32_t numWords) const
+        {
+            if(!m_buf)
+                return Reg_view();
+            return Reg_view(m_buf, (m_data - m_buf->data) + 4*firstWord
+                            , numWords);
+        }
+};
+
+#endif
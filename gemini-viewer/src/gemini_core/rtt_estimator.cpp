@@ -0,0 +1,63 @@
+#include "rtt_estimator.h"
+
+#define RTT_CLOCK_GRANULARITY_USEC 1000 // timers only have ms resolution
+
+Rtt_estimator::Rtt_estimator(int64_t initialRtoUsec, int64_t minRtoUsec
+                             , int64_t maxRtoUsec)
+    : m_initialRto(initialRtoUsec)
+    , m_minRto(minRtoUsec)
+    , m_maxRto(maxRtoUsec)
+{
+    reset();
+}
+
+void Rtt_estimator::reset()
+{
+    m_srtt = 0;
+    m_rttVar = 0;
+    m_numSamples = 0;
+    setRto(m_initialRto);
+}
+
+void Rtt_estimator::addSample(int64_t rttUsec)
+{
+    if(rttUsec < 0)
+        return;
+    if(m_numSamples == 0)
+    {
+        m_srtt = rttUsec;
+        m_rttVar = rttUsec / 2;
+    }
+    else
+    {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+        int64_t err = m_srtt - rttUsec;
+        if(err < 0)
+            err = -err;
+        m_rttVar = m_rttVar - m_rttVar/4 + err/4;
+        m_srtt = m_srtt - m_srtt/8 + rttUsec/8;
+    }
+    m_numSamples++;
+
+    int64_t var = 4 * m_rttVar;
+    if(var < RTT_CLOCK_GRANULARITY_USEC)
+        var = RTT_CLOCK_GRANULARITY_USEC;
+    setRto(m_srtt + var);
+}
+
+void Rtt_estimator::setRto(int64_t rto)
+{
+    if(rto < m_minRto)
+        rto = m_minRto;
+    if(rto > m_maxRto)
+        rto = m_maxRto;
+    m_rto = rto;
+}
+
+int64_t Rtt_estimator::getBackedOffRtoUsec(uint32_t retries) const
+{
+    int64_t rto = m_rto;
+    for(uint32_t i=0; (i<retries) && (rto < m_maxRto); i++)
+        rto *= 2;
+    return (rto > m_maxRto) ? m_maxRto : rto;
+}
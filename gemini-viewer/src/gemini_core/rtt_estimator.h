@@ -0,0 +1,42 @@
+/* Round trip time estimate for a Gemini connection, giving the timeout
+ * before a transaction is retried (RFC 6298).
+ *
+ * Times are in microseconds. Until the first sample arrives the timeout is
+ * the initial one given. Samples must only be taken from transactions that
+ * were sent once (Karn's rule): a reply to a retried transaction can't be
+ * matched to the send it answers.
+ */
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <cstdint>
+
+class Rtt_estimator
+{
+    private:
+        int64_t m_initialRto;
+        int64_t m_minRto;
+        int64_t m_maxRto;
+        int64_t m_srtt;   // smoothed round trip time
+        int64_t m_rttVar; // round trip time variation
+        int64_t m_rto;    // retransmission timeout
+        uint64_t m_numSamples;
+
+        void setRto(int64_t rto);
+
+    public:
+        Rtt_estimator(int64_t initialRtoUsec, int64_t minRtoUsec
+                      , int64_t maxRtoUsec);
+
+        void addSample(int64_t rttUsec);
+        void reset(); // back to initial timeout, forgetting all samples
+
+        int64_t getSrttUsec() const { return m_srtt; }
+        int64_t getRttVarUsec() const { return m_rttVar; }
+        int64_t getRtoUsec() const { return m_rto; }
+        uint64_t getNumSamples() const { return m_numSamples; }
+        // Timeout doubled for each retry already made, up to maximum
+        int64_t getBackedOffRtoUsec(uint32_t retries) const;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "rx_batch.h"
+#include <cstring>
+
+Rx_batch::Rx_batch()
+    : m_pool(nullptr)
+    , m_bufBytes(0)
+    , m_size(0)
+{
+#ifdef __linux__
+    memset(m_msgs, 0, sizeof(m_msgs));
+    for(uint32_t i=0; i<RX_BATCH_LEN; i++)
+    {
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+}
+
+Rx_batch::~Rx_batch()
+{
+    release();
+}
+
+void Rx_batch::setBuf(uint32_t idx, Reply_buf *rb)
+{
+    m_bufs[idx] = rb;
+#ifdef __linux__
+    m_iovs[idx].iov_base = rb->data;
+    m_iovs[idx].iov_len = m_bufBytes;
+#endif
+}
+
+// Drop our references to the buffers and the pool (views may still hold some)
+void Rx_batch::release()
+{
+    if(!m_pool)
+        return;
+    for(uint32_t i=0; i<RX_BATCH_LEN; i++)
+        m_bufs[i]->release();
+    m_pool->close();
+    m_pool = nullptr;
+}
+
+void Rx_batch::reserve(uint32_t bufBytes)
+{
+    m_size = 0;
+    if(bufBytes <= m_bufBytes)
+        return;
+    release();
+    m_pool = new Reply_pool(bufBytes);
+    m_bufBytes = m_pool->getBufBytes();
+    for(uint32_t i=0; i<RX_BATCH_LEN; i++)
+        setBuf(i, m_pool->acquire());
+}
+
+void Rx_batch::clear()
+{
+    for(uint32_t i=0; i<m_size; i++)
+    {
+        if(m_bufs[i]->refs.load(std::memory_order_acquire) == 1)
+            continue;
+        m_bufs[i]->release();
+        setBuf(i, m_pool->acquire());
+    }
+    m_size = 0;
+}
+
+#ifdef __linux__
+uint32_t Rx_batch::receive(int fd)
+{
+    if((m_bufBytes == 0) || isFull())
+        return 0;
+    int n = recvmmsg(fd, &m_msgs[m_size], RX_BATCH_LEN - m_size
+                     , MSG_DONTWAIT, nullptr);
+    if(n <= 0)
+        return 0;
+    for(int i=0; i<n; i++)
+        m_lens[m_size + i] = m_msgs[m_size + i].msg_len;
+    m_size += n;
+    return n;
+}
+#endif
@@ -0,0 +1,63 @@
+/* Buffers for receiving a batch of Gemini replies per socket wakeup.
+ *
+ * Buffers come from a Reply_pool once the maximum PDU size is known (on
+ * connection). A buffer that's still referenced after its batch has been
+ * handled (a client kept a view of its reply) is left to its holders and
+ * replaced from the pool; the others are reused for the next batch. On Linux
+ * a whole batch is received with one recvmmsg() call; elsewhere the caller
+ * fills the buffers one datagram at a time.
+ */
+#ifndef RX_BATCH_H
+#define RX_BATCH_H
+
+#include <cstdint>
+#ifdef __linux__
+#include <sys/socket.h> // for mmsghdr
+#endif
+#include "reply_pool.h"
+
+#define RX_BATCH_LEN 32 // datagrams received per batch
+
+class Rx_batch
+{
+    private:
+        Reply_pool *m_pool;
+        Reply_buf *m_bufs[RX_BATCH_LEN];
+        uint32_t m_bufBytes; // size of each datagram buffer
+        uint32_t m_lens[RX_BATCH_LEN];
+        uint32_t m_size; // number of datagrams received
+#ifdef __linux__
+        struct mmsghdr m_msgs[RX_BATCH_LEN];
+        struct iovec m_iovs[RX_BATCH_LEN];
+#endif
+
+        void setBuf(uint32_t idx, Reply_buf *rb);
+        void release();
+
+    public:
+        Rx_batch();
+        ~Rx_batch();
+        Rx_batch(const Rx_batch&) = delete; // no copy
+        Rx_batch& operator=(const Rx_batch &) = delete; // no assign
+
+        void reserve(uint32_t bufBytes); // new buffers only if larger
+        void clear(); // ready for the next batch
+
+        uint32_t size() const { return m_size; }
+        bool isFull() const { return m_size == RX_BATCH_LEN; }
+        uint32_t getBufBytes() const { return m_bufBytes; }
+        char * buf(uint32_t idx) { return m_bufs[idx]->data; }
+        Reply_buf * replyBuf(uint32_t idx) { return m_bufs[idx]; }
+        uint32_t len(uint32_t idx) const { return m_lens[idx]; }
+
+        // Buffer for the next datagram, and record its length once received
+        char * nextBuf() { return buf(m_size); }
+        void push(uint32_t len) { m_lens[m_size++] = len; }
+#ifdef __linux__
+        // Receive as many datagrams as are waiting (without blocking) into
+        // the remaining buffers, returning the number received
+        uint32_t receive(int fd);
+#endif
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "trans_ring.h"
+#include <utility> // for swap
+
+// Make sure the wire buffer can hold len bytes, allocating only if the slot
+// has never held a packet this big
+char * Gemini_transaction::reserveWire(uint32_t len)
+{
+    if(len > wireCap)
+    {
+        wire.reset(new char[len]);
+        wireCap = len;
+    }
+    wireLen = len;
+    return wire.get();
+}
+
+Trans_ring::Trans_ring()
+    : m_slots(new Gemini_transaction[TRANS_RING_INITIAL_LEN]())
+    , m_len(TRANS_RING_INITIAL_LEN)
+    , m_head(0)
+    , m_size(0)
+{
+}
+
+Gemini_transaction & Trans_ring::pushBack()
+{
+    if(m_size == m_len)
+        grow();
+    Gemini_transaction & t = m_slots[(m_head + m_size) & (m_len - 1)];
+    ++m_size;
+    return t;
+}
+
+void Trans_ring::popFront()
+{
+    if(m_size == 0)
+        return;
+    m_head = (m_head + 1) & (m_len - 1);
+    --m_size;
+}
+
+void Trans_ring::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+// Double the number of slots, keeping queued transactions in order and
+// moving (not copying) the wire buffers and held replies of all existing slots
+void Trans_ring::grow()
+{
+    uint32_t new_len = m_len * 2;
+    std::unique_ptr<Gemini_transaction[]> slots(
+            new Gemini_transaction[new_len]());
+    for(uint32_t i=0; i<m_len; i++)
+        std::swap(slots[i], m_slots[(m_head + i) & (m_len - 1)]);
+    m_slots = std::move(slots);
+    m_len = new_len;
+    m_head = 0;
+}
@@ -0,0 +1,79 @@
+/* Queue of Gemini transactions waiting to be sent or waiting for a reply.
+ *
+ * Transactions live in a ring of preallocated slots, each with its own
+ * buffer holding the packet exactly as it goes on the wire (Gemini header
+ * followed by any write data). Slots are recycled rather than freed, so a
+ * slot's buffer is allocated the first time it's needed and then reused, and
+ * queueing, sending and retiring transactions doesn't allocate. The ring only
+ * grows (doubling) if more transactions are queued than it has ever held.
+ */
+#ifndef TRANS_RING_H
+#define TRANS_RING_H
+
+#include <cstdint>
+#include <memory> // for unique_ptr
+#include "reply_pool.h"
+
+#define TRANS_RING_INITIAL_LEN 64 // slots, must be a power of two
+
+enum class Gem_rw_type{READ_INC, READ_FIFO, WR_INC, WR_FIFO};
+// QUEUED: not yet sent, SENT: awaiting reply, DONE: reply held until earlier
+// transactions are answered
+enum class Trans_state{QUEUED, SENT, DONE};
+
+// Record of transaction with remote card
+struct Gemini_transaction
+{
+    Gem_rw_type rwType;
+    uint32_t base;
+    uint32_t numRegs;
+    Trans_state state;
+    uint32_t sendCount;
+    uint32_t retryCount; // retries after timeout or server rejection
+    uint32_t laterReplies; // replies to transactions sent after its last send
+    uint64_t sendNum;      // order of its last send among all sends
+    int64_t sentTimeUs;    // time of latest send, on connection's clock
+    int64_t timeoutTimeUs; // retry if no reply by then
+    uint8_t cli_seq;
+    uint32_t ctx;
+    bool isLast;                  // last of the transactions for a request
+    std::unique_ptr<char[]> wire; // Gemini header then any write data
+    uint32_t wireLen;             // bytes of wire buffer in use
+    uint32_t wireCap;             // bytes allocated for wire buffer
+    Reg_view reply;               // whole reply, if received out of order
+    uint32_t replyLen;            // bytes of reply
+
+    char * reserveWire(uint32_t len);
+};
+
+class Trans_ring
+{
+    private:
+        std::unique_ptr<Gemini_transaction[]> m_slots;
+        uint32_t m_len;  // number of slots, a power of two
+        uint32_t m_head; // index of oldest transaction
+        uint32_t m_size; // number of transactions queued
+
+        void grow();
+
+    public:
+        Trans_ring();
+        Trans_ring(const Trans_ring&) = delete; // no copy
+        Trans_ring& operator=(const Trans_ring &) = delete; // no assign
+
+        // Queue a new transaction at the back and return its (reused) slot.
+        // Slot references stay valid until the next pushBack()
+        Gemini_transaction & pushBack();
+        void popFront();
+        Gemini_transaction & front() { return m_slots[m_head]; }
+        Gemini_transaction & at(uint32_t idx)
+        {
+            return m_slots[(m_head + idx) & (m_len - 1)];
+        }
+        uint32_t size() const { return m_size; }
+        bool isEmpty() const { return m_size == 0; }
+        uint32_t capacity() const { return m_len; }
+        void clear();
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "trans_sched.h"
+#include <algorithm> // for find
+#include <utility>   // for swap
+
+Trans_sched::Trans_sched()
+    : m_quantum(0)
+    , m_overheadBytes(0)
+    , m_size(0)
+{
+}
+
+void Trans_sched::setPacketSize(uint32_t maxPayloadBytes
+                                , uint32_t overheadBytes)
+{
+    m_quantum = maxPayloadBytes + 2*overheadBytes;
+    m_overheadBytes = overheadBytes;
+}
+
+Gemini_transaction & Trans_sched::pushBack(uint32_t ctx, Gem_priority prio)
+{
+    while(m_flows.size() <= ctx)
+    {
+        std::unique_ptr<Flow> flow(new Flow);
+        flow->prio = Gem_priority::POLLING;
+        flow->deficit = 0;
+        flow->isActive = false;
+        m_flows.push_back(std::move(flow));
+    }
+    Flow &f = *m_flows[ctx];
+    if(!f.isActive)
+    {
+        f.isActive = true;
+        f.deficit = m_quantum;
+        m_rounds[static_cast<int>(prio)].push_back(ctx);
+    }
+    else if(f.prio != prio)
+    {
+        // Change class, keeping any share left of the current turn
+        std::deque<uint32_t> &old = m_rounds[static_cast<int>(f.prio)];
+        old.erase(std::find(old.begin(), old.end(), ctx));
+        m_rounds[static_cast<int>(prio)].push_back(ctx);
+    }
+    f.prio = prio;
+    ++m_size;
+    return f.queue.pushBack();
+}
+
+void Trans_sched::moveNext(Trans_ring &ring)
+{
+    for(std::deque<uint32_t> &round: m_rounds)
+    {
+        if(round.empty())
+            continue;
+        // A flow whose turn is up goes to the back of the round with its
+        // next turn's share. The share is at least a packet, so some flow
+        // always gets to send before long
+        for(;;)
+        {
+            uint32_t ctx = round.front();
+            Flow &f = *m_flows[ctx];
+            uint32_t c = cost(f.queue.front());
+            if(c <= f.deficit)
+            {
+                f.deficit -= c;
+                std::swap(ring.pushBack(), f.queue.front());
+                f.queue.popFront();
+                --m_size;
+                if(f.queue.isEmpty())
+                {
+                    f.isActive = false;
+                    f.deficit = 0;
+                    round.pop_front();
+                }
+                return;
+            }
+            f.deficit += m_quantum;
+            round.pop_front();
+            round.push_back(ctx);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/* Gemini transactions waiting to be sent, queued separately for each
+ * requester (ctx) and scheduled by priority class.
+ *
+ * Classes are served strictly in order: interactive, then polling, then
+ * bulk. Requesters in the same class take turns by deficit round robin,
+ * weighted by the bytes a transaction puts on the wire in both directions:
+ * the request and its reply, each with its packet overhead, and the register
+ * data, which goes one way (in the request for a write, the reply for a
+ * read). A requester with a big transfer queued then holds the others up by
+ * no more than one PDU's worth per turn, whichever way the data flows. Each
+ * requester's transactions stay in the order they were queued. Sequence
+ * numbers are only given to transactions as they're sent, so the order
+ * chosen here doesn't affect the protocol's sequencing.
+ */
+#ifndef TRANS_SCHED_H
+#define TRANS_SCHED_H
+
+#include <cstdint>
+#include <deque>
+#include <memory> // for unique_ptr
+#include <vector>
+#include "trans_ring.h"
+
+enum class Gem_priority{INTERACTIVE, POLLING, BULK};
+#define GEM_NUM_PRIORITIES 3
+
+class Trans_sched
+{
+    private:
+        struct Flow
+        {
+            Trans_ring queue;
+            Gem_priority prio;
+            uint32_t deficit; // bytes it may send before its turn ends
+            bool isActive;    // has transactions queued, so is in a round
+        };
+
+        std::vector<std::unique_ptr<Flow>> m_flows; // by ctx
+        // ctx of each active flow by class, the one whose turn it is first
+        std::deque<uint32_t> m_rounds[GEM_NUM_PRIORITIES];
+        uint32_t m_quantum;       // bytes a flow may send per turn
+        uint32_t m_overheadBytes; // of each packet, besides register data
+        uint32_t m_size;
+
+        // Bytes of the request and of its reply, only one of which carries
+        // the register data
+        uint32_t cost(const Gemini_transaction &t) const
+        {
+            return t.numRegs*4 + 2*m_overheadBytes;
+        }
+
+    public:
+        Trans_sched();
+        Trans_sched(const Trans_sched&) = delete; // no copy
+        Trans_sched& operator=(const Trans_sched &) = delete; // no assign
+
+        // Bytes of register data in the largest packet, and of the rest of
+        // every packet. A turn lets a flow send at least one such packet
+        // and get its reply
+        void setPacketSize(uint32_t maxPayloadBytes, uint32_t overheadBytes);
+        // Queue a new transaction for ctx and return its (reused) slot. The
+        // class given applies to all of ctx's queued transactions. Slot
+        // references stay valid until the next pushBack() for the same ctx
+        Gemini_transaction & pushBack(uint32_t ctx, Gem_priority prio);
+        // Move the next transaction to send onto the back of ring
+        void moveNext(Trans_ring &ring);
+        uint32_t size() const { return m_size; }
+        bool isEmpty() const { return m_size == 0; }
+};
+
+#endif
@@ -308,13 +308,17 @@ void Fpga_window::onConnectResult(Gem_cnx_rslt rslt)
             , this, &Fpga_window::onDelayDone);
 
 
+    // Register writes by the user go ahead of polling, and polling goes
+    // ahead of bulk transfers so that the view keeps updating during them
     m_update_ch = m_gemio->openChannel();
-    connect(m_update_ch, &RwChannel::result, this, &Fpga_window::onUpdate2Done);
     m_writer_ch = m_gemio->openChannel();
+    m_writer_ch->setPriority(Gem_priority::INTERACTIVE);
     connect(m_writer_ch, &RwChannel::result, this, &Fpga_window::onRegWriteDone);
     m_upload_ch = m_gemio->openChannel();
-    // ignore result TODO is this always OK? connect to progress indicator??
+    m_upload_ch->setPriority(Gem_priority::BULK);
+    connect(m_upload_ch, &RwChannel::result, this, &Fpga_window::onUploadResult);
     m_download_ch = m_gemio->openChannel();
+    m_download_ch->setPriority(Gem_priority::BULK);
     connect(m_download_ch, &RwChannel::result, this, &Fpga_window::onDownloadResult);
 
     updateFromFPGA2();
@@ -354,39 +358,26 @@ void Fpga_window::updateFromFPGA2()
             //        << QString("%1").arg(m_tableBase) << dec << " len=" << m_numRegs;
             m_bold_changes = false;
         }
-        m_reg_blk_idx = 0;
-        while(m_reg_blks.at(m_reg_blk_idx).is_hole)
+        // Read all the blocks at once so that they share round trips, and
+        // show them together once the last has arrived. Holes are left out
+        // of the reads, as they may not be readable
+        std::vector<Gem_region> regions;
+        for(const Reg_block &blk: m_reg_blks)
         {
-            ++m_reg_blk_idx;
+            if(!blk.is_hole)
+                regions.push_back(Gem_region{blk.base, blk.len});
         }
-
-
-        //m_update_ch->rw(m_tableBase, m_numRegs,nullptr, Gem_rw_type::READ_INC);
-        //QString txt1 = QString("Orig read from 0x%1, len 0x%2")
-        //        .arg(m_tableBase, 0, 16)
-        //        .arg(m_numRegs, 0, 16);
-        //qDebug().noquote() << txt1;
-        m_update_ch->rw(m_reg_blks.at(m_reg_blk_idx).base
-                        , m_reg_blks.at(m_reg_blk_idx).len
-                        ,nullptr, Gem_rw_type::READ_INC);
-        //  will emit "result" which is connected to "onUpdate2Done"
-        //QString txt = QString("Read from 0x%1, len 0x%2")
-        //        .arg(m_reg_blks.at(m_reg_blk_idx).base, 0, 16)
-        //        .arg(m_reg_blks.at(m_reg_blk_idx).len, 0, 16);
-        //qDebug().noquote() << txt;
+        m_update_ch->readRegions(regions).then(
+                    [this](const Gem_regions_reply &reply)
+        {
+            onUpdateDone(reply);
+        });
     }
 }
 
-void Fpga_window::onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
-                                , QByteArray regs, Gem_rw_type op
-                                , bool isAck, uint8_t failCode)
+void Fpga_window::onUpdateDone(const Gem_regions_reply &reply)
 {
-
-    //Q_UNUSED(op);
-    //Q_UNUSED(base);
-    //Q_UNUSED(numRegs);
-
-    if(timeout)
+    if(reply.timedOut)
     {
         m_ackStatus->setText("Timeout");
         m_failCode->setText("");
@@ -401,9 +392,8 @@ void Fpga_window::onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
         return;
     }
 
-    m_failCode->setText( QString("0x%1").arg(failCode, 2,16,QLatin1Char('0')));
-
-    if(!isAck)
+    m_failCode->setText( QString("0x%1").arg(reply.failCode, 2,16,QLatin1Char('0')));
+    if(!reply.isAck)
     {
         m_ackStatus->setText("[NACK]");
         for(int i=0; i<(int)m_numRegs; i++)
@@ -419,13 +409,18 @@ void Fpga_window::onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
     }
 
     m_ackStatus->setText("  [ACK]");
-    // Uploads will generate replys - we don't want to show them here
-    if(op != Gem_rw_type::READ_INC)
-    {
-        m_dlyTimer->start(500); // connected to "onDelayDone"
-        return;
-    }
+    for(uint32_t i=0; i<reply.regions.size(); i++)
+        showRegs(reply, i);
+    m_bold_changes = true;
 
+    m_dlyTimer->start(500); // connected to "onDelayDone"
+}
+
+// Put the values of one of the blocks of registers read into the table
+void Fpga_window::showRegs(const Gem_regions_reply &reply, uint32_t region)
+{
+    uint32_t base = reply.regions[region].base;
+    uint32_t numRegs = reply.regions[region].numRegs;
     int pkt_offset = (base-m_tableBase);
     if(m_lastRegs.size() < int32_t(pkt_offset+numRegs))
     {
@@ -461,15 +456,9 @@ void Fpga_window::onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
                 << i+pkt_offset << ",2)";
             continue;
         }
-        if( (i*4+3) < regs.size())
+        if(i < (int)reply.size(region))
         {
-            uint32_t v1 = regs.at(4*i+0) & 0x0ff;
-            uint32_t v2 = regs.at(4*i+1) & 0x0ff;
-            uint32_t v3 = regs.at(4*i+2) & 0x0ff;
-            uint32_t v4 = regs.at(4*i+3) & 0x0ff;
-
-            uint32_t val = (v4 << 24)  | (v3 << 16)
-                        | (v2 << 8) | (v1);
+            uint32_t val = reply.at(region, i);
             twi->setText(QString("0x%1").arg(val,8,16,QLatin1Char('0')));
 
             if(val != m_lastRegs.at(i+pkt_offset))
@@ -501,37 +490,33 @@ void Fpga_window::onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
             twi->setText(QString("???"));
         }
     }
-    m_bold_changes = true;
+}
 
-    ++m_reg_blk_idx;
-    if(m_reg_blk_idx >= m_reg_blks.size()) // have read all the register blocks
-    {
-        m_dlyTimer->start(500); // connected to "onDelayDone"
-        return;
-    }
+// Results of uploads
+void Fpga_window::onUploadResult(bool timeout, uint32_t base, uint32_t numRegs
+                                 , const Reg_view &regs, Gem_rw_type op
+                                 , bool isAck, uint8_t failCode)
+{
+    Q_UNUSED(base);
+    Q_UNUSED(numRegs);
+    Q_UNUSED(regs);
+    Q_UNUSED(op);
 
-    while(m_reg_blks.at(m_reg_blk_idx).is_hole)
+    if(timeout)
     {
-        ++m_reg_blk_idx;
-        if(m_reg_blk_idx >= m_reg_blks.size())
-        {
-            m_dlyTimer->start(500); // connected to "onDelayDone"
-            return;
-        }
+        m_ackStatus->setText("Timeout");
+        m_failCode->setText("");
+        return;
     }
-
-    m_update_ch->rw(m_reg_blks.at(m_reg_blk_idx).base
-                    , m_reg_blks.at(m_reg_blk_idx).len
-                    ,nullptr, Gem_rw_type::READ_INC);
-
-    //m_dlyTimer->start(500); // connected to "onDelayDone"
+    m_failCode->setText( QString("0x%1").arg(failCode, 2,16,QLatin1Char('0')));
+    m_ackStatus->setText(isAck ? "  [ACK]" : "[NACK]");
 }
 
 // Handle response to individual user writes to FPGA registers by logging any
 // failure. Failure should be apparent to user from unchanged register value
 // shown in GUI
 void Fpga_window::onRegWriteDone(bool timeout, uint32_t base, uint32_t numRegs
-                                , QByteArray regs, Gem_rw_type op
+                                , const Reg_view &regs, Gem_rw_type op
                                 , bool isAck, uint8_t failCode)
 {
     Q_UNUSED(numRegs);
@@ -830,7 +815,7 @@ void Fpga_window::onUploadClicked(bool checked)
                                               reg_offset,8,16,QLatin1Char('0'));
                     // TODO write data
                     uint32_t addr = reg_base_addr + reg_offset;
-                    m_update_ch->rw(addr, data.size(), data.data(), Gem_rw_type::WR_INC);
+                    m_upload_ch->rw(addr, data.size(), data.data(), Gem_rw_type::WR_INC);
                 }
                 else
                     qDebug().noquote() << "ERROR - Ignoring data for " << header;
@@ -884,7 +869,7 @@ void Fpga_window::onUploadClicked(bool checked)
             qDebug().noquote() << data.size() << "regs about to load to" << header;
             // TODO write data
             uint32_t addr = reg_base_addr + reg_offset;
-            m_update_ch->rw(addr, data.size(), data.data(), Gem_rw_type::WR_INC);
+            m_upload_ch->rw(addr, data.size(), data.data(), Gem_rw_type::WR_INC);
             qDebug().noquote() << data.size() << "regs loaded to" << header;
         }
         else
@@ -1026,7 +1011,7 @@ void Fpga_window::onDownloadClicked(bool checked)
 }
 
 void Fpga_window::onDownloadResult(bool timeout, uint32_t base
-            , uint32_t numRegs, QByteArray regs, Gem_rw_type op
+            , uint32_t numRegs, const Reg_view &regs, Gem_rw_type op
             , bool isAck, uint8_t failCode)
 {
     Q_UNUSED(timeout);
@@ -1059,17 +1044,18 @@ void Fpga_window::onDownloadResult(bool timeout, uint32_t base
                   .arg(base,8,16,QLatin1Char('0'))
                   .arg(numRegs);
 
-    uint32_t *regdata = reinterpret_cast<uint32_t *>(regs.data());
+    if(regs.size() < numRegs)
+        numRegs = regs.size();
     for(unsigned int i = 0; i<numRegs; i++)
     {
         if((base+i)%16 == 0)
         {
-            out << QString("0x%1").arg(regdata[i],8,16,QLatin1Char('0'))
+            out << QString("0x%1").arg(regs.at(i),8,16,QLatin1Char('0'))
                 << QString("    # [0x%1]\n").arg(base+i,8,16,QLatin1Char('0'));
         }
         else
         {
-            out << QString("0x%1\n").arg(regdata[i],8,16,QLatin1Char('0'));
+            out << QString("0x%1\n").arg(regs.at(i),8,16,QLatin1Char('0'));
         }
     }
     dl_file.close();
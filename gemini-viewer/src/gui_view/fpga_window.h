@@ -57,7 +57,6 @@ private:
     uint32_t m_lastNumRegs;
     uint32_t m_newBase;
     std::vector<Reg_block> m_reg_blks;
-    uint32_t m_reg_blk_idx;
 
     QTimer *m_timeoutTimer;
     QTimer *m_dlyTimer;
@@ -67,6 +66,8 @@ private:
 
     void closeEvent(QCloseEvent *event) override;
     void updateFromFPGA2();
+    void onUpdateDone(const Gem_regions_reply &reply);
+    void showRegs(const Gem_regions_reply &reply, uint32_t region);
     void add_remove_tablewidgets();
     void adjust_address_display();
     bool find_addr(QString &hdrline, uint32_t *base, uint32_t *offset);
@@ -77,11 +78,11 @@ private slots:
     void onConnectResult(Gem_cnx_rslt rslt);
     void onCnxFailed();
     void onDelayDone();
-    void onUpdate2Done(bool timeout, uint32_t base, uint32_t numRegs
-                       , QByteArray regs, Gem_rw_type op, bool isAck
+    void onUploadResult(bool timeout, uint32_t base, uint32_t numRegs
+                       , const Reg_view &regs, Gem_rw_type op, bool isAck
                        , uint8_t failCode);
     void onRegWriteDone(bool timeout, uint32_t base, uint32_t numRegs
-                       , QByteArray regs, Gem_rw_type op, bool isAck
+                       , const Reg_view &regs, Gem_rw_type op, bool isAck
                        , uint8_t failCode);
     void onBaseAddrChange();
     void onLengthChange();
@@ -91,7 +92,7 @@ private slots:
     void onUploadClicked(bool checked);
     void onDownloadClicked(bool checked);
     void onDownloadResult(bool timeout, uint32_t base, uint32_t numRegs
-                       , QByteArray regs, Gem_rw_type op, bool isAck
+                       , const Reg_view &regs, Gem_rw_type op, bool isAck
                        , uint8_t failCode);
 
 public:
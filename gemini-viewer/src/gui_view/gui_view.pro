@@ -7,8 +7,8 @@ CONFIG += qt c++14 warn_on exceptions_off rtti_off
 QT += widgets network
 #QT -= core gui # core & gui included in QT by default. Uncomment to remove.
 
-LIBS += -L../../lib -lgemini_comms
-INCLUDEPATH += ../gemini_comms
+LIBS += -L../../lib -lgemini_comms -lgemini_core
+INCLUDEPATH += ../gemini_comms ../gemini_core
 
 SOURCES += main.cpp mainwindow.cpp event_model.cpp open_fpga_dlg.cpp \
     fpga_window.cpp \
@@ -19,4 +19,4 @@ HEADERS += mainwindow.h event_model.h open_fpga_dlg.h \
     address_map.h \
     download_dialog.h
 
-PRE_TARGETDEPS += ../../lib/libgemini_comms.a
+PRE_TARGETDEPS += ../../lib/libgemini_comms.a ../../lib/libgemini_core.a
@@ -1,2 +1,2 @@
-SUBDIRS += gemini_comms gui_view
+SUBDIRS += gemini_core gemini_comms gui_view gemini_bench
 TEMPLATE = subdirs
@@ -1,7 +1,14 @@
 #include "bigfile.h"
+#include "decompress.h"
 #include <iostream> // for cin cout cerr
 #include <fstream> // for ifstream
 #include <stdio.h> // for fopen fclose
+#include <cstring> // for memcpy strerror
+#include <errno.h>
+#include <fcntl.h> // for open
+#include <unistd.h> // for close
+#include <sys/stat.h> // for fstat
+#include <sys/mman.h> // for mmap
 
 
 
@@ -44,11 +51,124 @@ bool Bigfile::read()
     file.read(m_data.get(), m_size);
     file.close();
 
+    if(!decompress_data())
+        return false;
+
     //std::cout << "Loaded '" <<m_filename << "' (" << m_size << " bytes)"
     //    << std::endl;
     return true;
 }
 
+// Alternative to read(): map the file and copy it into RAM, letting the
+// kernel read ahead (MAP_POPULATE) instead of going through ifstream buffers
+bool Bigfile::read_mmap()
+{
+    int fd = open(m_filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cout << "Unable to open file: '" << m_filename << "'" << std::endl;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        std::cout << "Unable to stat file: '" << m_filename << "' "
+            << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+    m_size = st.st_size;
+
+    //allocate memory to hold file data
+    try
+    {
+        m_data = std::make_unique<char[]>(m_size);
+    }
+    catch (std::bad_alloc & ba)
+    {
+        std::cerr << "Couldn't allocate RAM for file read: " << ba.what()
+            << std::endl;
+        close(fd);
+        return false;
+    }
+    if(m_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void * map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE
+            , fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        std::cout << "Unable to map file: '" << m_filename << "' "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    madvise(map, m_size, MADV_SEQUENTIAL);
+    memcpy(m_data.get(), map, m_size);
+    munmap(map, m_size);
+    return decompress_data();
+}
+
+// Find the file's size, decompressed, without keeping its contents. Plain
+// files don't have to be read at all; compressed ones are read and
+// decompressed as there's no reliable way to know their size otherwise.
+bool Bigfile::read_size()
+{
+    int fd = open(m_filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cout << "Unable to open file: '" << m_filename << "'" << std::endl;
+        return false;
+    }
+    char magic[8];
+    ssize_t got = ::read(fd, magic, sizeof(magic));
+    struct stat st;
+    bool is_stat_ok = (fstat(fd, &st) >= 0);
+    close(fd);
+    if((got < 0) || !is_stat_ok)
+    {
+        std::cout << "Unable to read file: '" << m_filename << "' "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    if(detect_compression(magic, got) != Compression::NONE)
+    {
+        if(!read())
+            return false;
+        m_data.reset();
+        return true;
+    }
+    m_size = st.st_size;
+    return true;
+}
+
+// If the file just read is zstd or lz4 compressed, replace it in RAM with
+// its decompressed contents
+bool Bigfile::decompress_data()
+{
+    Compression type = detect_compression(m_data.get(), m_size);
+    if(type == Compression::NONE)
+        return true;
+
+    std::unique_ptr<char[]> plain;
+    uint64_t plain_len = 0;
+    if(!decompress(type, m_data.get(), m_size, plain, plain_len))
+    {
+        std::cout << "Unable to decompress " << compression_name(type)
+            << " file: '" << m_filename << "'" << std::endl;
+        return false;
+    }
+    std::cout << "Decompressed " << compression_name(type) << " file '"
+        << m_filename << "' (" << m_size << " -> " << plain_len << " bytes)"
+        << std::endl;
+    m_data = std::move(plain);
+    m_size = plain_len;
+    return true;
+}
+
 // Return pointer to underlying data bytes
 char * Bigfile::get()
 {
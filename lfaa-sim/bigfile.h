@@ -1,4 +1,5 @@
 /* This class reads a large file into RAM
+ * zstd or lz4 compressed files are decompressed transparently.
  *
  * Keith Bengston. CSIRO. 21 Jan 2018
  */
@@ -17,9 +18,12 @@ class Bigfile
         std::unique_ptr<char[]> m_data;
 
         bool exists();
+        bool decompress_data();
     public:
         Bigfile(std::string filename, bool is_binary = false);
         bool read();
+        bool read_mmap();
+        bool read_size();
         char * get();
         uint64_t size();
         std::unique_ptr<char[]> data();
@@ -0,0 +1,446 @@
+#include "capture_check.h"
+#include "lfaa_tx_data.h" // for ZERO_PAYLOAD_BYTES
+#include <iostream> // for cin cout cerr
+#include <algorithm> // for sort inplace_merge
+#include <thread>
+#include <atomic>
+#include <iterator> // for next
+
+#define CHUNK_RECORDS 65536 // records per unit of work
+#define ETH_L1_OVERHEAD 24  // FCS, preamble and inter-frame gap
+#define NO_PAYLOAD 0xffffffffffffffffULL
+#define NO_IDX 0xffffffff
+#define MAX_STATIONS_LISTED 32
+
+static uint64_t big_endian_64bit(const uint8_t * ptr)
+{
+    uint64_t val = 0;
+    for(int i=0; i<8; i++)
+        val = (val << 8) | ptr[i];
+    return val;
+}
+
+static uint32_t big_endian_32bit(const uint8_t * ptr)
+{
+    return (static_cast<uint32_t>(ptr[0]) << 24) | (ptr[1] << 16)
+        | (ptr[2] << 8) | ptr[3];
+}
+
+static void add(Check_count & c, uint32_t idx)
+{
+    if(c.count++ == 0)
+        c.first_idx = idx;
+}
+
+static void add(Check_count & into, const Check_count & from)
+{
+    if((from.count != 0) && ((into.count == 0)
+                || (from.first_idx < into.first_idx)))
+        into.first_idx = from.first_idx;
+    into.count += from.count;
+}
+
+static void clear(Capture_stats & st, uint32_t first_idx, uint32_t end_idx)
+{
+    st.first_idx = first_idx;
+    st.end_idx = end_idx;
+    st.bad_range = {0, NO_IDX};
+    st.bad_zero_len = {0, NO_IDX};
+    st.bad_udp_len = {0, NO_IDX};
+    st.send_backwards = {0, NO_IDX};
+    st.overlap = {0, NO_IDX};
+    st.shared = 0;
+    st.first_send_ns = 0;
+    st.last_send_ns = 0;
+    st.zero_payloads = 0;
+    st.payload_bytes = 0;
+    st.wire_bytes = 0;
+    st.first_counter = 0;
+    st.ranges.clear();
+    st.frames.clear();
+    st.stations.clear();
+}
+
+Capture_check::Capture_check()
+    : m_speed(1.0)
+    , m_line_gbps(40.0)
+    , m_is_raw(false)
+    , m_version(Spead_version::V1)
+    , m_payload_len(0)
+    , m_frame_backwards({0, NO_IDX})
+    , m_period_ns(0)
+    , m_rate_min_gbps(0.0)
+    , m_rate_max_gbps(0.0)
+    , m_rate_avg_gbps(0.0)
+    , m_frames_over_line(0)
+    , m_frames_no_gap(0)
+{
+    clear(m_stats, 0, 0);
+}
+
+// Replay speed the rates are worked out for (see Lfaa_sender::set_speed)
+void Capture_check::set_speed(double speed)
+{
+    m_speed = speed;
+}
+
+// Link rate frames are compared against, Gbit/sec
+void Capture_check::set_line_rate(double gbps)
+{
+    m_line_gbps = gbps;
+}
+
+// UDP lengths only matter when frames are sent whole
+void Capture_check::set_raw_mode(bool is_raw)
+{
+    m_is_raw = is_raw;
+}
+
+// Check the records st.first_idx to st.end_idx
+template<class L>
+void Capture_check::scan_chunk(const char * hdr, uint64_t payload_len
+        , Capture_stats & st)
+{
+    const typename L::Record * rec
+        = reinterpret_cast<const typename L::Record *>(hdr);
+    for(uint32_t idx=st.first_idx; idx<st.end_idx; idx++)
+    {
+        const typename L::Record & r = rec[idx];
+        uint64_t offset = big_endian_64bit(r.data_offset);
+        uint32_t len = big_endian_32bit(r.hdr_data_len_bytes);
+        uint64_t send_ns = big_endian_64bit(r.send_time_ns);
+
+        if(offset == NO_PAYLOAD)
+        {
+            ++st.zero_payloads;
+            if(len > ZERO_PAYLOAD_BYTES)
+                add(st.bad_zero_len, idx);
+        }
+        else if((offset > payload_len) || (len > payload_len - offset))
+            add(st.bad_range, idx);
+        else if(len != 0)
+            st.ranges.push_back({offset, len, idx});
+        uint32_t udp_len = (r.udp_hdr[4] << 8) | r.udp_hdr[5];
+        if(udp_len != (UDP_HDR_LEN + L::SPEAD_LEN + len))
+            add(st.bad_udp_len, idx);
+
+        if(idx == st.first_idx)
+            st.first_send_ns = send_ns;
+        else if(send_ns < st.last_send_ns)
+            add(st.send_backwards, idx);
+        st.last_send_ns = send_ns;
+
+        uint64_t wire_bytes = ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN
+            + L::SPEAD_LEN + len + ETH_L1_OVERHEAD;
+        st.wire_bytes += wire_bytes;
+        int32_t frame = static_cast<int32_t>(spead_counter<L>(r)
+                - st.first_counter);
+        auto fit = st.frames.find(frame);
+        if(fit == st.frames.end())
+            st.frames[frame] = {send_ns, 1, wire_bytes};
+        else
+        {
+            Frame_stat & f = fit->second;
+            if(send_ns < f.first_ns)
+                f.first_ns = send_ns;
+            ++f.pkts;
+            f.wire_bytes += wire_bytes;
+        }
+        Station_stat & s = st.stations[spead_station<L>(r)];
+        ++s.pkts;
+        s.chans.insert(spead_channel<L>(r));
+    }
+    std::sort(st.ranges.begin(), st.ranges.end()
+            , [](const Payload_range & a, const Payload_range & b)
+            { return (a.offset < b.offset)
+                || ((a.offset == b.offset) && (a.len < b.len)); });
+}
+
+// Add the results for a chunk to those for the chunks before it
+void Capture_check::merge(Capture_stats & into, Capture_stats & from)
+{
+    if((into.end_idx != into.first_idx) && (from.end_idx != from.first_idx)
+            && (from.first_send_ns < into.last_send_ns))
+        add(into.send_backwards, from.first_idx);
+    if(into.end_idx == into.first_idx)
+        into.first_send_ns = from.first_send_ns;
+    if(from.end_idx != from.first_idx)
+        into.last_send_ns = from.last_send_ns;
+    into.end_idx = from.end_idx;
+    add(into.bad_range, from.bad_range);
+    add(into.bad_zero_len, from.bad_zero_len);
+    add(into.bad_udp_len, from.bad_udp_len);
+    add(into.send_backwards, from.send_backwards);
+    into.zero_payloads += from.zero_payloads;
+    into.wire_bytes += from.wire_bytes;
+
+    size_t mid = into.ranges.size();
+    into.ranges.insert(into.ranges.end(), from.ranges.begin()
+            , from.ranges.end());
+    std::inplace_merge(into.ranges.begin(), into.ranges.begin() + mid
+            , into.ranges.end()
+            , [](const Payload_range & a, const Payload_range & b)
+            { return (a.offset < b.offset)
+                || ((a.offset == b.offset) && (a.len < b.len)); });
+    from.ranges.clear();
+
+    for(auto & ff: from.frames)
+    {
+        auto fit = into.frames.find(ff.first);
+        if(fit == into.frames.end())
+        {
+            into.frames.insert(ff);
+            continue;
+        }
+        Frame_stat & f = fit->second;
+        if(ff.second.first_ns < f.first_ns)
+            f.first_ns = ff.second.first_ns;
+        f.pkts += ff.second.pkts;
+        f.wire_bytes += ff.second.wire_bytes;
+    }
+    for(auto & fs: from.stations)
+    {
+        Station_stat & s = into.stations[fs.first];
+        s.pkts += fs.second.pkts;
+        s.chans.insert(fs.second.chans.begin(), fs.second.chans.end());
+    }
+}
+
+// Walk the payload ranges in offset order: a range starting inside an
+// earlier one overlaps it, unless the two are the same
+void Capture_check::find_overlaps()
+{
+    uint64_t end = 0; // furthest byte used so far
+    const Payload_range * prev = nullptr;
+    for(auto & r: m_stats.ranges)
+    {
+        if(prev && (r.offset == prev->offset) && (r.len == prev->len))
+        {
+            ++m_stats.shared;
+            continue;
+        }
+        if(r.offset < end)
+            add(m_stats.overlap, r.idx);
+        uint64_t r_end = r.offset + r.len;
+        if(r_end > end)
+        {
+            m_stats.payload_bytes += r_end - ((r.offset > end) ? r.offset
+                    : end);
+            end = r_end;
+        }
+        prev = &r;
+    }
+}
+
+// Bit rate each frame needs to be sent in the time before the next is due
+void Capture_check::frame_rates()
+{
+    auto & frames = m_stats.frames;
+    if(frames.size() == 0)
+        return;
+    uint64_t first_ns = frames.begin()->second.first_ns;
+    uint64_t last_ns = first_ns;
+    for(auto & f: frames)
+    {
+        if(f.second.first_ns < last_ns)
+            add(m_frame_backwards, f.first + m_stats.first_counter);
+        else
+            last_ns = f.second.first_ns;
+    }
+    m_period_ns = (frames.size() < 2) ? 0
+        : ((last_ns - first_ns) / (frames.size() - 1));
+
+    // Times are made monotonic, as when the frames are sent
+    uint64_t total_ns = 0;
+    uint64_t prev_ns = first_ns;
+    bool is_first = true;
+    for(auto it=frames.begin(); it!=frames.end(); ++it)
+    {
+        auto next = std::next(it);
+        uint64_t this_ns = (it->second.first_ns > prev_ns)
+            ? it->second.first_ns : prev_ns;
+        uint64_t next_ns = this_ns + m_period_ns;
+        if(next != frames.end())
+            next_ns = (next->second.first_ns > this_ns)
+                ? next->second.first_ns : this_ns;
+        prev_ns = this_ns;
+        total_ns += next_ns - this_ns;
+        if(next_ns == this_ns)
+        {
+            // Has to go out at once along with the next frame
+            ++m_frames_no_gap;
+            ++m_frames_over_line;
+            continue;
+        }
+        double gbps = it->second.wire_bytes * 8.0 * m_speed
+            / (next_ns - this_ns);
+        if(is_first || (gbps < m_rate_min_gbps))
+            m_rate_min_gbps = gbps;
+        if(is_first || (gbps > m_rate_max_gbps))
+            m_rate_max_gbps = gbps;
+        if(gbps > m_line_gbps)
+            ++m_frames_over_line;
+        is_first = false;
+    }
+    if(total_ns != 0)
+        m_rate_avg_gbps = m_stats.wire_bytes * 8.0 * m_speed / total_ns;
+}
+
+// Check all the records, spreading the work over all CPUs
+bool Capture_check::scan(const char * hdr, uint64_t hdr_len
+        , uint64_t payload_len, Spead_version version)
+{
+    if(version == Spead_version::AUTO)
+        version = detect_spead_version(hdr, hdr_len);
+    m_version = version;
+    m_payload_len = payload_len;
+    uint64_t rec_len = (version == Spead_version::V2)
+        ? sizeof(Spead_v2::Record) : sizeof(Spead_v1::Record);
+    if((hdr_len % rec_len) != 0)
+    {
+        std::cout << "Error - header file isn't a whole number of " << rec_len
+            << " byte records" << std::endl;
+        return false;
+    }
+    uint32_t n_recs = hdr_len / rec_len;
+    uint32_t first_counter = 0;
+    if((n_recs != 0) && (version == Spead_version::V2))
+        first_counter = spead_counter<Spead_v2>(
+                *reinterpret_cast<const Spead_v2::Record *>(hdr));
+    else if(n_recs != 0)
+        first_counter = spead_counter<Spead_v1>(
+                *reinterpret_cast<const Spead_v1::Record *>(hdr));
+
+    std::vector<Capture_stats> chunks((n_recs + CHUNK_RECORDS - 1)
+            / CHUNK_RECORDS);
+    for(size_t c=0; c<chunks.size(); c++)
+    {
+        uint32_t end = (c + 1) * CHUNK_RECORDS;
+        clear(chunks[c], c * CHUNK_RECORDS, (end > n_recs) ? n_recs : end);
+        chunks[c].first_counter = first_counter;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        size_t c;
+        while((c = next++) < chunks.size())
+        {
+            if(version == Spead_version::V2)
+                scan_chunk<Spead_v2>(hdr, payload_len, chunks[c]);
+            else
+                scan_chunk<Spead_v1>(hdr, payload_len, chunks[c]);
+        }
+    };
+    unsigned int n_threads = std::thread::hardware_concurrency();
+    if(n_threads > chunks.size())
+        n_threads = chunks.size();
+    std::vector<std::thread> threads;
+    for(unsigned int t=1; t<n_threads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for(auto & t: threads)
+        t.join();
+
+    clear(m_stats, 0, 0);
+    m_stats.first_counter = first_counter;
+    for(auto & c: chunks)
+        merge(m_stats, c);
+    find_overlaps();
+    frame_rates();
+    return true;
+}
+
+// Problems that stop the capture being sent as the model intended
+uint64_t Capture_check::get_num_errors()
+{
+    return m_stats.bad_range.count + m_stats.bad_zero_len.count
+        + (m_is_raw ? m_stats.bad_udp_len.count : 0);
+}
+
+bool Capture_check::is_line_rate_ok()
+{
+    return (m_frames_over_line == 0);
+}
+
+// Frames (in packet counter order) due earlier than the one before
+uint64_t Capture_check::get_num_frames_backwards()
+{
+    return m_frame_backwards.count;
+}
+
+static void print_count(const char * what, const Check_count & c
+        , const char * first_is = "packet")
+{
+    std::cout << "  " << what << ": " << c.count;
+    if(c.count != 0)
+        std::cout << " (first: " << first_is << " " << c.first_idx << ")";
+    std::cout << std::endl;
+}
+
+void Capture_check::report()
+{
+    uint64_t n_pkts = m_stats.end_idx;
+    std::cout << "\nPreflight check of " << n_pkts << " SPEAD v"
+        << ((m_version == Spead_version::V2) ? 2 : 1) << " packets, "
+        << m_payload_len << " byte data file" << std::endl;
+    print_count("Payloads outside the data file", m_stats.bad_range);
+    print_count("Zero payloads too long", m_stats.bad_zero_len);
+    print_count(m_is_raw ? "UDP lengths not matching the payload"
+            : "UDP lengths not matching the payload (only used by -e)"
+            , m_stats.bad_udp_len);
+    print_count("Payloads partly overlapping another", m_stats.overlap);
+    std::cout << "  Payloads shared with another packet: " << m_stats.shared
+        << ", all zero: " << m_stats.zero_payloads << std::endl;
+    std::cout << "  Data file bytes used: " << m_stats.payload_bytes
+        << " of " << m_payload_len << std::endl;
+    print_count("Send times earlier than the packet before"
+            , m_stats.send_backwards);
+    print_count("Frames due before the frame before", m_frame_backwards
+            , "packet counter");
+
+    std::cout << "  Frames: " << m_stats.frames.size() << ", every "
+        << m_period_ns / 1000.0 << " usec on average" << std::endl;
+    std::cout << "  Rate needed per frame (Gbps on the wire, speed "
+        << m_speed << "): min " << m_rate_min_gbps << ", average "
+        << m_rate_avg_gbps << ", peak " << m_rate_max_gbps << std::endl;
+    if(m_frames_no_gap != 0)
+        std::cout << "  Frames due at the same time as the next: "
+            << m_frames_no_gap << std::endl;
+
+    auto & stations = m_stats.stations;
+    std::cout << "  Stations: " << stations.size() << std::endl;
+    if(stations.size() <= MAX_STATIONS_LISTED)
+    {
+        for(auto & s: stations)
+            std::cout << "    station " << s.first << ": " << s.second.pkts
+                << " packets, " << s.second.chans.size() << " channels"
+                << std::endl;
+    }
+    else
+    {
+        auto lo = stations.begin();
+        auto hi = stations.begin();
+        for(auto it=stations.begin(); it!=stations.end(); ++it)
+        {
+            if(it->second.pkts < lo->second.pkts)
+                lo = it;
+            if(it->second.pkts > hi->second.pkts)
+                hi = it;
+        }
+        std::cout << "    fewest packets: station " << lo->first << " ("
+            << lo->second.pkts << "), most: station " << hi->first << " ("
+            << hi->second.pkts << "), average "
+            << static_cast<double>(n_pkts) / stations.size() << std::endl;
+    }
+
+    std::cout << "Expected rate " << m_rate_avg_gbps << " Gbps";
+    if(is_line_rate_ok())
+        std::cout << ", every frame fits " << m_line_gbps << " Gbps"
+            << std::endl;
+    else
+        std::cout << ", " << m_frames_over_line << " frames need more than "
+            << m_line_gbps << " Gbps" << std::endl;
+    if(get_num_errors() != 0)
+        std::cout << "Capture has " << get_num_errors() << " bad packets"
+            << std::endl;
+}
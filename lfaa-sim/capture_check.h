@@ -0,0 +1,112 @@
+/* Preflight check of a model capture (header and data files), to find out
+ * before a test whether it is consistent and whether it can be played at
+ * line rate.
+ *
+ * Every header record is checked, in parallel chunks:
+ *  - payload offset/length inside the data file (or zero payloads no
+ *    longer than the zero block), UDP length matching the payload
+ *  - payloads that partly overlap another (identical ranges are counted
+ *    as deliberately shared)
+ *  - send times going backwards, in file order and frame by frame
+ * and the packets are summarised per frame (bit rate needed to keep up with
+ * the model's timing) and per station.
+ */
+
+#ifndef CAPTURE_CHECK_H
+#define CAPTURE_CHECK_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include "spead_layout.h"
+
+// Number of records with a problem, and the first of them
+struct Check_count
+{
+    uint64_t count;
+    uint32_t first_idx;
+};
+
+struct Frame_stat
+{
+    uint64_t first_ns;   // earliest send time of the frame's packets
+    uint32_t pkts;
+    uint64_t wire_bytes; // on the wire, including Ethernet overheads
+};
+
+struct Station_stat
+{
+    uint64_t pkts;
+    std::set<uint16_t> chans;
+};
+
+struct Payload_range
+{
+    uint64_t offset;
+    uint32_t len;
+    uint32_t idx;
+};
+
+// Results for some or all of the records
+struct Capture_stats
+{
+    uint32_t first_idx;
+    uint32_t end_idx;
+    Check_count bad_range;     // payload beyond the end of the data file
+    Check_count bad_zero_len;  // zero payload longer than the zero block
+    Check_count bad_udp_len;
+    Check_count send_backwards;
+    Check_count overlap;
+    uint64_t shared;           // payloads identical to another packet's
+    uint64_t first_send_ns;
+    uint64_t last_send_ns;
+    uint64_t zero_payloads;
+    uint64_t payload_bytes;    // of data file used (counting sharing once)
+    uint64_t wire_bytes;
+    std::vector<Payload_range> ranges;
+    // Frames by SPEAD packet counter, less the first record's counter so
+    // that frames after the counter wraps sort after those before
+    uint32_t first_counter;
+    std::map<int32_t, Frame_stat> frames;
+    std::map<uint16_t, Station_stat> stations;
+};
+
+class Capture_check
+{
+    private:
+        double m_speed;
+        double m_line_gbps;
+        bool m_is_raw;
+        Spead_version m_version;
+        uint64_t m_payload_len;
+        Capture_stats m_stats;
+        // Frame timing, in frame (packet counter) order
+        Check_count m_frame_backwards;
+        uint64_t m_period_ns;
+        double m_rate_min_gbps;
+        double m_rate_max_gbps;
+        double m_rate_avg_gbps;
+        uint64_t m_frames_over_line;
+        uint64_t m_frames_no_gap;
+
+        template<class L> static void scan_chunk(const char * hdr
+                , uint64_t payload_len, Capture_stats & st);
+        static void merge(Capture_stats & into, Capture_stats & from);
+        void find_overlaps();
+        void frame_rates();
+
+    public:
+        Capture_check();
+        void set_speed(double speed);
+        void set_line_rate(double gbps);
+        void set_raw_mode(bool is_raw);
+        bool scan(const char * hdr, uint64_t hdr_len, uint64_t payload_len
+                , Spead_version version);
+        uint64_t get_num_errors();
+        bool is_line_rate_ok();
+        uint64_t get_num_frames_backwards();
+        void report();
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "control_server.h"
+#include "sender_control.h"
+#include <iostream> // for cin cout cerr
+#include <sstream>
+#include <cstring> // for strerror
+#include <stdlib.h> // for strtod strtoul
+#include <errno.h>
+#include <unistd.h> // for close pipe unlink
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h> // for sockaddr_un
+
+#define MIN_RATE 0.1
+#define MAX_RATE 10.0
+#define MAX_STATION 65535
+
+Control_server::Control_server(Sender_control * ctl)
+    : m_ctl(ctl)
+    , m_listen_sock(-1)
+{
+    m_stop_pipe[0] = -1;
+    m_stop_pipe[1] = -1;
+}
+
+Control_server::~Control_server()
+{
+    stop();
+}
+
+bool Control_server::start(std::string path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Control socket path too long: " << path << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    m_listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_listen_sock < 0)
+    {
+        std::cerr << "ERROR creating control socket: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+    unlink(path.c_str()); // left behind by an earlier run
+    if((bind(m_listen_sock, reinterpret_cast<struct sockaddr *>(&addr)
+                    , sizeof(addr)) < 0)
+            || (listen(m_listen_sock, 4) < 0)
+            || (pipe(m_stop_pipe) < 0))
+    {
+        std::cerr << "ERROR opening control socket '" << path << "': "
+            << strerror(errno) << std::endl;
+        close(m_listen_sock);
+        m_listen_sock = -1;
+        return false;
+    }
+    m_path = path;
+    m_thread = std::thread(&Control_server::serve, this);
+    std::cout << "Control socket: " << path << std::endl;
+    return true;
+}
+
+void Control_server::stop()
+{
+    if(!m_thread.joinable())
+        return;
+    char c = 0;
+    if(write(m_stop_pipe[1], &c, 1) < 0)
+        std::cerr << "ERROR stopping control thread" << std::endl;
+    m_thread.join();
+    close(m_listen_sock);
+    close(m_stop_pipe[0]);
+    close(m_stop_pipe[1]);
+    unlink(m_path.c_str());
+    m_listen_sock = -1;
+}
+
+// Accept clients one at a time until told to stop
+void Control_server::serve()
+{
+    struct pollfd pfd[2];
+    pfd[0].fd = m_stop_pipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = m_listen_sock;
+    pfd[1].events = POLLIN;
+    while(true)
+    {
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        if(pfd[0].revents)
+            return;
+        if(pfd[1].revents & POLLIN)
+        {
+            int sock = accept(m_listen_sock, nullptr, nullptr);
+            if(sock >= 0)
+            {
+                serve_client(sock);
+                close(sock);
+            }
+        }
+    }
+}
+
+void Control_server::serve_client(int sock)
+{
+    struct pollfd pfd[2];
+    pfd[0].fd = m_stop_pipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sock;
+    pfd[1].events = POLLIN;
+    std::string pending;
+    while(true)
+    {
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        if(pfd[0].revents)
+            return;
+        char buf[256];
+        ssize_t len = read(sock, buf, sizeof(buf));
+        if(len <= 0)
+            return;
+        pending.append(buf, len);
+        size_t eol;
+        while((eol = pending.find('\n')) != std::string::npos)
+        {
+            std::string reply = command(pending.substr(0, eol)) + "\n";
+            pending.erase(0, eol+1);
+            if(!send_reply(sock, reply))
+                return;
+        }
+    }
+}
+
+// Send all of a reply. MSG_NOSIGNAL stops a client that has gone away from
+// killing the simulator with SIGPIPE; EPIPE just ends its session
+bool Control_server::send_reply(int sock, const std::string & reply)
+{
+    size_t done = 0;
+    while(done < reply.size())
+    {
+        ssize_t len = send(sock, reply.data() + done, reply.size() - done
+                , MSG_NOSIGNAL);
+        if(len < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        done += len;
+    }
+    return true;
+}
+
+// Carry out one command line, returning the reply text
+std::string Control_server::command(std::string line)
+{
+    std::istringstream words(line);
+    std::string cmd;
+    words >> cmd;
+    Control_cmd c = {Control_type::PAUSE, 0.0, 0, nullptr};
+
+    if(cmd == "stats")
+    {
+        std::ostringstream out;
+        out << "pkts=" << m_ctl->pkts_sent.load()
+            << " bytes=" << m_ctl->bytes_sent.load()
+            << " frames=" << m_ctl->frames_sent.load()
+            << " repeat=" << m_ctl->repeat.load()
+            << " filtered=" << m_ctl->pkts_filtered.load()
+            << " impaired=" << m_ctl->pkts_impaired.load()
+            << " dropped=" << m_ctl->pkts_dropped.load()
+            << " speed=" << m_ctl->speed.load()
+            << " paused=" << (m_ctl->is_paused.load() ? 1 : 0);
+        return out.str();
+    }
+    else if(cmd == "pause")
+    {
+        c.type = Control_type::PAUSE;
+    }
+    else if(cmd == "resume")
+    {
+        c.type = Control_type::RESUME;
+    }
+    else if(cmd == "rate")
+    {
+        c.type = Control_type::RATE;
+        if(!(words >> c.rate) || (c.rate < MIN_RATE) || (c.rate > MAX_RATE))
+            return "ERROR rate must be between 0.1 and 10";
+    }
+    else if(cmd == "burst")
+    {
+        c.type = Control_type::BURST;
+        if(!(words >> c.count) || (c.count == 0))
+            return "ERROR usage: burst <num_packets>";
+    }
+    else if(cmd == "stations")
+    {
+        c.type = Control_type::STATIONS;
+        std::string list;
+        words >> list;
+        if(list.size() == 0)
+            return "ERROR usage: stations all|<id,id,...>";
+        if(list != "all")
+        {
+            c.filter = new Station_filter(MAX_STATION+1, false);
+            std::istringstream ids(list);
+            std::string id;
+            while(std::getline(ids, id, ','))
+            {
+                char * end;
+                unsigned long station = strtoul(id.c_str(), &end, 10);
+                if((id.size() == 0) || (*end != '\0')
+                        || (station > MAX_STATION))
+                {
+                    delete c.filter;
+                    return "ERROR bad station id '" + id + "'";
+                }
+                (*c.filter)[station] = true;
+            }
+        }
+    }
+    else if(cmd == "help")
+    {
+        return "commands: pause, resume, rate <factor>,"
+            " stations all|<id,...>, burst <n>, stats";
+    }
+    else
+    {
+        return "ERROR unknown command '" + cmd + "'";
+    }
+
+    if(!m_ctl->post(c))
+    {
+        delete c.filter;
+        return "ERROR sender busy, try again";
+    }
+    return "OK";
+}
@@ -0,0 +1,44 @@
+/* This class provides a local control endpoint (Unix stream socket) for a
+ * running simulator. Each connection sends text commands, one per line, and
+ * gets a one-line reply:
+ *   pause | resume          stop/restart sending at the next frame boundary
+ *   rate <factor>           change replay speed (0.1 to 10)
+ *   stations all|<id,...>   only send packets from the listed stations
+ *   burst <n>               drop the next n packets (impairment test)
+ *   stats                   live counters
+ * eg: echo "rate 2" | socat - UNIX-CONNECT:/tmp/lfaa.sock
+ */
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+class Sender_control;
+
+class Control_server
+{
+    private:
+        Sender_control * m_ctl;
+        std::string m_path;
+        int m_listen_sock;
+        int m_stop_pipe[2];
+        std::thread m_thread;
+
+        void serve();
+        void serve_client(int sock);
+        bool send_reply(int sock, const std::string & reply);
+        std::string command(std::string line);
+
+    public:
+        Control_server(Sender_control * ctl);
+        ~Control_server();
+        Control_server(const Control_server&) = delete; // no copy
+        Control_server& operator=(const Control_server &) = delete; // no assign
+        bool start(std::string path);
+        void stop();
+};
+
+#endif
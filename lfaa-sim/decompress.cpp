@@ -0,0 +1,412 @@
+#include "decompress.h"
+#include <iostream> // for cin cout cerr
+#include <cstring> // for memcpy memmove
+#include <vector>
+#include <thread>
+#include <atomic>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+
+#define ZSTD_MAGIC 0xFD2FB528
+#define ZSTD_SKIP_MAGIC 0x184D2A50 // low 4 bits are user defined
+#define LZ4_MAGIC 0x184D2204
+
+static uint32_t little_endian_32bit(const char * ptr)
+{
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(ptr);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+Compression detect_compression(const char * buf, size_t len)
+{
+    if(len < 4)
+        return Compression::NONE;
+    uint32_t magic = little_endian_32bit(buf);
+    if((magic == ZSTD_MAGIC) || ((magic & 0xfffffff0) == ZSTD_SKIP_MAGIC))
+        return Compression::ZSTD;
+    if(magic == LZ4_MAGIC)
+        return Compression::LZ4;
+    return Compression::NONE;
+}
+
+const char * compression_name(Compression type)
+{
+    switch(type)
+    {
+    case Compression::ZSTD:
+        return "zstd";
+    case Compression::LZ4:
+        return "lz4";
+    default:
+        return "uncompressed";
+    }
+}
+
+// One independently decodable piece of a compressed file. If the size it
+// decompresses to isn't known in advance, 'max_size' is an upper bound and
+// the output is closed up afterwards.
+struct Piece
+{
+    const char * src;
+    size_t src_len;
+    uint64_t max_size;
+    bool is_stored;     // lz4 block stored without compression
+    uint64_t dst_offset;
+    uint64_t dst_len;   // filled in by decompression
+};
+
+static bool alloc_output(std::unique_ptr<char[]> & dst, uint64_t len)
+{
+    try
+    {
+        dst = std::make_unique<char[]>(len);
+    }
+    catch (std::bad_alloc & ba)
+    {
+        std::cerr << "Couldn't allocate RAM for decompressed file: "
+            << ba.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Run decode(piece) for every piece, spread over all available CPUs
+template<typename F>
+static bool decode_parallel(std::vector<Piece> & pieces, F decode)
+{
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]()
+    {
+        size_t i;
+        while(ok && ((i = next++) < pieces.size()))
+        {
+            if(!decode(pieces[i]))
+                ok = false;
+        }
+    };
+    unsigned int n_threads = std::thread::hardware_concurrency();
+    if(n_threads > pieces.size())
+        n_threads = pieces.size();
+    std::vector<std::thread> threads;
+    for(unsigned int t=1; t<n_threads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for(auto & t: threads)
+        t.join();
+    return ok;
+}
+
+// Lay out pieces end to end in the output, decode them in parallel, then
+// close up any gaps left by pieces that came out shorter than max_size
+template<typename F>
+static bool decode_pieces(std::vector<Piece> & pieces, F decode
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len)
+{
+    uint64_t total = 0;
+    for(auto & p: pieces)
+    {
+        p.dst_offset = total;
+        total += p.max_size;
+    }
+    if(!alloc_output(dst, total))
+        return false;
+    char * out = dst.get();
+    if(!decode_parallel(pieces, [&](Piece & p){ return decode(p, out); }))
+        return false;
+
+    dst_len = 0;
+    for(auto & p: pieces)
+    {
+        if((p.dst_offset != dst_len) && (p.dst_len != 0))
+            memmove(out + dst_len, out + p.dst_offset, p.dst_len);
+        dst_len += p.dst_len;
+    }
+    return true;
+}
+
+#ifdef HAVE_ZSTD
+// Fallback for frames that don't record their decompressed size
+static bool zstd_stream(const char * src, size_t len
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len)
+{
+    ZSTD_DCtx * dctx = ZSTD_createDCtx();
+    uint64_t cap = 4 * static_cast<uint64_t>(len) + ZSTD_DStreamOutSize();
+    if(!alloc_output(dst, cap))
+    {
+        ZSTD_freeDCtx(dctx);
+        return false;
+    }
+    ZSTD_inBuffer in = {src, len, 0};
+    dst_len = 0;
+    // rv is 0 once a frame is complete and flushed. Keep going after the
+    // input is used up while output is still to be flushed
+    size_t rv = 1;
+    bool is_out_full = false;
+    while((in.pos < in.size) || ((rv != 0) && is_out_full))
+    {
+        if(cap - dst_len < ZSTD_DStreamOutSize())
+        {
+            std::unique_ptr<char[]> bigger;
+            if(!alloc_output(bigger, cap * 2))
+            {
+                ZSTD_freeDCtx(dctx);
+                return false;
+            }
+            memcpy(bigger.get(), dst.get(), dst_len);
+            dst = std::move(bigger);
+            cap *= 2;
+        }
+        ZSTD_outBuffer out = {dst.get() + dst_len, cap - dst_len, 0};
+        rv = ZSTD_decompressStream(dctx, &out, &in);
+        if(ZSTD_isError(rv))
+        {
+            std::cerr << "zstd error: " << ZSTD_getErrorName(rv) << std::endl;
+            ZSTD_freeDCtx(dctx);
+            return false;
+        }
+        dst_len += out.pos;
+        is_out_full = (out.pos == out.size);
+    }
+    ZSTD_freeDCtx(dctx);
+    if(rv != 0)
+    {
+        std::cerr << "zstd error: truncated frame" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool zstd_decompress(const char * src, size_t len
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len)
+{
+    // Each zstd frame can be decoded on its own
+    std::vector<Piece> pieces;
+    size_t pos = 0;
+    while(pos < len)
+    {
+        size_t frame_len = ZSTD_findFrameCompressedSize(src + pos, len - pos);
+        if(ZSTD_isError(frame_len))
+        {
+            std::cerr << "zstd error: " << ZSTD_getErrorName(frame_len)
+                << std::endl;
+            return false;
+        }
+        unsigned long long size = ZSTD_getFrameContentSize(src + pos
+                , len - pos);
+        if(size == ZSTD_CONTENTSIZE_ERROR)
+        {
+            std::cerr << "zstd error: bad frame header" << std::endl;
+            return false;
+        }
+        if(size == ZSTD_CONTENTSIZE_UNKNOWN)
+            return zstd_stream(src, len, dst, dst_len);
+        Piece p = {src + pos, frame_len, size, false, 0, 0};
+        pieces.push_back(p);
+        pos += frame_len;
+    }
+
+    return decode_pieces(pieces, [](Piece & p, char * out)
+        {
+            size_t rv = ZSTD_decompress(out + p.dst_offset, p.max_size
+                    , p.src, p.src_len);
+            if(ZSTD_isError(rv))
+            {
+                std::cerr << "zstd error: " << ZSTD_getErrorName(rv)
+                    << std::endl;
+                return false;
+            }
+            p.dst_len = rv;
+            return true;
+        }, dst, dst_len);
+}
+#endif
+
+#ifdef HAVE_LZ4
+static uint64_t little_endian_64bit(const char * ptr)
+{
+    return little_endian_32bit(ptr)
+        | (static_cast<uint64_t>(little_endian_32bit(ptr+4)) << 32);
+}
+
+// Fallback for frames with linked blocks, which must be decoded in order
+static bool lz4_stream(const char * src, size_t len, char * out
+        , uint64_t out_cap, uint64_t & out_len)
+{
+    LZ4F_dctx * dctx;
+    if(LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        return false;
+    out_len = 0;
+    size_t pos = 0;
+    size_t rv = 1;
+    while((pos < len) && (rv != 0))
+    {
+        size_t dst_size = out_cap - out_len;
+        size_t src_size = len - pos;
+        rv = LZ4F_decompress(dctx, out + out_len, &dst_size, src + pos
+                , &src_size, nullptr);
+        if(LZ4F_isError(rv))
+        {
+            std::cerr << "lz4 error: " << LZ4F_getErrorName(rv) << std::endl;
+            LZ4F_freeDecompressionContext(dctx);
+            return false;
+        }
+        out_len += dst_size;
+        pos += src_size;
+        if((dst_size == 0) && (src_size == 0))
+            break; // output full: caller's bound was wrong
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    return (rv == 0);
+}
+
+static bool lz4_decompress(const char * src, size_t len
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len)
+{
+    // Walk the frames and blocks to find pieces that can be decoded alone:
+    // each block of a frame using independent blocks, otherwise whole frames
+    std::vector<Piece> pieces;
+    size_t pos = 0;
+    while(pos + 7 <= len)
+    {
+        uint32_t magic = little_endian_32bit(src + pos);
+        if((magic & 0xfffffff0) == ZSTD_SKIP_MAGIC)
+        {
+            // skippable frame
+            pos += 8 + little_endian_32bit(src + pos + 4);
+            continue;
+        }
+        if(magic != LZ4_MAGIC)
+        {
+            std::cerr << "lz4 error: bad frame magic" << std::endl;
+            return false;
+        }
+        size_t frame_start = pos;
+        uint8_t flg = src[pos+4];
+        uint8_t bd = src[pos+5];
+        bool independent = (flg & 0x20);
+        bool block_csum = (flg & 0x10);
+        bool has_size = (flg & 0x08);
+        bool content_csum = (flg & 0x04);
+        bool has_dict = (flg & 0x01);
+        uint64_t max_block = 1ULL << (8 + 2 * ((bd >> 4) & 0x7));
+        uint64_t content_size = 0;
+        pos += 6;
+        if(has_size)
+        {
+            if(pos + 8 > len)
+            {
+                std::cerr << "lz4 error: truncated frame" << std::endl;
+                return false;
+            }
+            content_size = little_endian_64bit(src + pos);
+            pos += 8;
+        }
+        if(has_dict)
+            pos += 4;
+        pos += 1; // header checksum
+
+        std::vector<Piece> blocks;
+        uint64_t bound = 0;
+        while(true)
+        {
+            if(pos + 4 > len)
+            {
+                std::cerr << "lz4 error: truncated frame" << std::endl;
+                return false;
+            }
+            uint32_t bsize = little_endian_32bit(src + pos);
+            pos += 4;
+            if(bsize == 0)
+                break; // end mark
+            bool stored = (bsize & 0x80000000);
+            bsize &= 0x7fffffff;
+            if(pos + bsize > len)
+            {
+                std::cerr << "lz4 error: truncated block" << std::endl;
+                return false;
+            }
+            Piece p = {src + pos, bsize, stored ? bsize : max_block, stored
+                , 0, 0};
+            blocks.push_back(p);
+            bound += p.max_size;
+            pos += bsize + (block_csum ? 4 : 0);
+        }
+        pos += (content_csum ? 4 : 0);
+        if(pos > len)
+        {
+            std::cerr << "lz4 error: truncated frame" << std::endl;
+            return false;
+        }
+
+        if(independent)
+        {
+            pieces.insert(pieces.end(), blocks.begin(), blocks.end());
+        }
+        else
+        {
+            Piece p = {src + frame_start, pos - frame_start
+                , has_size ? content_size : bound, false, 0, 0};
+            pieces.push_back(p);
+        }
+    }
+    if(pos != len)
+    {
+        std::cerr << "lz4 error: truncated frame" << std::endl;
+        return false;
+    }
+
+    return decode_pieces(pieces, [](Piece & p, char * out)
+        {
+            char * dst = out + p.dst_offset;
+            if(p.is_stored)
+            {
+                memcpy(dst, p.src, p.src_len);
+                p.dst_len = p.src_len;
+                return true;
+            }
+            if(detect_compression(p.src, p.src_len) == Compression::LZ4)
+                return lz4_stream(p.src, p.src_len, dst, p.max_size
+                        , p.dst_len);
+            int rv = LZ4_decompress_safe(p.src, dst, p.src_len, p.max_size);
+            if(rv < 0)
+            {
+                std::cerr << "lz4 error: corrupt block" << std::endl;
+                return false;
+            }
+            p.dst_len = rv;
+            return true;
+        }, dst, dst_len);
+}
+#endif
+
+bool decompress(Compression type, const char * src, size_t len
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len)
+{
+    switch(type)
+    {
+    case Compression::ZSTD:
+#ifdef HAVE_ZSTD
+        return zstd_decompress(src, len, dst, dst_len);
+#else
+        std::cerr << "zstd input not supported: rebuild with 'make ZSTD=1'"
+            << std::endl;
+        return false;
+#endif
+    case Compression::LZ4:
+#ifdef HAVE_LZ4
+        return lz4_decompress(src, len, dst, dst_len);
+#else
+        std::cerr << "lz4 input not supported: rebuild with 'make LZ4=1'"
+            << std::endl;
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
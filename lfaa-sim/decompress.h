@@ -0,0 +1,29 @@
+/* Decompression of zstd and lz4 compressed input files.
+ *
+ * Compressed files are split into independently decodable pieces (zstd
+ * frames; lz4 frames, or lz4 blocks when the frame uses independent blocks)
+ * which are decompressed in parallel by a pool of threads. A single-frame
+ * zstd file (eg from 'zstd -T0') decompresses on one thread; use pzstd to
+ * get a multi-frame file that decompresses in parallel.
+ *
+ * Support is optional at build time: make ZSTD=1 LZ4=1
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory> // for unique_ptr
+
+enum class Compression{NONE, ZSTD, LZ4};
+
+// Identify compression type from the first bytes of a file
+Compression detect_compression(const char * buf, size_t len);
+const char * compression_name(Compression type);
+
+// Decompress 'len' bytes at 'src' into a newly allocated buffer 'dst'
+bool decompress(Compression type, const char * src, size_t len
+        , std::unique_ptr<char[]> & dst, uint64_t & dst_len);
+
+#endif
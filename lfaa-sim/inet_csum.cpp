@@ -0,0 +1,105 @@
+#include "inet_csum.h"
+#include <cstring> // for memcpy
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Portable version: eight bytes at a time into a 64-bit accumulator, with the
+// carry out of each add wrapped back in (end-around carry)
+static uint64_t csum_partial_scalar(const uint8_t * p, size_t len, uint64_t sum)
+{
+    while(len >= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        uint64_t s = sum + w;
+        sum = s + (s < w);
+        p += 8;
+        len -= 8;
+    }
+    // Fold to 32 bits so the remaining 16-bit words can't overflow
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    while(len >= 2)
+    {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+    if(len)
+    {
+        // odd trailing byte is padded with zero to make a 16-bit word
+        uint16_t w = 0;
+        memcpy(&w, p, 1);
+        sum += w;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+// AVX2 version: 32 bytes per iteration, each 16-bit word zero-extended into
+// one of eight 32-bit lanes. Lanes are drained to 64 bits every 64kB, well
+// before they can overflow.
+__attribute__((target("avx2")))
+static uint64_t csum_partial_avx2(const uint8_t * p, size_t len, uint64_t sum)
+{
+    const __m256i lo_mask = _mm256_set1_epi32(0xffff);
+    while(len >= 32)
+    {
+        size_t blk = (len < 65536) ? (len & ~static_cast<size_t>(31)) : 65536;
+        __m256i acc = _mm256_setzero_si256();
+        for(size_t i=0; i<blk; i+=32)
+        {
+            __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(p + i));
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(v, lo_mask));
+            acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+        for(int i=0; i<8; i++)
+            sum += lanes[i];
+        p += blk;
+        len -= blk;
+    }
+    return csum_partial_scalar(p, len, sum);
+}
+#endif
+
+uint64_t csum_partial(const void * buf, size_t len, uint64_t sum)
+{
+    const uint8_t * p = static_cast<const uint8_t *>(buf);
+#if defined(__x86_64__)
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    if(have_avx2 && (len >= 64))
+        return csum_partial_avx2(p, len, sum);
+#endif
+    return csum_partial_scalar(p, len, sum);
+}
+
+uint16_t csum_fold(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+uint16_t csum_update(uint16_t csum, const void * old_data
+        , const void * new_data, size_t len)
+{
+    // HC' = ~(~HC + ~m + m')  where ~m is added by subtracting m
+    uint64_t sum = static_cast<uint16_t>(~csum);
+    sum = csum_partial(new_data, len, sum);
+    const uint8_t * p = static_cast<const uint8_t *>(old_data);
+    for(size_t i=0; i+1<len; i+=2)
+    {
+        uint16_t w;
+        memcpy(&w, p+i, 2);
+        sum += static_cast<uint16_t>(~w);
+    }
+    return csum_fold(sum);
+}
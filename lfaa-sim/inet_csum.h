@@ -0,0 +1,26 @@
+/* Internet (ones' complement) checksum routines used to fill in IPv4 and UDP
+ * checksums when complete Ethernet frames are sent on a raw socket.
+ *
+ * Sums are accumulated on native-order 16-bit words (RFC 1071), so the
+ * folded result can be stored straight into a packet header with memcpy.
+ */
+
+#ifndef INET_CSUM_H
+#define INET_CSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Add the 16-bit words of 'buf' to a running (unfolded) sum. Buffers chained
+// into one checksum must all have even length, except the last one.
+uint64_t csum_partial(const void * buf, size_t len, uint64_t sum);
+
+// Fold a running sum to 16 bits and complement it, ready to store in a header
+uint16_t csum_fold(uint64_t sum);
+
+// Incrementally update a stored checksum when 'len' bytes (even) of the data
+// it covers change from 'old_data' to 'new_data' (RFC 1624)
+uint16_t csum_update(uint16_t csum, const void * old_data
+        , const void * new_data, size_t len);
+
+#endif
@@ -0,0 +1,471 @@
+/* Benchmarks for the lfaa-sim load and transmit paths.
+ *
+ * A synthetic capture is generated in a temporary directory, then:
+ *  - microbenchmarks time Bigfile reads (ifstream vs mmap), header decode,
+ *    data file load and the per-station channel indexing
+ *  - the per-station sample transform: each SIMD kernel's throughput, and
+ *    the whole load-time transform (gain, phase and delay on every station)
+ *  - end-to-end benchmarks send the capture over loopback UDP (and a raw
+ *    socket on a given interface, eg one end of a veth pair) measuring
+ *    packets/s, Gbps, CPU cycles per packet and pacing jitter
+ *  - a check that repeating part of a paced capture takes as long as the
+ *    part sent, not the whole capture, each time
+ *  - a check that the preflight keeps frames in order across a packet
+ *    counter wrap
+ * Results are also written as JSON so runs can be compared across releases.
+ *
+ * Usage: lfaa_bench [-o results.json] [-e interface] [-s stations]
+ *                   [-c channels] [-f frames] [-i iterations]
+ */
+
+#include <iostream> // cout, cin, cerr
+#include <fstream> // for ofstream
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm> // for sort
+#include <cstring>
+#include <unistd.h> // getopt
+#include <stdlib.h> // for atoi mkdtemp
+#include <time.h> // for clock_gettime
+#include <arpa/inet.h> // for inet_pton htons
+#if defined(__x86_64__)
+#include <x86intrin.h> // for __rdtsc
+#endif
+#include "bigfile.h"
+#include "lfaa_tx_data.h"
+#include "tx_socket.h"
+#include "lfaa_sender.h"
+#include "sample_transform.h"
+#include "capture_check.h"
+
+#define HDR_RECORD_LEN 148
+#define PKT_DATA_LEN 8192
+#define FRAME_PERIOD_NS 2211840
+#define BENCH_PORT 4660
+
+struct Bench_result
+{
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+static std::vector<Bench_result> results;
+
+static void report(std::string name, double value, std::string unit)
+{
+    results.push_back({name, value, unit});
+    std::cout << "  " << name << " = " << value << " " << unit << std::endl;
+}
+
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void put_be(uint8_t * p, uint64_t val, int nbytes)
+{
+    for(int i=nbytes-1; i>=0; i--)
+    {
+        p[i] = val & 0xff;
+        val >>= 8;
+    }
+}
+
+// Write header and data files in the layout the matlab model produces.
+// Every frame has one packet per station per channel. If 'paced' is false,
+// all send times are zero so the sender runs flat out. Packet counters
+// start at 'first_counter'.
+static bool write_capture(std::string hdr_name, std::string data_name
+        , uint32_t stations, uint32_t chans, uint32_t frames, bool paced
+        , uint32_t first_counter = 0)
+{
+    std::ofstream hdr(hdr_name, std::ios::binary);
+    std::ofstream data(data_name, std::ios::binary);
+    if(!hdr.is_open() || !data.is_open())
+    {
+        std::cerr << "Can't create capture files in " << hdr_name << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> payload(PKT_DATA_LEN);
+    uint64_t offset = 0;
+    uint32_t pkt = 0;
+    for(uint32_t f=0; f<frames; f++)
+    {
+        for(uint32_t s=0; s<stations; s++)
+        {
+            for(uint32_t c=0; c<chans; c++, pkt++)
+            {
+                uint8_t rec[HDR_RECORD_LEN] = {0};
+                bool is_zero = ((pkt % 5) == 0);
+                put_be(&rec[0], is_zero ? 0xffffffffffffffff : offset, 8);
+                put_be(&rec[8], PKT_DATA_LEN, 4);
+                uint64_t t = paced ? (uint64_t)f * FRAME_PERIOD_NS : 0;
+                put_be(&rec[12], t, 8);
+                // Ethernet: zero MACs, IPv4 ethertype
+                uint8_t * eth = &rec[32];
+                eth[12] = 0x08;
+                // IPv4 127.0.0.1 -> 127.0.0.1, UDP
+                uint8_t * ip = &rec[46];
+                ip[0] = 0x45;
+                put_be(&ip[2], 20 + 8 + 72 + PKT_DATA_LEN, 2);
+                ip[6] = 0x40;
+                ip[8] = 64;
+                ip[9] = 17;
+                inet_pton(AF_INET, "127.0.0.1", &ip[12]);
+                inet_pton(AF_INET, "127.0.0.1", &ip[16]);
+                uint8_t * udp = &rec[66];
+                put_be(&udp[0], BENCH_PORT, 2);
+                put_be(&udp[2], BENCH_PORT, 2);
+                put_be(&udp[4], 8 + 72 + PKT_DATA_LEN, 2);
+                // SPEAD: logical channel, packet counter, station
+                uint8_t * spead = &rec[74];
+                put_be(&spead[0], 0x5304020600000008, 8);
+                put_be(&spead[8], 0x8001, 2);
+                put_be(&spead[10], c, 2);
+                put_be(&spead[12], first_counter + f, 4);
+                put_be(&spead[32], 0x9600, 2);
+                put_be(&spead[34], t, 6);
+                put_be(&spead[56], 0xb001, 2);
+                put_be(&spead[60], s+1, 2);
+                hdr.write(reinterpret_cast<char *>(rec), sizeof(rec));
+                if(!is_zero)
+                {
+                    for(uint32_t i=0; i<PKT_DATA_LEN; i++)
+                        payload[i] = (pkt + i) & 0xff;
+                    data.write(reinterpret_cast<char *>(payload.data())
+                            , PKT_DATA_LEN);
+                    offset += PKT_DATA_LEN;
+                }
+            }
+        }
+    }
+    return hdr.good() && data.good();
+}
+
+// Run fn 'iters' times, returning the median duration in ns
+template<typename F>
+static double median_ns(uint32_t iters, F fn)
+{
+    std::vector<uint64_t> t;
+    for(uint32_t i=0; i<iters; i++)
+    {
+        uint64_t start = now_ns();
+        fn();
+        t.push_back(now_ns() - start);
+    }
+    std::sort(t.begin(), t.end());
+    return t[t.size()/2];
+}
+
+static void bench_load(std::string hdr_name, std::string data_name
+        , uint32_t iters)
+{
+    std::cout << "Load path:" << std::endl;
+    Bigfile probe(data_name, true);
+    probe.read();
+    double mbytes = probe.size() / 1e6;
+
+    double ns = median_ns(iters, [&]{ Bigfile f(data_name, true); f.read(); });
+    report("bigfile_read_ifstream", mbytes / (ns / 1e9), "MB/s");
+    ns = median_ns(iters, [&]{ Bigfile f(data_name, true); f.read_mmap(); });
+    report("bigfile_read_mmap", mbytes / (ns / 1e9), "MB/s");
+
+    // Quieten the loaders' progress messages while timing them
+    std::streambuf * cout_buf = std::cout.rdbuf();
+    std::ostringstream sink;
+    Lfaa_tx_data tx;
+    std::cout.rdbuf(sink.rdbuf());
+    double hdr_ns = median_ns(iters, [&]{ tx.load_header_file(hdr_name); });
+    double data_ns = median_ns(iters, [&]{ tx.load_data_file(data_name); });
+    double idx_ns = median_ns(iters, [&]{ tx.index_channels(); });
+    std::cout.rdbuf(cout_buf);
+    uint32_t n_pkts = tx.get_num_pkts();
+    report("load_header_file", hdr_ns / n_pkts, "ns/pkt");
+    report("load_data_file", data_ns / n_pkts, "ns/pkt");
+    report("index_channels", idx_ns / n_pkts, "ns/pkt");
+}
+
+static void bench_transform(std::string hdr_name, std::string data_name
+        , uint32_t stations, uint32_t iters)
+{
+    std::cout << "Sample transform:" << std::endl;
+    Bigfile probe(data_name, true);
+    probe.read();
+    size_t n_bytes = probe.size();
+    std::vector<int8_t> out(n_bytes);
+    const int8_t * in = reinterpret_cast<const int8_t *>(probe.get());
+    Cint8_weight w;
+    Sample_transform::make_weight(0.7, 33.0, w);
+    std::vector<Simd_level> levels = {Simd_level::SCALAR};
+    if(best_simd_level() != Simd_level::SCALAR)
+        levels.push_back(Simd_level::AVX2);
+    if(best_simd_level() == Simd_level::AVX512)
+        levels.push_back(Simd_level::AVX512);
+    for(auto level: levels)
+    {
+        double ns = median_ns(iters, [&]{
+                cint8_rotate(out.data(), in, n_bytes, w, level); });
+        report(std::string("cint8_rotate_") + simd_level_name(level)
+                , n_bytes / ns, "GB/s");
+    }
+
+    // Whole transform as done when loading, against a plain load
+    Sample_transform xform;
+    for(uint32_t s=0; s<stations; s++)
+    {
+        Station_xform xf = {w, static_cast<int32_t>(100 * s + 7)};
+        xform.set_station(s+1, xf);
+    }
+    std::streambuf * cout_buf = std::cout.rdbuf();
+    std::ostringstream sink;
+    std::cout.rdbuf(sink.rdbuf());
+    Lfaa_tx_data tx;
+    tx.load_header_file(hdr_name);
+    double plain_ns = median_ns(iters, [&]{ tx.load_data_file(data_name); });
+    tx.set_transform(&xform);
+    double xform_ns = median_ns(iters, [&]{ tx.load_data_file(data_name); });
+    std::cout.rdbuf(cout_buf);
+    report("transform_payload", (xform_ns - plain_ns) / tx.get_num_pkts()
+            , "ns/pkt");
+}
+
+static bool bench_send(std::string name, std::string hdr_name
+        , std::string data_name, std::string raw_if, uint32_t repeats)
+{
+    bool is_raw = (raw_if.size() != 0);
+    std::streambuf * cout_buf = std::cout.rdbuf();
+    std::ostringstream sink;
+    std::cout.rdbuf(sink.rdbuf());
+    Lfaa_tx_data tx;
+    tx.set_raw_mode(is_raw);
+    bool ok = tx.load_header_file(hdr_name) && tx.load_data_file(data_name);
+    char dest[] = "127.0.0.1";
+    if(!is_raw)
+        tx.set_dest(dest, BENCH_PORT);
+    std::cout.rdbuf(cout_buf);
+    if(!ok)
+        return false;
+
+    Tx_socket sock;
+    if(!(is_raw ? sock.open_raw(raw_if) : sock.open_udp()))
+        return false;
+
+    std::cout << "Send " << name << ":" << std::endl;
+    Lfaa_sender sender(&tx, &sock);
+    uint64_t c0 = cycles();
+    if(!sender.run(repeats, tx.get_num_pkts()))
+        return false;
+    uint64_t c1 = cycles();
+
+    double secs = sender.get_elapsed_ns() / 1e9;
+    uint64_t pkts = sender.get_pkts_sent();
+    report(name + "_pkt_rate", pkts / secs, "pkts/s");
+    report(name + "_rate", sender.get_bytes_sent() * 8 / secs / 1e9, "Gbps");
+    if(c1 != c0)
+        report(name + "_cycles", static_cast<double>(c1 - c0) / pkts
+                , "cycles/pkt");
+    if(sender.get_num_paced() != 0)
+    {
+        report(name + "_late_mean", sender.get_late_mean_ns() / 1e3, "usec");
+        report(name + "_late_stddev", sender.get_late_stddev_ns() / 1e3
+                , "usec");
+        report(name + "_late_max", sender.get_late_max_ns() / 1e3, "usec");
+    }
+    return true;
+}
+
+// Repeating the first few frames of a paced capture (-z with -r) must take
+// the repeats times the span sent, not the whole capture's
+static bool check_truncated_repeat(std::string hdr_name, std::string data_name
+        , uint32_t stations, uint32_t chans, uint32_t frames)
+{
+    const uint32_t repeats = 2;
+    uint32_t n_frames = (frames > 10) ? (frames / 10) : 1;
+    std::streambuf * cout_buf = std::cout.rdbuf();
+    std::ostringstream sink;
+    std::cout.rdbuf(sink.rdbuf());
+    Lfaa_tx_data tx;
+    bool ok = tx.load_header_file(hdr_name) && tx.load_data_file(data_name);
+    char dest[] = "127.0.0.1";
+    tx.set_dest(dest, BENCH_PORT);
+    std::cout.rdbuf(cout_buf);
+    Tx_socket sock;
+    if(!ok || !sock.open_udp())
+        return false;
+
+    std::cout << "Truncated repeat:" << std::endl;
+    Lfaa_sender sender(&tx, &sock);
+    if(!sender.run(repeats, n_frames * stations * chans))
+        return false;
+    // The last frame goes out a frame period before the end of the span
+    double expect_ns = ((1.0 + repeats) * n_frames - 1) * FRAME_PERIOD_NS;
+    double ratio = sender.get_elapsed_ns() / expect_ns;
+    report("truncated_repeat_time", ratio, "x expected");
+    if((ratio < 0.9) || (ratio > 1.25))
+    {
+        std::cerr << "Truncated repeat took " << sender.get_elapsed_ns() / 1e6
+            << " msec, expected " << expect_ns / 1e6 << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A capture whose packet counter wraps half way through must still check
+// out with its frames in order, each due a frame period after the last
+static bool check_counter_wrap(std::string dir, uint32_t stations
+        , uint32_t chans, uint32_t frames)
+{
+    std::string hdr_name = dir + "/wrap.hdr";
+    std::string data_name = dir + "/wrap.dat";
+    bool ok = write_capture(hdr_name, data_name, stations, chans, frames
+            , true, 0xffffffff - frames/2);
+    Bigfile hdr(hdr_name);
+    Bigfile data(data_name);
+    ok = ok && hdr.read() && data.read_size();
+    Capture_check check;
+    ok = ok && check.scan(hdr.get(), hdr.size(), data.size()
+            , Spead_version::AUTO);
+    unlink(hdr_name.c_str());
+    unlink(data_name.c_str());
+    if(!ok)
+        return false;
+
+    std::cout << "Packet counter wrap:" << std::endl;
+    report("wrap_frames_backwards", check.get_num_frames_backwards()
+            , "frames");
+    if((check.get_num_frames_backwards() != 0) || !check.is_line_rate_ok())
+    {
+        std::cerr << "Frames out of order across the packet counter wrap"
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool write_results(std::string file_name, uint32_t stations
+        , uint32_t chans, uint32_t frames)
+{
+    std::ofstream out(file_name);
+    if(!out.is_open())
+    {
+        std::cerr << "Unable to write results to '" << file_name << "'"
+            << std::endl;
+        return false;
+    }
+    out << "{\n  \"tool\": \"lfaa-sim\",\n  \"time\": " << time(nullptr)
+        << ",\n  \"config\": {\"stations\": " << stations
+        << ", \"channels\": " << chans << ", \"frames\": " << frames
+        << "},\n  \"results\": [\n";
+    for(size_t i=0; i<results.size(); i++)
+    {
+        out << "    {\"name\": \"" << results[i].name << "\", \"value\": "
+            << results[i].value << ", \"unit\": \"" << results[i].unit
+            << "\"}" << ((i+1 < results.size()) ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.good();
+}
+
+void usage(char * progname)
+{
+    std::cout << "USAGE: " << progname << " [-o results.json] [-e interface]"
+        << " [-s stations] [-c channels] [-f frames] [-i iterations]"
+        << std::endl;
+}
+
+int main(int argc, char * argv[])
+{
+    int ret;
+    std::string out_name = "bench_results.json";
+    std::string raw_if_name;
+    uint32_t stations = 4;
+    uint32_t chans = 8;
+    uint32_t frames = 200;
+    uint32_t iters = 5;
+    while((ret = getopt(argc, argv, "o:e:s:c:f:i:?")) != -1)
+    {
+        switch(ret)
+        {
+            case 'o':
+                out_name = std::string(optarg);
+                break;
+            case 'e':
+                raw_if_name = std::string(optarg);
+                break;
+            case 's':
+                stations = atoi(optarg);
+                break;
+            case 'c':
+                chans = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'i':
+                iters = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if((stations == 0) || (chans == 0) || (frames == 0) || (iters == 0))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    char dir_template[] = "/tmp/lfaa_bench_XXXXXX";
+    if(mkdtemp(dir_template) == nullptr)
+    {
+        std::cerr << "Can't create temporary directory: " << strerror(errno)
+            << std::endl;
+        return -1;
+    }
+    std::string dir(dir_template);
+    std::string burst_hdr = dir + "/burst.hdr";
+    std::string paced_hdr = dir + "/paced.hdr";
+    std::string data_name = dir + "/capture.dat";
+    bool ok = write_capture(burst_hdr, data_name, stations, chans, frames
+                , false)
+        && write_capture(paced_hdr, data_name, stations, chans, frames, true);
+
+    if(ok)
+    {
+        bench_load(paced_hdr, data_name, iters);
+        bench_transform(paced_hdr, data_name, stations, iters);
+        ok = bench_send("udp_burst", burst_hdr, data_name, "", iters - 1)
+            && bench_send("udp_paced", paced_hdr, data_name, "", 0)
+            && check_truncated_repeat(paced_hdr, data_name, stations, chans
+                    , frames)
+            && check_counter_wrap(dir, stations, chans, frames);
+        if(ok && (raw_if_name.size() != 0))
+            ok = bench_send("raw_burst", burst_hdr, data_name, raw_if_name
+                        , iters - 1)
+                && bench_send("raw_paced", paced_hdr, data_name, raw_if_name
+                        , 0);
+    }
+
+    unlink(burst_hdr.c_str());
+    unlink(paced_hdr.c_str());
+    unlink(data_name.c_str());
+    rmdir(dir.c_str());
+
+    if(!ok || !write_results(out_name, stations, chans, frames))
+        return -1;
+    std::cout << "Results written to " << out_name << std::endl;
+    return 0;
+}
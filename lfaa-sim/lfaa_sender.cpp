@@ -0,0 +1,590 @@
+#include "lfaa_sender.h"
+#include "lfaa_tx_data.h"
+#include "tx_socket.h"
+#include "tx_timestamps.h"
+#include "sender_control.h"
+#include "stream_source.h"
+#include <iostream> // for cin cout cerr
+#include <cstring> // for strerror
+#include <cmath> // for sqrt
+#include <time.h> // for clock_gettime
+#include <errno.h>
+
+#define MIN_SPEED 0.1
+#define MAX_SPEED 10.0
+#define START_SPIN_NS 200000 // busy-wait the last 200usec before start time
+#define PAUSE_POLL_NS 1000000 // check for commands every 1msec when paused
+// Most packets sent at once from a stream, leaving the rest of the ring for
+// the producer to fill meanwhile
+#define STREAM_MAX_BATCH (STREAM_RING_LEN / 2)
+
+static uint64_t timespec_ns(const timespec & ts)
+{
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+Lfaa_sender::Lfaa_sender(Lfaa_tx_data * data, Tx_socket * sock)
+    : m_data(data)
+    , m_sock(sock)
+    , m_speed(1.0)
+    , m_tstamps(nullptr)
+    , m_ctl(nullptr)
+    , m_filter(nullptr)
+    , m_burst_left(0)
+    , m_msg_lane(nullptr)
+    , m_lane(0)
+    , m_has_start_at(false)
+    , m_start_clock(CLOCK_REALTIME)
+    , m_start_at_ns(0)
+    , m_start_error_ns(0)
+    , m_pkts_sent(0)
+    , m_bytes_sent(0)
+    , m_elapsed_ns(0)
+    , m_pkts_filtered(0)
+    , m_pkts_impaired(0)
+    , m_pkts_dropped(0)
+    , m_num_paced(0)
+    , m_late_min_ns(0)
+    , m_late_max_ns(0)
+    , m_late_sum_ns(0.0)
+    , m_late_sumsq_ns(0.0)
+{
+}
+
+void Lfaa_sender::record_lateness(int64_t late_ns)
+{
+    if((m_num_paced == 0) || (late_ns < m_late_min_ns))
+        m_late_min_ns = late_ns;
+    if((m_num_paced == 0) || (late_ns > m_late_max_ns))
+        m_late_max_ns = late_ns;
+    m_late_sum_ns += late_ns;
+    m_late_sumsq_ns += static_cast<double>(late_ns) * late_ns;
+    ++m_num_paced;
+}
+
+// Replay speed relative to the model's timing (0.1 to 10)
+bool Lfaa_sender::set_speed(double speed)
+{
+    if((speed < MIN_SPEED) || (speed > MAX_SPEED))
+    {
+        std::cout << "Speed factor must be between " << MIN_SPEED << " and "
+            << MAX_SPEED << std::endl;
+        return false;
+    }
+    m_speed = speed;
+    return true;
+}
+
+// Hold the first frame back until 'start_ns' on the given clock
+void Lfaa_sender::set_start_at(clockid_t clock, uint64_t start_ns)
+{
+    m_has_start_at = true;
+    m_start_clock = clock;
+    m_start_at_ns = start_ns;
+}
+
+// How far from the requested start time sending actually began
+int64_t Lfaa_sender::get_start_error_ns()
+{
+    return m_start_error_ns;
+}
+
+// Sleep until shortly before the start time, then spin until it arrives.
+// Returns the equivalent CLOCK_MONOTONIC time, which all pacing uses.
+bool Lfaa_sender::wait_for_start(uint64_t & mono_start_ns)
+{
+    timespec ts;
+    if(clock_gettime(m_start_clock, &ts) < 0)
+    {
+        std::cerr << "ERROR: can't read start clock: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+    if(timespec_ns(ts) > m_start_at_ns)
+        std::cout << "WARNING: start time had already passed" << std::endl;
+    else if(m_start_at_ns - timespec_ns(ts) > START_SPIN_NS)
+    {
+        uint64_t wake_ns = m_start_at_ns - START_SPIN_NS;
+        timespec ts_wake;
+        ts_wake.tv_sec = wake_ns / 1000000000;
+        ts_wake.tv_nsec = wake_ns % 1000000000;
+        int rv;
+        do {
+            rv = clock_nanosleep(m_start_clock, TIMER_ABSTIME, &ts_wake
+                    , nullptr);
+        } while(rv == EINTR);
+    }
+
+    uint64_t now_ns;
+    do {
+        clock_gettime(m_start_clock, &ts);
+        now_ns = timespec_ns(ts);
+    } while(now_ns < m_start_at_ns);
+
+    timespec ts_mono;
+    clock_gettime(CLOCK_MONOTONIC, &ts_mono);
+    m_start_error_ns = now_ns - m_start_at_ns;
+    // Pace from the requested start even if we woke a little late
+    mono_start_ns = timespec_ns(ts_mono) - m_start_error_ns;
+    return true;
+}
+
+// Measure when packets leave against their schedule (optional)
+void Lfaa_sender::set_tx_timestamps(Tx_timestamps * tstamps)
+{
+    m_tstamps = tstamps;
+}
+
+// Accept commands from a controller while running (optional)
+void Lfaa_sender::set_control(Sender_control * ctl)
+{
+    m_ctl = ctl;
+}
+
+// Send only the messages whose entry in 'msg_lane' is 'lane', when several
+// senders share the data (eg one per interface). Sending the same data with
+// more than one sender needs everything else to be per-sender too: the
+// control mailbox and TX timestamps aren't.
+void Lfaa_sender::set_lane(const std::vector<uint32_t> * msg_lane
+        , uint32_t lane)
+{
+    m_msg_lane = msg_lane;
+    m_lane = lane;
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time
+static bool sleep_until(uint64_t due_ns)
+{
+    timespec ts_due;
+    ts_due.tv_sec = due_ns / 1000000000;
+    ts_due.tv_nsec = due_ns % 1000000000;
+    int rv;
+    do {
+        rv = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_due, nullptr);
+    } while(rv == EINTR);
+    if(rv != 0)
+    {
+        std::cerr << "ERROR: clock_nanosleep failure: " << strerror(rv)
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Apply commands from the controller. Called between frames; 'origin_ns' is
+// the monotonic time that model time zero maps to, and 'model_ns' is the
+// model time of the frame about to be sent.
+void Lfaa_sender::apply_control(int64_t & origin_ns, uint64_t model_ns)
+{
+    Control_cmd cmd;
+    bool is_paused = false;
+    uint64_t pause_start_ns = 0;
+    while(true)
+    {
+        if(!m_ctl->fetch(cmd))
+        {
+            if(!is_paused)
+                return;
+            // Paused: keep checking for commands
+            timespec ts = {0, PAUSE_POLL_NS};
+            nanosleep(&ts, nullptr);
+            continue;
+        }
+        switch(cmd.type)
+        {
+        case Control_type::PAUSE:
+            if(!is_paused)
+            {
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                pause_start_ns = timespec_ns(ts);
+                is_paused = true;
+                m_ctl->is_paused = true;
+            }
+            break;
+        case Control_type::RESUME:
+            if(is_paused)
+            {
+                // Shift the whole schedule on by the time spent paused
+                timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                origin_ns += timespec_ns(ts) - pause_start_ns;
+                is_paused = false;
+                m_ctl->is_paused = false;
+            }
+            break;
+        case Control_type::RATE:
+            // Keep this frame's due time, change the rate from here on
+            origin_ns += static_cast<int64_t>(model_ns / m_speed)
+                - static_cast<int64_t>(model_ns / cmd.rate);
+            m_speed = cmd.rate;
+            m_ctl->speed = m_speed;
+            break;
+        case Control_type::STATIONS:
+            delete m_filter;
+            m_filter = cmd.filter;
+            break;
+        case Control_type::BURST:
+            m_burst_left += cmd.count;
+            break;
+        }
+    }
+}
+
+// Whether a packet from 'station' is left out, by the station filter or as
+// part of a burst being dropped
+bool Lfaa_sender::is_held_back(uint16_t station)
+{
+    if(m_filter && !(*m_filter)[station])
+    {
+        ++m_pkts_filtered;
+        return true;
+    }
+    if(m_burst_left != 0)
+    {
+        --m_burst_left;
+        ++m_pkts_impaired;
+        return true;
+    }
+    return false;
+}
+
+// Show the controller how far sending has got, after each frame
+void Lfaa_sender::publish_counters()
+{
+    m_ctl->pkts_sent.store(m_pkts_sent, std::memory_order_relaxed);
+    m_ctl->bytes_sent.store(m_bytes_sent, std::memory_order_relaxed);
+    m_ctl->frames_sent.fetch_add(1, std::memory_order_relaxed);
+    m_ctl->pkts_filtered.store(m_pkts_filtered, std::memory_order_relaxed);
+    m_ctl->pkts_impaired.store(m_pkts_impaired, std::memory_order_relaxed);
+    m_ctl->pkts_dropped.store(m_pkts_dropped, std::memory_order_relaxed);
+}
+
+// Send the first n_pkts packets (1+repeats) times
+bool Lfaa_sender::run(uint32_t repeats, uint32_t n_pkts)
+{
+    struct mmsghdr * mmsg = m_data->get_mmsg_ptr();
+    const std::vector<Lfaa_frame> & frames = m_data->get_frames();
+    if(frames.size() == 0)
+        return true;
+
+    // Bytes on the wire (or in IP packets for UDP) for each message
+    std::vector<uint32_t> msg_bytes(m_data->get_num_pkts(), 0);
+    uint32_t max_frame_msgs = 0;
+    for(uint32_t msg=0; msg<msg_bytes.size(); msg++)
+    {
+        struct msghdr * mh = &mmsg[msg].msg_hdr;
+        for(size_t vec=0; vec<mh->msg_iovlen; vec++)
+            msg_bytes[msg] += mh->msg_iov[vec].iov_len;
+        // Add bytes in UDP & IP header (already in iovecs for raw frames)
+        if(!m_sock->is_raw())
+            msg_bytes[msg] += (20+8);
+    }
+    uint64_t max_frame_bytes = 0;
+    for(auto & f: frames)
+    {
+        if(f.num_msgs > max_frame_msgs)
+            max_frame_msgs = f.num_msgs;
+        uint64_t bytes = 0;
+        for(uint32_t m=0; m<f.num_msgs; m++)
+        {
+            if(!m_msg_lane || ((*m_msg_lane)[f.first_msg + m] == m_lane))
+                bytes += msg_bytes[f.first_msg + m];
+        }
+        if(bytes > max_frame_bytes)
+            max_frame_bytes = bytes;
+    }
+    m_sock->fit_send_buffer(max_frame_bytes, max_frame_msgs);
+    // Frames are copied here when some of their packets are left out
+    std::vector<struct mmsghdr> batch_buf(max_frame_msgs);
+    std::vector<uint32_t> batch_idx(max_frame_msgs);
+
+    // Each repeat starts one frame period after the last frame of the
+    // previous one, which is earlier than the capture's last when n_pkts
+    // cuts it short
+    size_t last_sent = 0;
+    uint64_t n_reached = frames[0].num_msgs;
+    while((n_reached < n_pkts) && (last_sent+1 < frames.size()))
+        n_reached += frames[++last_sent].num_msgs;
+    uint64_t capture_ns = frames[last_sent].time_ns
+        + m_data->get_frame_period_ns();
+
+    timespec ts_start;
+    bool have_ts_start = (clock_gettime(CLOCK_MONOTONIC, &ts_start) >= 0);
+    uint64_t start_ns = timespec_ns(ts_start);
+    if(m_has_start_at && !wait_for_start(start_ns))
+        return false;
+    int64_t origin_ns = start_ns;
+    bool is_rebased = m_data->is_rebased();
+    if(m_ctl)
+        m_ctl->speed = m_speed;
+
+    // TX timestamps are CLOCK_REALTIME, pacing is CLOCK_MONOTONIC
+    int64_t real_minus_mono_ns = 0;
+    if(m_tstamps)
+    {
+        timespec ts_real, ts_mono;
+        clock_gettime(CLOCK_REALTIME, &ts_real);
+        clock_gettime(CLOCK_MONOTONIC, &ts_mono);
+        real_minus_mono_ns = timespec_ns(ts_real) - timespec_ns(ts_mono);
+    }
+    for(uint32_t rpt=0; rpt<(1+repeats); rpt++)
+    {
+        uint32_t pkts_left = n_pkts;
+        if(m_ctl)
+            m_ctl->repeat.store(rpt, std::memory_order_relaxed);
+        for(size_t f=0; (f<frames.size()) && (pkts_left > 0); f++)
+        {
+            // Timestamps move on by a capture length on each repeat.
+            // Done before waiting so it is off the critical path
+            if(is_rebased && (rpt > 0) && !m_msg_lane)
+                m_data->advance_timestamps(frames[f].first_msg
+                        , frames[f].num_msgs, capture_ns);
+            else if(is_rebased && (rpt > 0))
+            {
+                // Only this lane's: other senders advance their own
+                for(uint32_t m=0; m<frames[f].num_msgs; m++)
+                {
+                    uint32_t msg = frames[f].first_msg + m;
+                    if((*m_msg_lane)[msg] == m_lane)
+                        m_data->advance_timestamps(msg, 1, capture_ns);
+                }
+            }
+
+            uint64_t model_ns = rpt * capture_ns + frames[f].time_ns;
+            if(m_ctl && m_ctl->is_pending())
+                apply_control(origin_ns, model_ns);
+
+            // Wait until the frame is due
+            uint64_t due_ns = origin_ns + static_cast<int64_t>(model_ns/m_speed);
+            if(!sleep_until(due_ns))
+                return false;
+            timespec ts_now;
+            if(clock_gettime(CLOCK_MONOTONIC, &ts_now) >= 0)
+                record_lateness(timespec_ns(ts_now) - due_ns);
+
+            // Pick the frame's packets, leaving out other lanes' packets,
+            // filtered stations and any being dropped as an impairment
+            uint32_t n_msgs = frames[f].num_msgs;
+            if(n_msgs > pkts_left)
+                n_msgs = pkts_left;
+            pkts_left -= n_msgs;
+            struct mmsghdr * batch = &mmsg[frames[f].first_msg];
+            uint32_t n_batch = n_msgs;
+            bool is_picked = (m_filter != nullptr) || (m_burst_left != 0)
+                || (m_msg_lane != nullptr);
+            if(is_picked)
+            {
+                n_batch = 0;
+                for(uint32_t m=0; m<n_msgs; m++)
+                {
+                    uint32_t msg = frames[f].first_msg + m;
+                    if(m_msg_lane && ((*m_msg_lane)[msg] != m_lane))
+                        continue;
+                    if(is_held_back(m_data->get_msg_station(msg)))
+                        continue;
+                    batch_buf[n_batch] = mmsg[msg];
+                    batch_idx[n_batch] = msg;
+                    ++n_batch;
+                }
+                batch = batch_buf.data();
+            }
+
+            // The kernel sets msg_len of each packet it accepts
+            if(m_tstamps)
+            {
+                for(uint32_t m=0; m<n_batch; m++)
+                    batch[m].msg_len = 0;
+            }
+
+            // Send the frame's packets as one batch
+            uint32_t sent = m_sock->send_batch(batch, n_batch);
+
+            // Only accepted packets take a timestamp id, so packets that
+            // were dropped mustn't be expected
+            if(m_tstamps)
+            {
+                for(uint32_t m=0; m<n_batch; m++)
+                {
+                    if(batch[m].msg_len == 0)
+                        continue;
+                    uint32_t msg = is_picked ? batch_idx[m]
+                        : (frames[f].first_msg + m);
+                    uint64_t pkt_ns = rpt * capture_ns
+                        + m_data->get_msg_send_ns(msg);
+                    m_tstamps->expect(origin_ns + real_minus_mono_ns
+                            + static_cast<int64_t>(pkt_ns/m_speed)
+                            , m_data->get_msg_station(msg), f);
+                }
+            }
+            uint64_t batch_bytes = 0;
+            for(uint32_t m=0; m<n_batch; m++)
+            {
+                batch_bytes += msg_bytes[is_picked ? batch_idx[m]
+                    : (frames[f].first_msg + m)];
+            }
+            m_pkts_sent += sent;
+            m_pkts_dropped += n_batch - sent;
+            if(n_batch != 0)
+                m_bytes_sent += batch_bytes * sent / n_batch;
+
+            if(m_ctl)
+                publish_counters();
+        }
+    }
+
+    timespec ts_end;
+    bool have_ts_end = (clock_gettime(CLOCK_MONOTONIC, &ts_end) >= 0);
+    if(have_ts_start && have_ts_end)
+        m_elapsed_ns = timespec_ns(ts_end) - start_ns;
+    return true;
+}
+
+// Send packets as they arrive from a stream, until it ends. Frames are
+// paced by the model's send times as in run(); a frame is complete when the
+// first packet of the next one arrives.
+bool Lfaa_sender::run_stream(Stream_source * src)
+{
+    std::vector<struct mmsghdr> batch_buf(STREAM_MAX_BATCH);
+    if(!src->wait_pkt(0))
+        return true; // nothing to send
+
+    timespec ts_start;
+    bool have_ts_start = (clock_gettime(CLOCK_MONOTONIC, &ts_start) >= 0);
+    uint64_t start_ns = timespec_ns(ts_start);
+    if(m_has_start_at && !wait_for_start(start_ns))
+        return false;
+    int64_t origin_ns = start_ns;
+    if(m_ctl)
+        m_ctl->speed = m_speed;
+
+    uint64_t first_send_ns = src->get_pkt(0).send_ns;
+    uint64_t model_ns = 0;
+    bool is_buffer_fitted = false;
+    for(uint64_t seq=0; src->wait_pkt(seq); )
+    {
+        // Gather the frame: packets sharing the first one's counter
+        const Stream_pkt & first = src->get_pkt(seq);
+        uint64_t end = seq + 1;
+        uint64_t frame_bytes = first.wire_bytes;
+        while(((end - seq) < STREAM_MAX_BATCH) && src->wait_pkt(end)
+                && (src->get_pkt(end).counter == first.counter))
+        {
+            frame_bytes += src->get_pkt(end).wire_bytes;
+            ++end;
+        }
+        // Frame sizes aren't known in advance: assume they're like the first
+        if(!is_buffer_fitted)
+        {
+            m_sock->fit_send_buffer(frame_bytes, end - seq);
+            is_buffer_fitted = true;
+        }
+
+        // Model time never goes backwards
+        if(first.send_ns > first_send_ns + model_ns)
+            model_ns = first.send_ns - first_send_ns;
+        if(m_ctl && m_ctl->is_pending())
+            apply_control(origin_ns, model_ns);
+
+        uint64_t due_ns = origin_ns + static_cast<int64_t>(model_ns/m_speed);
+        if(!sleep_until(due_ns))
+            return false;
+        timespec ts_now;
+        if(clock_gettime(CLOCK_MONOTONIC, &ts_now) >= 0)
+            record_lateness(timespec_ns(ts_now) - due_ns);
+
+        uint32_t n_batch = 0;
+        uint64_t batch_bytes = 0;
+        for(uint64_t i=seq; i<end; i++)
+        {
+            const Stream_pkt & pkt = src->get_pkt(i);
+            if(is_held_back(pkt.station))
+                continue;
+            batch_buf[n_batch++] = src->get_mmsg(i);
+            batch_bytes += pkt.wire_bytes;
+        }
+        uint32_t sent = m_sock->send_batch(batch_buf.data(), n_batch);
+        m_pkts_sent += sent;
+        m_pkts_dropped += n_batch - sent;
+        if(n_batch != 0)
+            m_bytes_sent += batch_bytes * sent / n_batch;
+        if(m_ctl)
+            publish_counters();
+
+        src->release(end);
+        seq = end;
+    }
+
+    timespec ts_end;
+    bool have_ts_end = (clock_gettime(CLOCK_MONOTONIC, &ts_end) >= 0);
+    if(have_ts_start && have_ts_end)
+        m_elapsed_ns = timespec_ns(ts_end) - start_ns;
+    return true;
+}
+
+Lfaa_sender::~Lfaa_sender()
+{
+    delete m_filter;
+}
+
+uint64_t Lfaa_sender::get_pkts_sent()
+{
+    return m_pkts_sent;
+}
+
+uint64_t Lfaa_sender::get_bytes_sent()
+{
+    return m_bytes_sent;
+}
+
+uint64_t Lfaa_sender::get_pkts_filtered()
+{
+    return m_pkts_filtered;
+}
+
+uint64_t Lfaa_sender::get_pkts_impaired()
+{
+    return m_pkts_impaired;
+}
+
+// Packets the socket couldn't send (see Tx_socket for the reasons)
+uint64_t Lfaa_sender::get_pkts_dropped()
+{
+    return m_pkts_dropped;
+}
+
+uint64_t Lfaa_sender::get_elapsed_ns()
+{
+    return m_elapsed_ns;
+}
+
+uint64_t Lfaa_sender::get_num_paced()
+{
+    return m_num_paced;
+}
+
+int64_t Lfaa_sender::get_late_min_ns()
+{
+    return m_late_min_ns;
+}
+
+int64_t Lfaa_sender::get_late_max_ns()
+{
+    return m_late_max_ns;
+}
+
+double Lfaa_sender::get_late_mean_ns()
+{
+    if(m_num_paced == 0)
+        return 0.0;
+    return m_late_sum_ns / m_num_paced;
+}
+
+double Lfaa_sender::get_late_stddev_ns()
+{
+    if(m_num_paced < 2)
+        return 0.0;
+    double mean = m_late_sum_ns / m_num_paced;
+    double var = (m_late_sumsq_ns / m_num_paced) - (mean * mean);
+    return (var > 0.0) ? sqrt(var) : 0.0;
+}
@@ -0,0 +1,93 @@
+/* This class paces LFAA simulation packets out of a Tx_socket according to
+ * the send times in the model's header file, and keeps statistics about how
+ * much was sent and how accurately the pacing was achieved.
+ *
+ * Pacing is done per frame: the sender sleeps until a frame is due, then
+ * sends all its packets as one batch. A speed factor compresses (>1) or
+ * stretches (<1) the model's timeline.
+ *
+ * Sending can be held back until an absolute time on CLOCK_REALTIME or
+ * CLOCK_TAI, so that simulators on several hosts start together.
+ *
+ * Packets come either from files loaded into an Lfaa_tx_data, or from a
+ * Stream_source as the model generates them.
+ */
+
+#ifndef LFAA_SENDER_H
+#define LFAA_SENDER_H
+
+#include <cstdint>
+#include <vector>
+#include <time.h> // for clockid_t
+
+class Lfaa_tx_data;
+class Tx_socket;
+class Tx_timestamps;
+class Sender_control;
+class Stream_source;
+
+class Lfaa_sender
+{
+    private:
+        Lfaa_tx_data * m_data;
+        Tx_socket * m_sock;
+        double m_speed;
+        Tx_timestamps * m_tstamps;
+        // Runtime control: station filter (nullptr: all) and impairment
+        Sender_control * m_ctl;
+        std::vector<bool> * m_filter;
+        uint32_t m_burst_left;
+        // Lane of each message, when this is one of several senders
+        const std::vector<uint32_t> * m_msg_lane;
+        uint32_t m_lane;
+        // Absolute start time, if one was requested
+        bool m_has_start_at;
+        clockid_t m_start_clock;
+        uint64_t m_start_at_ns;
+        int64_t m_start_error_ns;
+        uint64_t m_pkts_sent;
+        uint64_t m_bytes_sent;
+        uint64_t m_elapsed_ns;
+        uint64_t m_pkts_filtered;
+        uint64_t m_pkts_impaired;
+        uint64_t m_pkts_dropped;
+        // Pacing jitter: how late each frame started being sent (ns)
+        uint64_t m_num_paced;
+        int64_t m_late_min_ns;
+        int64_t m_late_max_ns;
+        double m_late_sum_ns;
+        double m_late_sumsq_ns;
+
+        void record_lateness(int64_t late_ns);
+        bool wait_for_start(uint64_t & mono_start_ns);
+        void apply_control(int64_t & origin_ns, uint64_t model_ns);
+        bool is_held_back(uint16_t station);
+        void publish_counters();
+
+    public:
+        Lfaa_sender(Lfaa_tx_data * data, Tx_socket * sock);
+        ~Lfaa_sender();
+        Lfaa_sender(const Lfaa_sender&) = delete; // no copy
+        Lfaa_sender& operator=(const Lfaa_sender &) = delete; // no assign
+        bool set_speed(double speed);
+        void set_start_at(clockid_t clock, uint64_t start_ns);
+        int64_t get_start_error_ns();
+        void set_tx_timestamps(Tx_timestamps * tstamps);
+        void set_control(Sender_control * ctl);
+        void set_lane(const std::vector<uint32_t> * msg_lane, uint32_t lane);
+        bool run(uint32_t repeats, uint32_t n_pkts);
+        bool run_stream(Stream_source * src);
+        uint64_t get_pkts_sent();
+        uint64_t get_bytes_sent();
+        uint64_t get_pkts_filtered();
+        uint64_t get_pkts_impaired();
+        uint64_t get_pkts_dropped();
+        uint64_t get_elapsed_ns();
+        uint64_t get_num_paced();
+        int64_t get_late_min_ns();
+        int64_t get_late_max_ns();
+        double get_late_mean_ns();
+        double get_late_stddev_ns();
+};
+
+#endif
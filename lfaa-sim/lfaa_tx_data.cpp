@@ -1,32 +1,36 @@
 #include "lfaa_tx_data.h"
 #include "bigfile.h"
-#include <cassert>
+#include "inet_csum.h"
+#include "shm_segment.h"
+#include "sample_transform.h"
+#include "spead_layout.h"
 #include <iostream> // for cin cout cerr
 #include <memory> // for make_unique
 #include <cstring> // for memcpy
+#include <algorithm> // for stable_sort
+#include <unordered_map>
+#include <map>
+#include <type_traits> // for is_same
+#include <cstddef> // for offsetof
 
-#define SPEAD_HDR_LEN 72
-
-// Structure in the model-generated header file
-struct Lfaa_hdr_t
-{
-    uint8_t data_offset[8];
-    uint8_t hdr_data_len_bytes[4]; // FIXME length of hdr or payload??
-    uint8_t send_time_ns[8];// TODO move to front of struct for better alignment
-    uint8_t reserved[12];
-    uint8_t eth_hdr[14];
-    uint8_t ip_hdr[20];
-    uint8_t udp_hdr[8];
-    uint8_t spead_hdr[SPEAD_HDR_LEN];
-    uint8_t unused_pad[2];
-} __attribute__((packed)) ; // note: GCC-specific keyword (avoids padding)
-
-
+#define LFAA_FRAME_NS 2211840 // 2048 samples at 1.08usec
+#define PAGE_BYTES 4096
 
 
 Lfaa_tx_data::Lfaa_tx_data()
     : m_is_hdr_ok(false)
     , m_is_data_ok(false)
+    , m_is_raw(false)
+    , m_is_dedup(false)
+    , m_is_rebased(false)
+    , m_version(Spead_version::AUTO)
+    , m_xform(nullptr)
+    , m_first_send_ns(0)
+    , m_num_pkts(0)
+    , m_hdr(nullptr)
+    , m_hdr_len(0)
+    , m_payload_len(0)
+    , m_payload(nullptr)
 {
 }
 
@@ -35,6 +39,29 @@ Lfaa_tx_data::~Lfaa_tx_data()
 {
 }
 
+// Raw mode must be selected before the header file is loaded
+void Lfaa_tx_data::set_raw_mode(bool is_raw)
+{
+    m_is_raw = is_raw;
+}
+
+bool Lfaa_tx_data::is_raw()
+{
+    return m_is_raw;
+}
+
+// Transforms must be selected before the data file is loaded
+void Lfaa_tx_data::set_transform(Sample_transform * xform)
+{
+    m_xform = xform;
+}
+
+// Deduplication must be selected before the data file is loaded
+void Lfaa_tx_data::set_dedup(bool is_dedup)
+{
+    m_is_dedup = is_dedup;
+}
+
 uint64_t Lfaa_tx_data::big_endian_64bit(uint8_t * ptr)
 {
     uint64_t val = 0;
@@ -54,7 +81,6 @@ uint32_t Lfaa_tx_data::big_endian_32bit(uint8_t * ptr)
 bool Lfaa_tx_data::load_header_file(std::string file)
 {
     m_is_hdr_ok = false;
-    assert(sizeof(Lfaa_hdr_t) == 148); // our type matches Matlab size?
 
     // Read header file into temporary variable
     Bigfile data(file);
@@ -66,21 +92,74 @@ bool Lfaa_tx_data::load_header_file(std::string file)
         return false;
     }
     uint64_t hdr_data_len = data.size();
-    assert( (hdr_data_len % sizeof(Lfaa_hdr_t)) == 0); // no partial headers?
-    m_num_pkts = hdr_data_len / sizeof(Lfaa_hdr_t);
-    std::cout << "Header file contains " << m_num_pkts << " headers" << std::endl;
-    
+
     // Move all the data into this class
-    m_hdr = data.data();
-    Lfaa_hdr_t * hdr_data_ptr = reinterpret_cast<Lfaa_hdr_t *>(m_hdr.get());
+    m_hdr_buf = data.data();
+    return use_headers(m_hdr_buf.get(), hdr_data_len);
+}
+
+// Headers and payload already loaded into a shared memory segment
+bool Lfaa_tx_data::load_shared(Shm_segment & seg)
+{
+    if(m_is_dedup)
+    {
+        std::cout << "Error - shared data can't be deduplicated" << std::endl;
+        return false;
+    }
+    return use_headers(seg.get_hdr(), seg.get_hdr_len())
+        && use_payload(seg.get_payload(), seg.get_payload_len());
+}
+
+// Header format: AUTO (default) detects it from the header file
+void Lfaa_tx_data::set_spead_version(Spead_version version)
+{
+    m_version = version;
+}
+
+// Build the message headers for a header file's contents. The headers are
+// modified in place (checksums, timestamps), so must be writable.
+bool Lfaa_tx_data::use_headers(char * hdr, uint64_t hdr_data_len)
+{
+    m_is_hdr_ok = false;
+    if(m_version == Spead_version::AUTO)
+        m_version = detect_spead_version(hdr, hdr_data_len);
+    switch(m_version)
+    {
+        case Spead_version::V2:
+            return use_headers_t<Spead_v2>(hdr, hdr_data_len);
+        default:
+            return use_headers_t<Spead_v1>(hdr, hdr_data_len);
+    }
+}
+
+template<class L>
+bool Lfaa_tx_data::use_headers_t(char * hdr, uint64_t hdr_data_len)
+{
+    if((hdr_data_len % sizeof(typename L::Record)) != 0)
+    {
+        std::cout << "Error - header file isn't a whole number of "
+            << sizeof(typename L::Record) << " byte SPEAD v"
+            << (std::is_same<L, Spead_v2>::value ? 2 : 1) << " records"
+            << std::endl;
+        return false;
+    }
+    m_num_pkts = hdr_data_len / sizeof(typename L::Record);
+    std::cout << "Header file contains " << m_num_pkts << " SPEAD v"
+        << (std::is_same<L, Spead_v2>::value ? 2 : 1) << " headers"
+        << std::endl;
+    m_hdr = hdr;
+    m_hdr_len = hdr_data_len;
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
 
     // Allocate extra space we'll need to hold the structures used to send data
-    // as UDP packets via sendmsg() call
+    // as UDP packets via sendmmsg() call
     try
     {
-        m_msghdr = std::make_unique<struct msghdr[]>(m_num_pkts);
+        m_mmsg = std::make_unique<struct mmsghdr[]>(m_num_pkts);
+        m_msg_pkt_idx = std::make_unique<uint32_t[]>(m_num_pkts);
+        m_msg_station = std::make_unique<uint16_t[]>(m_num_pkts);
         m_iovec = std::make_unique<struct iovec[]>(m_num_pkts * 2);
-        m_send_dly_us = std::make_unique<uint64_t[]>(m_num_pkts);
     }
     catch (std::bad_alloc &ba)
     {
@@ -89,26 +168,314 @@ bool Lfaa_tx_data::load_header_file(std::string file)
         return false;
     }
     
+    // Work out the order packets will be sent in
+    group_frames<L>();
+
     // Fill in all the message headers as far as the SPEAD headers
-    for(unsigned int idx = 0; idx < m_num_pkts; idx++)
+    for(unsigned int msg = 0; msg < m_num_pkts; msg++)
     {
+        unsigned int idx = m_msg_pkt_idx[msg];
+        struct msghdr * mh = &m_mmsg[msg].msg_hdr;
+        m_msg_station[msg] = spead_station<L>(hdr_data_ptr[idx]);
+
         // Fill in message header with destination and iovec pointer 
-        memset(&m_msghdr[idx], 0, sizeof(struct msghdr));
-        m_msghdr[idx].msg_name = &m_dest;
-        m_msghdr[idx].msg_namelen = sizeof(m_dest);
-        m_msghdr[idx].msg_iov = &m_iovec[2*idx]; 
-        m_msghdr[idx].msg_iovlen = 2; // two iov entries: header + data
+        memset(&m_mmsg[msg], 0, sizeof(struct mmsghdr));
+        mh->msg_name = &m_dest;
+        mh->msg_namelen = sizeof(m_dest);
+        mh->msg_iov = &m_iovec[2*idx]; 
+        mh->msg_iovlen = 2; // two iov entries: header + data
         
         // make first iovec structure point to SPEAD header data
         m_iovec[2*idx].iov_base = hdr_data_ptr[idx].spead_hdr;
         //hdr_data_ptr[idx].spead_hdr[0] = idx % 0x7f; // kb DEBUG TEST COUNTER
-        m_iovec[2*idx].iov_len = SPEAD_HDR_LEN;
+        m_iovec[2*idx].iov_len = L::SPEAD_LEN;
+        if(m_is_raw)
+        {
+            // Whole frame goes out: Ethernet, IP, UDP and SPEAD headers are
+            // contiguous in the model's header record. Raw socket is bound
+            // to the interface so there's no destination address.
+            mh->msg_name = nullptr;
+            mh->msg_namelen = 0;
+            m_iovec[2*idx].iov_base = hdr_data_ptr[idx].eth_hdr;
+            m_iovec[2*idx].iov_len = ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN
+                + L::SPEAD_LEN;
+        }
     }
+    std::cout << "Packets grouped into " << m_frames.size() << " frames"
+        << std::endl;
 
     m_is_hdr_ok = true;
     return true;
 }
 
+// Group packets into frames using the SPEAD packet counter, so that the
+// send order and pacing don't depend on how the model ordered its output.
+// Frames are sent in packet counter order; within a frame the model's order
+// is kept. A frame is due at the earliest send time of its packets.
+// The 32-bit counter can wrap within a file, so counters are ordered by
+// serial number arithmetic relative to the model's first packet.
+template<class L>
+void Lfaa_tx_data::group_frames()
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    std::vector<uint32_t> counter(m_num_pkts);
+    std::vector<int32_t> rel_counter(m_num_pkts);
+    for(uint32_t idx=0; idx<m_num_pkts; idx++)
+    {
+        counter[idx] = spead_counter<L>(hdr_data_ptr[idx]);
+        rel_counter[idx] = static_cast<int32_t>(counter[idx] - counter[0]);
+        m_msg_pkt_idx[idx] = idx;
+    }
+    std::stable_sort(&m_msg_pkt_idx[0], &m_msg_pkt_idx[0] + m_num_pkts
+            , [&rel_counter](uint32_t a, uint32_t b)
+            { return rel_counter[a] < rel_counter[b]; });
+
+    m_frames.clear();
+    uint64_t first_ns = 0;
+    for(uint32_t msg=0; msg<m_num_pkts; msg++)
+    {
+        uint32_t idx = m_msg_pkt_idx[msg];
+        uint64_t send_ns = big_endian_64bit(hdr_data_ptr[idx].send_time_ns);
+        if((msg == 0)
+                || (counter[idx] != counter[m_msg_pkt_idx[msg-1]]))
+        {
+            if(msg == 0)
+                first_ns = send_ns;
+            Lfaa_frame f = {msg, 0, send_ns};
+            m_frames.push_back(f);
+        }
+        Lfaa_frame & f = m_frames.back();
+        f.num_msgs++;
+        if(send_ns < f.time_ns)
+            f.time_ns = send_ns;
+    }
+
+    // Make frame times relative to the first, and never go backwards
+    m_first_send_ns = first_ns;
+    uint64_t prev_ns = 0;
+    for(auto & f: m_frames)
+    {
+        f.time_ns = (f.time_ns > first_ns) ? (f.time_ns - first_ns) : 0;
+        if(f.time_ns < prev_ns)
+            f.time_ns = prev_ns;
+        prev_ns = f.time_ns;
+    }
+}
+
+// Recompute IPv4 header and UDP checksums for a raw frame so that the model's
+// headers go on the wire unchanged apart from the checksum fields
+template<class L>
+void Lfaa_tx_data::fill_checksums(uint32_t idx)
+{
+    typename L::Record * hdr = reinterpret_cast<typename L::Record *>(m_hdr)
+        + idx;
+    fill_record_checksums<L>(*hdr, m_iovec[2*idx+1].iov_base
+            , m_iovec[2*idx+1].iov_len);
+}
+
+// Fast 64-bit hash of a payload block, eight bytes at a time
+static uint64_t hash_block(const uint8_t * p, size_t len)
+{
+    const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = len * mul;
+    size_t i = 0;
+    for(; i+8<=len; i+=8)
+    {
+        uint64_t w;
+        memcpy(&w, p+i, 8);
+        h = (h ^ (w * mul)) * 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+    }
+    for(; i<len; i++)
+        h = (h ^ p[i]) * mul;
+    return h ^ (h >> 29);
+}
+
+// Keep one copy of each distinct payload block, pointing the iovecs of
+// every packet that carries it at the shared copy. The original payload
+// buffer is then released.
+bool Lfaa_tx_data::dedup_payload()
+{
+    struct Block
+    {
+        uint8_t * src;
+        uint32_t len;
+        uint64_t dst_offset;
+    };
+    std::vector<Block> unique;
+    std::unordered_multimap<uint64_t, uint32_t> by_hash;
+    std::vector<uint32_t> pkt_block(m_num_pkts);
+    uint64_t unique_bytes = 0;
+    uint64_t dup_pkts = 0;
+    for(uint32_t idx=0; idx<m_num_pkts; idx++)
+    {
+        struct iovec * iov = &m_iovec[2*idx+1];
+        uint8_t * src = static_cast<uint8_t *>(iov->iov_base);
+        if(iov->iov_base == &m_zero)
+            continue;
+        uint64_t h = hash_block(src, iov->iov_len);
+        uint32_t found = unique.size();
+        auto range = by_hash.equal_range(h);
+        for(auto it = range.first; it != range.second; ++it)
+        {
+            Block & b = unique[it->second];
+            if((b.len == iov->iov_len)
+                    && ((b.src == src) || (memcmp(b.src, src, b.len) == 0)))
+            {
+                found = it->second;
+                break;
+            }
+        }
+        if(found == unique.size())
+        {
+            Block b = {src, static_cast<uint32_t>(iov->iov_len), unique_bytes};
+            unique.push_back(b);
+            by_hash.emplace(h, found);
+            unique_bytes += b.len;
+        }
+        else
+        {
+            ++dup_pkts;
+        }
+        pkt_block[idx] = found;
+    }
+
+    std::unique_ptr<char[]> compact;
+    try
+    {
+        compact = std::make_unique<char[]>(unique_bytes);
+    }
+    catch (std::bad_alloc &ba)
+    {
+        std::cerr << "Couldn't allocate RAM for unique payloads: " << ba.what()
+            << std::endl;
+        return false;
+    }
+    for(auto & b: unique)
+        memcpy(&compact[b.dst_offset], b.src, b.len);
+    for(uint32_t idx=0; idx<m_num_pkts; idx++)
+    {
+        if(m_iovec[2*idx+1].iov_base == &m_zero)
+            continue;
+        m_iovec[2*idx+1].iov_base = &compact[unique[pkt_block[idx]].dst_offset];
+    }
+
+    std::cout << "Deduplicated payload: " << unique.size()
+        << " unique blocks (" << dup_pkts << " duplicate packets), "
+        << m_payload_len << " -> " << unique_bytes << " bytes" << std::endl;
+    m_payload_buf = std::move(compact);
+    m_payload = m_payload_buf.get();
+    m_xform_buf.reset();
+    m_payload_len = unique_bytes;
+    return true;
+}
+
+// Apply each station's gain, phase and delay. A station's packets form one
+// stream per logical channel; delays move samples along the stream, wrapping
+// round at the end of the capture so repeats stay continuous. Transformed
+// payloads go to a new buffer, as the original may be shared.
+template<class L>
+bool Lfaa_tx_data::transform_payload()
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    // Messages of each transformed stream, in send order
+    std::map<uint32_t, std::vector<uint32_t>> streams;
+    uint64_t out_bytes = 0;
+    for(uint32_t msg=0; msg<m_num_pkts; msg++)
+    {
+        uint32_t idx = m_msg_pkt_idx[msg];
+        uint32_t station = spead_station<L>(hdr_data_ptr[idx]);
+        if(m_xform->find(station) == nullptr)
+            continue;
+        uint32_t chan = spead_channel<L>(hdr_data_ptr[idx]);
+        streams[(station << 16) | chan].push_back(msg);
+        out_bytes += m_iovec[2*idx+1].iov_len;
+    }
+
+    try
+    {
+        m_xform_buf = std::make_unique<char[]>(out_bytes);
+    }
+    catch (std::bad_alloc &ba)
+    {
+        std::cerr << "Couldn't allocate RAM for transformed payloads: "
+            << ba.what() << std::endl;
+        return false;
+    }
+
+    uint64_t out_offset = 0;
+    std::vector<int8_t> scratch;
+    for(auto & s: streams)
+    {
+        const Station_xform * xf = m_xform->find(s.first >> 16);
+        std::vector<uint32_t> & msgs = s.second;
+        uint32_t len = m_iovec[2*m_msg_pkt_idx[msgs[0]]+1].iov_len;
+        for(uint32_t msg: msgs)
+        {
+            if((m_iovec[2*m_msg_pkt_idx[msg]+1].iov_len != len)
+                    || ((len % CINT8_SAMPLE_BYTES) != 0))
+            {
+                std::cerr << "Error - can't transform station " << (s.first>>16)
+                    << " channel " << (s.first & 0xffff)
+                    << ": packets aren't all whole samples of the same length"
+                    << std::endl;
+                return false;
+            }
+        }
+        uint64_t pkt_samples = len / CINT8_SAMPLE_BYTES;
+        uint64_t total_samples = pkt_samples * msgs.size();
+        if(total_samples == 0)
+            continue;
+        // Output sample n comes from input sample n - delay
+        int64_t delay = xf->delay % static_cast<int64_t>(total_samples);
+        uint64_t lag = (delay < 0) ? (total_samples + delay) : delay;
+        scratch.resize(len);
+        for(uint64_t pkt=0; pkt<msgs.size(); pkt++)
+        {
+            // Gather this packet's delayed samples, wrapping at the end
+            uint64_t src = (pkt * pkt_samples + total_samples - lag)
+                % total_samples;
+            uint64_t done = 0;
+            while(done < pkt_samples)
+            {
+                uint64_t src_pkt = src / pkt_samples;
+                uint64_t src_off = src % pkt_samples;
+                uint64_t n = pkt_samples - src_off;
+                if(n > pkt_samples - done)
+                    n = pkt_samples - done;
+                const char * from = static_cast<const char *>(
+                        m_iovec[2*m_msg_pkt_idx[msgs[src_pkt]]+1].iov_base);
+                memcpy(&scratch[done * CINT8_SAMPLE_BYTES]
+                        , from + src_off * CINT8_SAMPLE_BYTES
+                        , n * CINT8_SAMPLE_BYTES);
+                done += n;
+                src = (src + n) % total_samples;
+            }
+            int8_t * dst = reinterpret_cast<int8_t *>(&m_xform_buf[out_offset]);
+            cint8_rotate(dst, scratch.data(), len, xf->weight);
+            out_offset += len;
+        }
+    }
+
+    // Only now point the iovecs at the results: all the gathering above
+    // reads the original payloads
+    out_offset = 0;
+    for(auto & s: streams)
+    {
+        for(uint32_t msg: s.second)
+        {
+            struct iovec * iov = &m_iovec[2*m_msg_pkt_idx[msg]+1];
+            iov->iov_base = &m_xform_buf[out_offset];
+            out_offset += iov->iov_len;
+        }
+    }
+    std::cout << "Transformed " << streams.size() << " station channels ("
+        << out_bytes << " bytes)" << std::endl;
+    return true;
+}
+
 struct channel_list
 {
     uint32_t station;
@@ -152,40 +519,45 @@ bool Lfaa_tx_data::load_data_file(std::string file)
             << file << "'" << std::endl;
         return false;
     }
-    m_payload_len = data.size();
-    m_payload = data.data();
+    uint64_t payload_len = data.size();
+    m_payload_buf = data.data();
+    return use_payload(m_payload_buf.get(), payload_len);
+}
 
-    Lfaa_hdr_t * hdr_data_ptr = reinterpret_cast<Lfaa_hdr_t *>(m_hdr.get());
-    uint64_t last_send_ns = 0;
-    std::list<channel_list> in_use;
-    for(unsigned int idx=0; idx<m_num_pkts; idx++)
+// Point each message's second iovec at its packet's payload
+bool Lfaa_tx_data::use_payload(char * payload, uint64_t payload_len)
+{
+    m_is_data_ok = false;
+    m_payload = payload;
+    m_payload_len = payload_len;
+    switch(m_version)
     {
-        // for each station, create a list of channels it is sending
-        uint32_t stationID = hdr_data_ptr[idx].spead_hdr[104-43];
-        stationID += (hdr_data_ptr[idx].spead_hdr[103-43] << 8);
-        uint32_t logicalChan = hdr_data_ptr[idx].spead_hdr[11];
-        logicalChan += (hdr_data_ptr[idx].spead_hdr[10] << 8);
-        add_freq_channel(&in_use, stationID, logicalChan);
-#if 0
-        // debug
-        {
-            uint32_t substationID = hdr_data_ptr[idx].spead_hdr[101-43];
-            uint32_t subarrayIdx = hdr_data_ptr[idx].spead_hdr[102-43];
-
-            std::cout << big_endian_64bit(hdr_data_ptr[idx].send_time_ns)
-            << "," << stationID
-            << "," << substationID
-            << "," << subarrayIdx
-            << "," << logicalChan
-            << std::endl;
-        }
-#endif
+        case Spead_version::V2:
+            return use_payload_t<Spead_v2>();
+        default:
+            return use_payload_t<Spead_v1>();
+    }
+}
 
+template<class L>
+bool Lfaa_tx_data::use_payload_t()
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    for(unsigned int idx=0; idx<m_num_pkts; idx++)
+    {
         //Fill in second iovec entry
         uint64_t offset = big_endian_64bit(hdr_data_ptr[idx].data_offset);
         uint32_t len = big_endian_32bit(hdr_data_ptr[idx].hdr_data_len_bytes);
         if(offset == 0xffffffffffffffff)
         {
+            if(len > ZERO_PAYLOAD_BYTES)
+            {
+                std::cerr << "Error in header info" << std::endl;
+                std::cerr << "hdr[" << idx << "] zero payload len=" << len
+                    << " (max " << ZERO_PAYLOAD_BYTES << ")" << std::endl;
+                return false;
+            }
             m_iovec[2*idx+1].iov_base = &m_zero;
         }
         else
@@ -202,31 +574,84 @@ bool Lfaa_tx_data::load_data_file(std::string file)
             m_iovec[2*idx+1].iov_base = &m_payload[offset];
         }
         m_iovec[2*idx+1].iov_len = len;
+    }
 
-        // Fill in delta send time
-        if(idx == 0)
-        {
-            m_send_dly_us[idx] = 0;
-            last_send_ns = big_endian_64bit(hdr_data_ptr[idx].send_time_ns);
-        }
-        else
+    if((m_xform != nullptr) && !transform_payload<L>())
+        return false;
+
+    // Raw frames: check lengths and fill in checksums over the final payload
+    for(unsigned int idx=0; m_is_raw && (idx<m_num_pkts); idx++)
+    {
+        uint32_t len = m_iovec[2*idx+1].iov_len;
+        uint32_t udp_len = (hdr_data_ptr[idx].udp_hdr[4] << 8)
+            | hdr_data_ptr[idx].udp_hdr[5];
+        if(udp_len != (UDP_HDR_LEN + L::SPEAD_LEN + len))
         {
-            uint64_t send_dly_ns =
-                big_endian_64bit(hdr_data_ptr[idx].send_time_ns) - last_send_ns;
-            uint64_t send_dly_us = send_dly_ns / 1000;
-            m_send_dly_us[idx] = send_dly_us;
-            last_send_ns += (send_dly_us * 1000);
+            std::cerr << "Error in header info" << std::endl;
+            std::cerr << "hdr[" << idx << "] UDP length=" << udp_len
+                << " but frame carries "
+                << (UDP_HDR_LEN + L::SPEAD_LEN + len) << std::endl;
+            return false;
         }
+        fill_checksums<L>(idx);
     }
     std::cout << "Message headers and iovecs created" << std::endl;
 
+    if(m_is_dedup && !dedup_payload())
+        return false;
+
     m_is_data_ok = true;
+    uint32_t num_stations = index_channels();
+    std::cout << "Total of " << m_num_freq_chans
+        << " coarse channels for " << num_stations << " stations" << std::endl;
+    return true;
+}
+
+// Count the coarse channels being sent by each station. Sets the total number
+// of channels, and returns the number of stations.
+uint32_t Lfaa_tx_data::index_channels()
+{
+    switch(m_version)
+    {
+        case Spead_version::V2:
+            return index_channels_t<Spead_v2>();
+        default:
+            return index_channels_t<Spead_v1>();
+    }
+}
+
+template<class L>
+uint32_t Lfaa_tx_data::index_channels_t()
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    std::list<channel_list> in_use;
+    for(unsigned int idx=0; idx<m_num_pkts; idx++)
+    {
+        // for each station, create a list of channels it is sending
+        uint32_t stationID = spead_station<L>(hdr_data_ptr[idx]);
+        uint32_t logicalChan = spead_channel<L>(hdr_data_ptr[idx]);
+        add_freq_channel(&in_use, stationID, logicalChan);
+#if 0
+        // debug
+        {
+            uint32_t substationID = hdr_data_ptr[idx].spead_hdr[L::STATION-2];
+            uint32_t subarrayIdx = hdr_data_ptr[idx].spead_hdr[L::STATION-1];
+
+            std::cout << big_endian_64bit(hdr_data_ptr[idx].send_time_ns)
+            << "," << stationID
+            << "," << substationID
+            << "," << subarrayIdx
+            << "," << logicalChan
+            << std::endl;
+        }
+#endif
+    }
+
     m_num_freq_chans = 0;
     for(auto ch: in_use)
         m_num_freq_chans += ch.freq_chans.size();
-    std::cout << "Total of " << m_num_freq_chans
-        << " coarse channels for " << in_use.size() << " stations" << std::endl;
-    return true;
+    return in_use.size();
 }
 
 uint32_t Lfaa_tx_data::get_num_pkts()
@@ -235,14 +660,76 @@ uint32_t Lfaa_tx_data::get_num_pkts()
 }
 
 
-struct msghdr * Lfaa_tx_data::get_msg_ptr()
+struct mmsghdr * Lfaa_tx_data::get_mmsg_ptr()
+{
+    return m_mmsg.get();
+}
+
+uint16_t Lfaa_tx_data::get_msg_station(uint32_t msg)
 {
-    return m_msghdr.get();
+    return m_msg_station[msg];
 }
 
-uint64_t * Lfaa_tx_data::get_send_dly_us()
+// Share the messages out between 'n_lanes' senders, either keeping each
+// station's packets together (stations dealt out in ID order) or dealing
+// packets out in turn. Returns the lane of each message.
+std::vector<uint32_t> Lfaa_tx_data::assign_lanes(uint32_t n_lanes
+        , bool is_by_station)
 {
-    return m_send_dly_us.get();
+    std::vector<uint32_t> lane(m_num_pkts);
+    if(!is_by_station)
+    {
+        for(uint32_t msg=0; msg<m_num_pkts; msg++)
+            lane[msg] = msg % n_lanes;
+        return lane;
+    }
+    std::map<uint16_t, uint32_t> station_lane;
+    for(uint32_t msg=0; msg<m_num_pkts; msg++)
+        station_lane[get_msg_station(msg)] = 0;
+    uint32_t next = 0;
+    for(auto & sl: station_lane)
+        sl.second = next++ % n_lanes;
+    for(uint32_t msg=0; msg<m_num_pkts; msg++)
+        lane[msg] = station_lane[get_msg_station(msg)];
+    return lane;
+}
+
+// Model's send time for a message, relative to the first frame
+uint64_t Lfaa_tx_data::get_msg_send_ns(uint32_t msg)
+{
+    switch(m_version)
+    {
+        case Spead_version::V2:
+            return get_msg_send_ns_t<Spead_v2>(msg);
+        default:
+            return get_msg_send_ns_t<Spead_v1>(msg);
+    }
+}
+
+template<class L>
+uint64_t Lfaa_tx_data::get_msg_send_ns_t(uint32_t msg)
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    uint64_t send_ns = big_endian_64bit(
+            hdr_data_ptr[m_msg_pkt_idx[msg]].send_time_ns);
+    return (send_ns > m_first_send_ns) ? (send_ns - m_first_send_ns) : 0;
+}
+
+const std::vector<Lfaa_frame> & Lfaa_tx_data::get_frames()
+{
+    return m_frames;
+}
+
+// Time between the start of successive frames, averaged over the capture
+uint64_t Lfaa_tx_data::get_frame_period_ns()
+{
+    if(m_frames.size() < 2)
+        return LFAA_FRAME_NS;
+    uint64_t span = m_frames.back().time_ns - m_frames.front().time_ns;
+    if(span == 0)
+        return 0; // all packets due at once: send as fast as possible
+    return span / (m_frames.size() - 1);
 }
 
 bool Lfaa_tx_data::set_dest(char * destination, uint16_t port)
@@ -263,6 +750,122 @@ bool Lfaa_tx_data::set_dest(char * destination, uint16_t port)
     return true;
 }
 
+// Touch every page of the packet data so nothing page faults once sending
+// has started
+void Lfaa_tx_data::prefault()
+{
+    volatile char sink = 0;
+    char * hdr = m_hdr;
+    for(uint64_t i=0; i<m_hdr_len; i+=PAGE_BYTES)
+        sink = sink + hdr[i];
+    for(uint64_t i=0; i<m_payload_len; i+=PAGE_BYTES)
+        sink = sink + m_payload[i];
+    for(uint32_t msg=0; msg<m_num_pkts; msg++)
+        sink = sink + m_mmsg[msg].msg_len;
+}
+
+// Overwrite the 48-bit value of the SPEAD item at 'item_offset' in a packet's
+// header, keeping the UDP checksum of raw frames correct
+template<class L>
+void Lfaa_tx_data::write_spead_item(uint32_t idx, uint32_t item_offset
+        , uint64_t value)
+{
+    typename L::Record * hdr = reinterpret_cast<typename L::Record *>(m_hdr)
+        + idx;
+    uint8_t * item = &hdr->spead_hdr[item_offset];
+    uint8_t old_item[8];
+    memcpy(old_item, item, 8);
+    for(int i=7; i>=2; i--)
+    {
+        item[i] = value & 0xff;
+        value >>= 8;
+    }
+    if(m_is_raw)
+    {
+        uint16_t csum;
+        memcpy(&csum, &hdr->udp_hdr[6], 2);
+        csum = csum_update(csum, old_item, item, 8);
+        if(csum == 0)
+            csum = 0xffff;
+        memcpy(&hdr->udp_hdr[6], &csum, 2);
+    }
+}
+
+// Make the SPEAD sync time and timestamps describe the real time packets are
+// sent: sync time becomes 'sync_sec', and the first frame's timestamp becomes
+// 'offset_ns' with later ones keeping their spacing from the model.
+void Lfaa_tx_data::rebase_timestamps(uint64_t sync_sec, uint64_t offset_ns)
+{
+    if(m_num_pkts == 0)
+        return;
+    switch(m_version)
+    {
+        case Spead_version::V2:
+            rebase_timestamps_t<Spead_v2>(sync_sec, offset_ns);
+            break;
+        default:
+            rebase_timestamps_t<Spead_v1>(sync_sec, offset_ns);
+            break;
+    }
+    m_is_rebased = true;
+}
+
+template<class L>
+void Lfaa_tx_data::rebase_timestamps_t(uint64_t sync_sec, uint64_t offset_ns)
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    uint64_t first_ts = big_endian_64bit(
+            &hdr_data_ptr[m_msg_pkt_idx[0]].spead_hdr[L::TIMESTAMP])
+        & SPEAD_ITEM_VALUE_MASK;
+    for(uint32_t idx=0; idx<m_num_pkts; idx++)
+    {
+        uint64_t ts = big_endian_64bit(
+                &hdr_data_ptr[idx].spead_hdr[L::TIMESTAMP])
+            & SPEAD_ITEM_VALUE_MASK;
+        write_spead_item<L>(idx, L::SYNC_TIME, sync_sec);
+        write_spead_item<L>(idx, L::TIMESTAMP
+                , (ts - first_ts + offset_ns) & SPEAD_ITEM_VALUE_MASK);
+    }
+}
+
+bool Lfaa_tx_data::is_rebased()
+{
+    return m_is_rebased;
+}
+
+// Move the SPEAD timestamps of a range of messages forward, as the capture
+// is repeated
+void Lfaa_tx_data::advance_timestamps(uint32_t first_msg, uint32_t num_msgs
+        , uint64_t delta_ns)
+{
+    switch(m_version)
+    {
+        case Spead_version::V2:
+            advance_timestamps_t<Spead_v2>(first_msg, num_msgs, delta_ns);
+            break;
+        default:
+            advance_timestamps_t<Spead_v1>(first_msg, num_msgs, delta_ns);
+            break;
+    }
+}
+
+template<class L>
+void Lfaa_tx_data::advance_timestamps_t(uint32_t first_msg, uint32_t num_msgs
+        , uint64_t delta_ns)
+{
+    typename L::Record * hdr_data_ptr
+        = reinterpret_cast<typename L::Record *>(m_hdr);
+    for(uint32_t msg=first_msg; msg<(first_msg+num_msgs); msg++)
+    {
+        uint32_t idx = m_msg_pkt_idx[msg];
+        uint64_t ts = big_endian_64bit(
+                &hdr_data_ptr[idx].spead_hdr[L::TIMESTAMP]);
+        write_spead_item<L>(idx, L::TIMESTAMP
+                , (ts + delta_ns) & SPEAD_ITEM_VALUE_MASK);
+    }
+}
+
 uint32_t Lfaa_tx_data::get_num_freq_chans()
 {
     return m_num_freq_chans;
@@ -1,5 +1,8 @@
 /* This class allocates and holds memory for all the LFAA simulation packets.
  * It also creates msghdrs so that the data is easily sent via sendmsg().
+ * Packets are grouped into frames (by SPEAD packet counter) and the msghdrs
+ * are ordered frame by frame so each frame can go out with one sendmmsg().
+ * Header records may be in any of the SPEAD formats in spead_layout.h.
  *
  * Keith Bengston. CSIRO. 21 January 2018.
  */
@@ -14,44 +17,111 @@
 #include <arpa/inet.h>  // for sockaddr_in
 #include <memory>       // for unique_ptr
 #include <list>
+#include <vector>
+#include "spead_layout.h"
+
+#define ZERO_PAYLOAD_BYTES 8192 // longest all-zero payload (no data offset)
 
 struct channel_list;
+class Shm_segment;
+class Sample_transform;
+
+// Packets sharing one SPEAD packet counter value: a 2.21184msec LFAA frame
+struct Lfaa_frame
+{
+    uint32_t first_msg; // index of the frame's first message
+    uint32_t num_msgs;
+    uint64_t time_ns;   // send time, relative to the first frame
+};
 
 class Lfaa_tx_data
 {
     private:
         bool m_is_hdr_ok;
         bool m_is_data_ok;
+        // Send complete model-generated Ethernet frames (raw socket)
+        bool m_is_raw;
+        // Store identical payload blocks only once
+        bool m_is_dedup;
+        // SPEAD timestamps have been rebased to the real start time
+        bool m_is_rebased;
+        Spead_version m_version;
+        // Per-station gain/phase/delay applied to payloads (optional)
+        Sample_transform * m_xform;
         struct sockaddr_in m_dest;
-        // Array of message headers - one entry per message
-        std::unique_ptr<struct msghdr[]> m_msghdr;
+        // Array of message headers - one entry per message, in frame order
+        std::unique_ptr<struct mmsghdr[]> m_mmsg;
+        // Header file index of the packet in each message
+        std::unique_ptr<uint32_t[]> m_msg_pkt_idx;
+        // Station of each message, so senders needn't decode the header
+        std::unique_ptr<uint16_t[]> m_msg_station;
+        std::vector<Lfaa_frame> m_frames;
+        uint64_t m_first_send_ns;
         // Array of iovec structures - two entries used per message
         std::unique_ptr<struct iovec[]> m_iovec;
         // SPEAD part of payload for each packet
         uint32_t m_num_pkts;
-        std::unique_ptr<char[]>m_hdr;
+        std::unique_ptr<char[]>m_hdr_buf; // nullptr if shared
+        char * m_hdr;
+        uint64_t m_hdr_len;
         // data part of payload for each packet
         uint64_t m_payload_len;
-        char m_zero[8192] = {0};
-        std::unique_ptr<char[]>m_payload;
-        std::unique_ptr<uint64_t[]> m_send_dly_us;
+        char m_zero[ZERO_PAYLOAD_BYTES] = {0};
+        std::unique_ptr<char[]>m_payload_buf; // nullptr if shared
+        char * m_payload;
+        std::unique_ptr<char[]>m_xform_buf; // transformed payloads
         uint32_t m_num_freq_chans = {16};
 
         static uint64_t big_endian_64bit(uint8_t * ptr);
         static uint32_t big_endian_32bit(uint8_t * ptr);
         void add_freq_channel( std::list<channel_list> *cl
                 , uint32_t station, uint32_t chan);
+        bool use_headers(char * hdr, uint64_t hdr_data_len);
+        bool use_payload(char * payload, uint64_t payload_len);
+        bool dedup_payload();
+        // Versions of the above for each header layout
+        template<class L> bool use_headers_t(char * hdr
+                , uint64_t hdr_data_len);
+        template<class L> bool use_payload_t();
+        template<class L> void fill_checksums(uint32_t idx);
+        template<class L> void group_frames();
+        template<class L> bool transform_payload();
+        template<class L> uint32_t index_channels_t();
+        template<class L> void write_spead_item(uint32_t idx
+                , uint32_t item_offset, uint64_t value);
+        template<class L> void rebase_timestamps_t(uint64_t sync_sec
+                , uint64_t offset_ns);
+        template<class L> void advance_timestamps_t(uint32_t first_msg
+                , uint32_t num_msgs, uint64_t delta_ns);
+        template<class L> uint64_t get_msg_send_ns_t(uint32_t msg);
 
     public:
         Lfaa_tx_data();
         ~Lfaa_tx_data();
+        void set_raw_mode(bool is_raw);
+        void set_spead_version(Spead_version version);
+        bool is_raw();
+        void set_dedup(bool is_dedup);
+        void set_transform(Sample_transform * xform);
         bool load_header_file(std::string file);
         bool load_data_file(std::string file);
+        bool load_shared(Shm_segment & seg);
         uint32_t get_num_pkts();
-        struct msghdr * get_msg_ptr();
-        uint64_t * get_send_dly_us();
+        struct mmsghdr * get_mmsg_ptr();
+        uint16_t get_msg_station(uint32_t msg);
+        std::vector<uint32_t> assign_lanes(uint32_t n_lanes
+                , bool is_by_station);
+        uint64_t get_msg_send_ns(uint32_t msg);
+        const std::vector<Lfaa_frame> & get_frames();
+        uint64_t get_frame_period_ns();
         bool set_dest(char * destination, uint16_t port);
         uint32_t get_num_freq_chans();
+        uint32_t index_channels();
+        void prefault();
+        void rebase_timestamps(uint64_t sync_sec, uint64_t offset_ns);
+        bool is_rebased();
+        void advance_timestamps(uint32_t first_msg, uint32_t num_msgs
+                , uint64_t delta_ns);
 };
 
 #endif
@@ -12,20 +12,233 @@
 
 #include <iostream> // cout, cin, cerr
 #include <unistd.h> // getopt
-#include <stdlib.h> // for atoi
+#include <getopt.h> // getopt_long
+#include <time.h> // for clock_gettime
+#include <stdlib.h> // for atoi atof
 #include <cstring>
 #include <string>
-#include <sys/select.h>
-#include <time.h>
-#include <errno.h>
+#include <vector>
+#include <memory> // for unique_ptr
+#include <thread>
+#include <sched.h> // for sched_getaffinity
+#include <pthread.h> // for pthread_setaffinity_np
 #include "lfaa_tx_data.h"
-#include <time.h> // for clock_gettime
+#include "tx_socket.h"
+#include "lfaa_sender.h"
+#include "tx_timestamps.h"
+#include "sender_control.h"
+#include "control_server.h"
+#include "shm_segment.h"
+#include "sample_transform.h"
+#include "stream_source.h"
+#include "capture_check.h"
+#include "bigfile.h"
+
+#define LANE_START_LEAD_NS 20000000 // time for sender threads to get going
+
+// Long-only command line options
+enum Long_opt {OPT_START_AT = 256, OPT_CLOCK, OPT_REBASE, OPT_TX_TIMESTAMPS
+    , OPT_CONTROL, OPT_SHM, OPT_TRANSFORM, OPT_SPEAD_VERSION, OPT_STREAM
+    , OPT_INTERFACES, OPT_SPREAD, OPT_CPUS, OPT_PREFLIGHT, OPT_LINE_RATE};
+static const struct option long_opts[] = {
+    {"start-at", required_argument, nullptr, OPT_START_AT},
+    {"clock", required_argument, nullptr, OPT_CLOCK},
+    {"rebase-timestamps", no_argument, nullptr, OPT_REBASE},
+    {"tx-timestamps", no_argument, nullptr, OPT_TX_TIMESTAMPS},
+    {"control", required_argument, nullptr, OPT_CONTROL},
+    {"shm", required_argument, nullptr, OPT_SHM},
+    {"transform", required_argument, nullptr, OPT_TRANSFORM},
+    {"spead-version", required_argument, nullptr, OPT_SPEAD_VERSION},
+    {"stream", required_argument, nullptr, OPT_STREAM},
+    {"interfaces", required_argument, nullptr, OPT_INTERFACES},
+    {"spread", required_argument, nullptr, OPT_SPREAD},
+    {"cpus", required_argument, nullptr, OPT_CPUS},
+    {"preflight", no_argument, nullptr, OPT_PREFLIGHT},
+    {"line-rate", required_argument, nullptr, OPT_LINE_RATE},
+    {nullptr, 0, nullptr, 0}
+};
+
+// Parse a start time given as "seconds[.fraction]" since the epoch of
+// 'clock', or "+seconds[.fraction]" from now
+static bool parse_start_time(std::string text, clockid_t clock
+        , uint64_t & start_ns)
+{
+    bool is_relative = (text.size() > 0) && (text[0] == '+');
+    if(is_relative)
+        text = text.substr(1);
+    size_t dot = text.find('.');
+    std::string sec_text = text.substr(0, dot);
+    std::string frac_text = (dot == std::string::npos) ? "" : text.substr(dot+1);
+    if((sec_text.size() == 0) || (frac_text.size() > 9)
+            || (sec_text.find_first_not_of("0123456789") != std::string::npos)
+            || (frac_text.find_first_not_of("0123456789") != std::string::npos))
+        return false;
+    frac_text.resize(9, '0');
+    start_ns = strtoull(sec_text.c_str(), nullptr, 10) * 1000000000ULL
+        + strtoull(frac_text.c_str(), nullptr, 10);
+    if(is_relative)
+    {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        start_ns += ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    return true;
+}
+
+// Split a comma separated list, eg of interface names
+static std::vector<std::string> split_list(std::string text)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t comma = text.find(',', start);
+        if(comma == std::string::npos)
+            comma = text.size();
+        if(comma > start)
+            items.push_back(text.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+// Sender threads go on separate CPUs: the ones given, otherwise the last
+// of those this process may use (leaving the first for the system)
+static bool choose_cpus(std::string text, size_t n, std::vector<int> & cpus)
+{
+    for(auto & item: split_list(text))
+    {
+        if(item.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        cpus.push_back(atoi(item.c_str()));
+    }
+    if(cpus.size() != 0)
+        return (cpus.size() >= n);
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return true; // don't pin
+    for(int cpu=CPU_SETSIZE-1; (cpu>=0) && (cpus.size()<n); cpu--)
+    {
+        if(CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
+    }
+    if(cpus.size() < n)
+        cpus.clear(); // fewer CPUs than threads, let the kernel place them
+    return true;
+}
+
+static void pin_to_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rv != 0)
+        std::cout << "WARNING: can't run on CPU " << cpu << ": "
+            << strerror(rv) << std::endl;
+}
+
+// Throughput of each interface, to show how evenly the load was spread
+static void report_lanes(std::vector<std::unique_ptr<Tx_socket>> & socks
+        , std::vector<std::unique_ptr<Lfaa_sender>> & senders
+        , std::vector<int> & cpus)
+{
+    uint64_t min_bytes = 0;
+    uint64_t max_bytes = 0;
+    std::cout << "Per interface:" << std::endl;
+    for(size_t lane=0; lane<senders.size(); lane++)
+    {
+        Lfaa_sender & s = *senders[lane];
+        uint64_t bytes = s.get_bytes_sent();
+        if((lane == 0) || (bytes < min_bytes))
+            min_bytes = bytes;
+        if(bytes > max_bytes)
+            max_bytes = bytes;
+        std::cout << "  " << socks[lane]->get_ifname();
+        if(cpus.size() != 0)
+            std::cout << " (CPU " << cpus[lane] << ")";
+        std::cout << ": " << s.get_pkts_sent() << " packets, " << bytes
+            << " bytes";
+        if(s.get_elapsed_ns() != 0)
+            std::cout << ", " << (bytes * 8000.0 / s.get_elapsed_ns())
+                << " Mbps";
+        if(s.get_pkts_dropped() != 0)
+            std::cout << ", " << s.get_pkts_dropped() << " dropped";
+        if(s.get_num_paced() != 0)
+            std::cout << ", late " << s.get_late_mean_ns()/1000
+                << " usec average (max " << s.get_late_max_ns()/1000 << ")";
+        std::cout << std::endl;
+    }
+    if(max_bytes != 0)
+        std::cout << "Least loaded interface sent "
+            << (100.0 * min_bytes / max_bytes) << "% of the bytes of the"
+            << " most loaded" << std::endl;
+}
+
+// Check the capture and report on it, without sending anything
+static int preflight(std::string hdr_file_name, std::string data_file_name
+        , Spead_version version, bool is_raw, double speed, double line_gbps)
+{
+    Bigfile hdr(hdr_file_name);
+    Bigfile data(data_file_name);
+    if(!hdr.read() || !data.read_size())
+        return -1;
+    Capture_check check;
+    check.set_speed(speed);
+    check.set_line_rate(line_gbps);
+    check.set_raw_mode(is_raw);
+    if(!check.scan(hdr.get(), hdr.size(), data.size(), version))
+        return -1;
+    check.report();
+    return (check.get_num_errors() == 0) ? 0 : -1;
+}
 
 void usage(char * progname)
 {
     std::cout << "USAGE: " << progname << " -h header_file -d data_file"
         << " -a my.ip.dest.addr -p dest_port -r repeats -z fixed_no_of_pkts"
+        << " -s speed -u" << std::endl;
+    std::cout << "   or: " << progname << " -h header_file -d data_file"
+        << " -e interface -r repeats -z fixed_no_of_pkts -s speed -u"
+        << std::endl;
+    std::cout << "  -e sends complete model-generated Ethernet frames on a"
+        << " raw socket" << std::endl;
+    std::cout << "     (-e if1,if2,... spreads them over several interfaces)"
+        << std::endl;
+    std::cout << "  -u stores identical packet payloads only once" << std::endl;
+    std::cout << "  -s replays faster (>1) or slower (<1) than the model's"
+        << " frame timing, 0.1 to 10" << std::endl;
+    std::cout << "  --start-at sec[.frac] starts sending at an absolute time"
+        << " (or +sec[.frac] from now)" << std::endl;
+    std::cout << "  --clock realtime|tai selects the clock for --start-at"
+        << " (default realtime)" << std::endl;
+    std::cout << "  --rebase-timestamps sets SPEAD sync time/timestamps from"
+        << " the start time" << std::endl;
+    std::cout << "  --tx-timestamps reports when packets left compared to"
+        << " their schedule" << std::endl;
+    std::cout << "  --control path accepts pause/resume/rate/stations/burst/stats"
+        << " commands on a Unix socket" << std::endl;
+    std::cout << "  --shm name|path shares one copy of the model data between"
+        << " processes on this host" << std::endl;
+    std::cout << "  --transform file applies per-station gain, phase and delay"
+        << " to the sample data" << std::endl;
+    std::cout << "  --spead-version 1|2|auto sets the header file's SPEAD"
+        << " format (default auto)" << std::endl;
+    std::cout << "  --stream -|path|unix:path sends header records, each"
+        << " followed by its payload," << std::endl;
+    std::cout << "      as they arrive on stdin, a FIFO or a Unix socket"
+        << " (instead of -h and -d)" << std::endl;
+    std::cout << "  --interfaces if1,if2,... spreads UDP packets over"
+        << " several interfaces" << std::endl;
+    std::cout << "  --spread station|packet shares packets between interfaces"
+        << " by station (default)" << std::endl;
+    std::cout << "      or packet by packet" << std::endl;
+    std::cout << "  --cpus n,n,... CPUs for each interface's sender thread"
         << std::endl;
+    std::cout << "  --preflight checks the capture and reports on it without"
+        << " sending (needs -h and -d)" << std::endl;
+    std::cout << "  --line-rate gbps is the link rate --preflight checks"
+        << " frames against (default 40)" << std::endl;
 }
 
 int main( int argc, char* argv[])
@@ -38,13 +251,31 @@ int main( int argc, char* argv[])
     uint16_t port = 0;
     uint32_t repeats=0;
     uint32_t fixed_pkts = 0;
+    std::string raw_if_name;
+    double speed = 1.0;
+    bool is_dedup = false;
+    std::string start_at_text;
+    clockid_t start_clock = CLOCK_REALTIME;
+    bool is_rebase = false;
+    bool is_tx_timestamps = false;
+    std::string control_path;
+    std::string shm_name;
+    std::string transform_file;
+    Spead_version spead_version = Spead_version::AUTO;
+    std::string stream_spec;
+    std::string udp_if_list;
+    bool is_spread_by_station = true;
+    std::string cpu_list;
+    bool is_preflight = false;
+    double line_gbps = 40.0;
     if(argc < 2)
     {
         std::cout << "No program arguments provided\n" << std::endl;
         usage(argv[0]);
         return 0;
     }
-    while((ret = getopt(argc, argv, "z:d:h:a:p:r:?")) != -1)
+    while((ret = getopt_long(argc, argv, "z:d:h:a:p:r:e:s:u?", long_opts
+                    , nullptr)) != -1)
     {
         switch(ret)
         {
@@ -66,6 +297,92 @@ int main( int argc, char* argv[])
             case 'z':
                 fixed_pkts = atoi(optarg);
                 break;
+            case 'e':
+                raw_if_name = std::string(optarg);
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'u':
+                is_dedup = true;
+                break;
+            case OPT_START_AT:
+                start_at_text = std::string(optarg);
+                break;
+            case OPT_CLOCK:
+                if(strcmp(optarg, "tai") == 0)
+                    start_clock = CLOCK_TAI;
+                else if(strcmp(optarg, "realtime") == 0)
+                    start_clock = CLOCK_REALTIME;
+                else
+                {
+                    std::cout << "Error - unknown clock '" << optarg << "'"
+                        << std::endl;
+                    return -1;
+                }
+                break;
+            case OPT_REBASE:
+                is_rebase = true;
+                break;
+            case OPT_TX_TIMESTAMPS:
+                is_tx_timestamps = true;
+                break;
+            case OPT_CONTROL:
+                control_path = std::string(optarg);
+                break;
+            case OPT_SHM:
+                shm_name = std::string(optarg);
+                break;
+            case OPT_TRANSFORM:
+                transform_file = std::string(optarg);
+                break;
+            case OPT_SPEAD_VERSION:
+                if(strcmp(optarg, "1") == 0)
+                    spead_version = Spead_version::V1;
+                else if(strcmp(optarg, "2") == 0)
+                    spead_version = Spead_version::V2;
+                else if(strcmp(optarg, "auto") == 0)
+                    spead_version = Spead_version::AUTO;
+                else
+                {
+                    std::cout << "Error - unknown SPEAD version '" << optarg
+                        << "'" << std::endl;
+                    return -1;
+                }
+                break;
+            case OPT_STREAM:
+                stream_spec = std::string(optarg);
+                break;
+            case OPT_INTERFACES:
+                udp_if_list = std::string(optarg);
+                break;
+            case OPT_SPREAD:
+                if(strcmp(optarg, "station") == 0)
+                    is_spread_by_station = true;
+                else if(strcmp(optarg, "packet") == 0)
+                    is_spread_by_station = false;
+                else
+                {
+                    std::cout << "Error - unknown spread '" << optarg << "'"
+                        << std::endl;
+                    return -1;
+                }
+                break;
+            case OPT_CPUS:
+                cpu_list = std::string(optarg);
+                break;
+            case OPT_PREFLIGHT:
+                is_preflight = true;
+                break;
+            case OPT_LINE_RATE:
+                line_gbps = atof(optarg);
+                if(line_gbps <= 0.0)
+                {
+                    std::cout << "Error - bad line rate '" << optarg << "'"
+                        << std::endl;
+                    return -1;
+                }
+                break;
             case '?':
                 usage(argv[0]);
                 return 0;
@@ -75,159 +392,353 @@ int main( int argc, char* argv[])
                 break;
         }
     }
-    if( data_file_name.size() == 0)
+    bool is_stream = (stream_spec.size() != 0);
+    if(is_stream && ((data_file_name.size() != 0)
+                || (hdr_file_name.size() != 0) || (repeats != 0)
+                || (fixed_pkts != 0) || is_dedup || (shm_name.size() != 0)
+                || (transform_file.size() != 0) || is_rebase
+                || is_tx_timestamps))
+    {
+        std::cout << "Error - --stream can't be used with -h, -d, -r, -z, -u,"
+            << " --shm, --transform, --rebase-timestamps or --tx-timestamps"
+            << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    if(!is_stream && (data_file_name.size() == 0))
     {
         std::cout << "Error - missing data file name" << std::endl;
         usage(argv[0]);
         return -1;
     }
-    if( hdr_file_name.size() == 0)
+    if(!is_stream && (hdr_file_name.size() == 0))
     {
         std::cout << "Error - missing header file name" << std::endl;
         usage(argv[0]);
         return -1;
     }
-    if(strlen(dest_addr) == 0)
+    bool is_raw = (raw_if_name.size() != 0);
+    if(is_preflight && is_stream)
+    {
+        std::cout << "Error - --preflight needs -h and -d, not --stream"
+            << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    if(is_preflight)
+        return preflight(hdr_file_name, data_file_name, spead_version, is_raw
+                , speed, line_gbps);
+    if(!is_raw && (strlen(dest_addr) == 0))
     {
         std::cout << "Error - missing destination IP address" << std::endl;
         usage(argv[0]);
         return -1;
     }
-    if(port == 0)
+    if(!is_raw && (port == 0))
     {
         std::cout << "Error - missing destination port number" << std::endl;
         usage(argv[0]);
         return -1;
     }
+    if(is_raw && is_tx_timestamps)
+    {
+        std::cout << "Error - --tx-timestamps only works for UDP packets, not"
+            << " raw frames" << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    if(is_raw && (udp_if_list.size() != 0))
+    {
+        std::cout << "Error - use -e if1,if2,... to send raw frames on several"
+            << " interfaces" << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    std::vector<std::string> if_names = split_list(is_raw ? raw_if_name
+            : udp_if_list);
+    size_t n_lanes = (if_names.size() > 1) ? if_names.size() : 1;
+    if((n_lanes > 1) && (is_stream || is_tx_timestamps
+                || (control_path.size() != 0)))
+    {
+        std::cout << "Error - several interfaces can't be used with --stream,"
+            << " --tx-timestamps or --control" << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    std::vector<int> cpus;
+    if(!choose_cpus(cpu_list, n_lanes, cpus))
+    {
+        std::cout << "Error - bad CPU list '" << cpu_list << "', need one CPU"
+            << " per interface" << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+
+    uint64_t start_at_ns = 0;
+    bool has_start_at = (start_at_text.size() != 0);
+    if(has_start_at
+            && !parse_start_time(start_at_text, start_clock, start_at_ns))
+    {
+        std::cout << "Error - bad start time '" << start_at_text << "'"
+            << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    if(is_dedup && (shm_name.size() != 0))
+    {
+        std::cout << "Error - -u can't be used with --shm" << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
+    if(is_rebase && !has_start_at)
+    {
+        std::cout << "Error - --rebase-timestamps needs --start-at"
+            << std::endl;
+        usage(argv[0]);
+        return -1;
+    }
 
     // Read data files
     Lfaa_tx_data tx_data;
-    tx_data.load_header_file(hdr_file_name);
-    tx_data.load_data_file(data_file_name);
-    tx_data.set_dest(dest_addr, port);
+    tx_data.set_raw_mode(is_raw);
+    tx_data.set_spead_version(spead_version);
+    tx_data.set_dedup(is_dedup);
+    Sample_transform xform;
+    if(transform_file.size() != 0)
+    {
+        if(!xform.load_config(transform_file))
+            return -1;
+        tx_data.set_transform(&xform);
+    }
+    Shm_segment shm;
+    Stream_source stream;
+    if(is_stream)
+    {
+        if(!stream.open(stream_spec)
+                || (!is_raw && !stream.set_dest(dest_addr, port)))
+            return -1;
+    }
+    else if(shm_name.size() != 0)
+    {
+        if(!shm.open(shm_name, hdr_file_name, data_file_name)
+                || !tx_data.load_shared(shm))
+            return -1;
+    }
+    else if(!tx_data.load_header_file(hdr_file_name)
+            || !tx_data.load_data_file(data_file_name))
+        return -1;
+    if(!is_raw && !is_stream)
+        tx_data.set_dest(dest_addr, port);
 
     uint32_t n_pkts = tx_data.get_num_pkts();
     if((fixed_pkts >0) && (fixed_pkts < n_pkts))
         n_pkts = fixed_pkts;
-    struct msghdr * msghdr = tx_data.get_msg_ptr();
-    uint64_t * send_dly_us = tx_data.get_send_dly_us();
 
-    // Create sending socket
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if(sock < 0)
+    // Create sending sockets: one per interface, each with its own sender
+    std::vector<std::unique_ptr<Tx_socket>> socks;
+    std::vector<std::unique_ptr<Lfaa_sender>> senders;
+    for(size_t lane=0; lane<n_lanes; lane++)
     {
-        std::cerr << "ERROR creating socket: " << strerror(errno) << std::endl;
-        return -1;
+        socks.push_back(std::make_unique<Tx_socket>());
+        Tx_socket & lane_sock = *socks.back();
+        bool sock_ok = is_raw ? lane_sock.open_raw(if_names[lane])
+            : (lane_sock.open_udp() && ((if_names.size() == 0)
+                        || lane_sock.bind_device(if_names[lane])));
+        if(!sock_ok)
+            return -1;
+        senders.push_back(std::make_unique<Lfaa_sender>(&tx_data, &lane_sock));
+        if(!senders.back()->set_speed(speed))
+            return -1;
+    }
+    Tx_socket & sock = *socks[0];
+    Lfaa_sender & sender = *senders[0];
+    std::vector<uint32_t> msg_lane;
+    if(n_lanes > 1)
+    {
+        msg_lane = tx_data.assign_lanes(n_lanes, is_spread_by_station);
+        for(size_t lane=0; lane<n_lanes; lane++)
+            senders[lane]->set_lane(&msg_lane, lane);
+        std::cout << "Packets spread over " << n_lanes << " interfaces by "
+            << (is_spread_by_station ? "station" : "packet") << std::endl;
     }
 
-    // Send all the packets
-    std::cout<< "\nStart sending packets" << std::endl;
-    timespec ts_start;
-    bool have_ts_start = (clock_gettime(CLOCK_MONOTONIC, &ts_start) >= 0);
-    struct timeval send_time;
-    send_time.tv_sec = ts_start.tv_sec;
-    send_time.tv_usec = ts_start.tv_nsec/1000;
-    uint32_t pkt_sent = 0;
-    uint32_t chanl_cnt = 0;
-    uint32_t num_freq_chans =  tx_data.get_num_freq_chans();
-    for(uint32_t rpt=0; rpt<(1+repeats); rpt++)
-    {
-        for(uint32_t i=0; i<n_pkts; i++)
+    if(has_start_at)
+    {
+        // SPEAD sync time is in UNIX seconds, so take TAI's offset off
+        if(is_rebase)
         {
-            ++chanl_cnt;
-            send_time.tv_usec += send_dly_us[i];
-            while(send_time.tv_usec > 1000000)
+            uint64_t unix_start_ns = start_at_ns;
+            if(start_clock == CLOCK_TAI)
             {
-                send_time.tv_usec -= 1000000;
-                send_time.tv_sec += 1;
+                // The offset is whole seconds; rounding the difference of
+                // full timestamps copes with a second ticking between reads
+                timespec ts_tai, ts_real;
+                clock_gettime(CLOCK_TAI, &ts_tai);
+                clock_gettime(CLOCK_REALTIME, &ts_real);
+                int64_t diff_ns = (ts_tai.tv_sec - ts_real.tv_sec) * 1000000000LL
+                    + (ts_tai.tv_nsec - ts_real.tv_nsec);
+                int64_t offset_sec = (diff_ns + 500000000LL) / 1000000000LL;
+                unix_start_ns -= offset_sec * 1000000000ULL;
             }
-
-            // When we've sent one packet for each frequency channel,
-            // we stop and wait out the rest of the 2.21184msec interval
-            // before LFAA is due to have more packets ready
-            if(chanl_cnt >= num_freq_chans)
-            {
-                chanl_cnt = 0;
-#if 1
-                timespec ts_now;
-                bool ok = (clock_gettime(CLOCK_MONOTONIC, &ts_now) >= 0);
-                uint32_t now_usec = ts_now.tv_nsec/1000;
-                if(ok && ( (send_time.tv_sec > ts_now.tv_sec)
-                            ||((send_time.tv_sec == ts_now.tv_sec)
-                                &&( (send_time.tv_usec) > now_usec))))
-                {
-                    struct timeval waitTime;
-                    waitTime.tv_sec = send_time.tv_sec - ts_now.tv_sec;
-                    if(send_time.tv_usec > now_usec)
-                        waitTime.tv_usec = send_time.tv_usec - now_usec;
-                    else
-                    {
-                        waitTime.tv_sec -= 1;
-                        waitTime.tv_usec =
-                            (1000000 + send_time.tv_usec) - now_usec;
-                    }
-#if 1
-                    // Delay
-                    int numEvents;
-                    do {
-                        numEvents = select( 0, 0, 0, 0, &waitTime);
-                    } while((numEvents == -1) && (errno == EINTR));
-                    if(numEvents < 0)
-                    {
-                        std::cerr << "ERROR: select failure: "
-                            << strerror(errno) << std::endl;
-                        return -1;
-                    }
-#endif
-                }
-            }
-#endif
-            // Send a packet
-            sendmsg(sock, &msghdr[i], 0);
+            tx_data.rebase_timestamps(unix_start_ns / 1000000000
+                    , unix_start_ns % 1000000000);
         }
-        pkt_sent += n_pkts;
+        // Get everything into RAM now so the start isn't delayed
+        if(!is_stream)
+            tx_data.prefault();
+        for(auto & lane_sender: senders)
+            lane_sender->set_start_at(start_clock, start_at_ns);
+        std::string frac = std::to_string(1000000000
+                + start_at_ns % 1000000000).substr(1);
+        std::cout << "\nWaiting to start at " << start_at_ns / 1000000000
+            << "." << frac << std::endl;
     }
 
-    // Show duration statistics if the information is available
-    timespec ts_end;
-    bool have_ts_end;
-    have_ts_end = (clock_gettime(CLOCK_MONOTONIC, &ts_end) >= 0);
-    uint32_t usec = 0;
-    if(have_ts_start && have_ts_end)
-    {
-        uint64_t diff_ns;
-        uint64_t diff_sec = ts_end.tv_sec - ts_start.tv_sec;
-        if(ts_start.tv_nsec > ts_end.tv_nsec)
+    Tx_timestamps tstamps;
+    if(is_tx_timestamps)
+    {
+        if(!tstamps.start(sock.get_fd(), tx_data.get_frames().size()))
+            return -1;
+        sender.set_tx_timestamps(&tstamps);
+    }
+
+    Sender_control control;
+    Control_server control_server(&control);
+    if(control_path.size() != 0)
+    {
+        if(!control_server.start(control_path))
+            return -1;
+        sender.set_control(&control);
+    }
+
+    // Send all the packets
+    std::cout<< "\nStart sending packets" << std::endl;
+    if(is_stream)
+    {
+        if(!stream.start(is_raw, spead_version)
+                || !sender.run_stream(&stream))
+            return -1;
+        stream.stop();
+    }
+    else if(n_lanes == 1)
+    {
+        if(cpu_list.size() != 0)
+            pin_to_cpu(cpus[0]);
+        if(!sender.run(repeats, n_pkts))
+            return -1;
+    }
+    else
+    {
+        // Start all the lanes together a little after their threads do
+        if(!has_start_at)
         {
-            diff_sec -= 1;
-            diff_ns = (ts_end.tv_nsec + 1000000000) - ts_start.tv_nsec;
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint64_t now_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            for(auto & lane_sender: senders)
+                lane_sender->set_start_at(CLOCK_MONOTONIC
+                        , now_ns + LANE_START_LEAD_NS);
         }
-        else
+        std::vector<std::thread> threads;
+        std::unique_ptr<bool[]> is_lane_ok(new bool[n_lanes]);
+        for(size_t lane=0; lane<n_lanes; lane++)
         {
-            diff_ns = ts_end.tv_nsec - ts_start.tv_nsec;
+            threads.emplace_back([&, lane]() {
+                    if(cpus.size() != 0)
+                        pin_to_cpu(cpus[lane]);
+                    is_lane_ok[lane] = senders[lane]->run(repeats, n_pkts);
+                });
         }
-        usec = diff_sec * 1000000 + (diff_ns/1000);
-        std::cout << usec << " usec elapsed" << std::endl;
+        bool is_ok = true;
+        for(size_t lane=0; lane<n_lanes; lane++)
+        {
+            threads[lane].join();
+            is_ok = is_ok && is_lane_ok[lane];
+        }
+        if(!is_ok)
+            return -1;
     }
-    std::cout << pkt_sent << " packets sent" << std::endl;
+    tstamps.stop();
+    control_server.stop();
 
+    // Totals over all the interfaces
+    uint64_t elapsed_ns = 0;
+    uint64_t total_pkts = 0;
     uint64_t total_bytes = 0;
-    for(unsigned int pkt=0; pkt<n_pkts; pkt++)
+    uint64_t pkts_dropped = 0;
+    uint64_t drops_full = 0;
+    uint64_t drops_error = 0;
+    uint64_t retries = 0;
+    int last_errno = 0;
+    for(size_t lane=0; lane<n_lanes; lane++)
     {
-        // Add up all the payload bytes in the iovecs
-        int n_iov = msghdr[pkt].msg_iovlen;
-        for(int vec=0; vec<n_iov; vec++)
-            total_bytes += msghdr[pkt].msg_iov[vec].iov_len;
-        // Add bytes in UDP & IP header
-        total_bytes += (20+8);
+        if(senders[lane]->get_elapsed_ns() > elapsed_ns)
+            elapsed_ns = senders[lane]->get_elapsed_ns();
+        total_pkts += senders[lane]->get_pkts_sent();
+        total_bytes += senders[lane]->get_bytes_sent();
+        pkts_dropped += senders[lane]->get_pkts_dropped();
+        drops_full += socks[lane]->get_drops_full();
+        drops_error += socks[lane]->get_drops_error();
+        retries += socks[lane]->get_retries();
+        if(socks[lane]->get_last_errno() != 0)
+            last_errno = socks[lane]->get_last_errno();
     }
-    total_bytes = total_bytes * (repeats+1);
+
+    // Show duration statistics if the information is available
+    uint32_t usec = elapsed_ns / 1000;
+    if(usec != 0)
+        std::cout << usec << " usec elapsed" << std::endl;
+    std::cout << total_pkts << " packets sent" << std::endl;
+
     std::cout << total_bytes << " bytes sent" << std::endl;
+    if(sender.get_pkts_filtered() != 0)
+        std::cout << sender.get_pkts_filtered()
+            << " packets held back by station filter" << std::endl;
+    if(sender.get_pkts_impaired() != 0)
+        std::cout << sender.get_pkts_impaired()
+            << " packets dropped by burst impairment" << std::endl;
+    if(pkts_dropped != 0)
+    {
+        std::cout << "WARNING: " << pkts_dropped
+            << " packets dropped by this host: " << drops_full
+            << " with the socket queue still full after retrying, "
+            << drops_error << " by other send errors (last: "
+            << strerror(last_errno) << ")" << std::endl;
+    }
+    if(retries != 0)
+        std::cout << retries << " sends retried because the socket"
+            << " queue was full" << std::endl;
     if(usec != 0)
     {
         float rate = ((float) total_bytes / (float) usec) * 8.0;
         std::cout << "Average sending rate: " << rate << " Mbps" << std::endl;
     }
+    if(is_stream)
+    {
+        std::cout << stream.get_pkts_read() << " packets ("
+            << stream.get_bytes_read() << " bytes) read from stream"
+            << std::endl;
+        if(stream.get_empty_waits() != 0)
+            std::cout << "Sending waited for the stream "
+                << stream.get_empty_waits() << " times" << std::endl;
+        if(stream.get_full_waits() != 0)
+            std::cout << "Stream waited for sending " << stream.get_full_waits()
+                << " times (ring full)" << std::endl;
+    }
+    if(has_start_at)
+        std::cout << "Started " << sender.get_start_error_ns()
+            << " nsec after requested start time" << std::endl;
+    if((n_lanes == 1) && (sender.get_num_paced() != 0))
+        std::cout << "Frames started late by " << sender.get_late_mean_ns()/1000
+            << " usec average (min " << sender.get_late_min_ns()/1000
+            << ", max " << sender.get_late_max_ns()/1000 << ")" << std::endl;
+    if(n_lanes > 1)
+        report_lanes(socks, senders, cpus);
+
+    if(is_tx_timestamps)
+        tstamps.report();
+    if(is_stream && stream.is_failed())
+        return -1;
 
     std::cout << "done." << std::endl;
 }
@@ -0,0 +1,237 @@
+#include "sample_transform.h"
+#include <iostream> // for cin cout cerr
+#include <fstream> // for ifstream
+#include <sstream> // for istringstream
+#include <cmath> // for cos sin lround
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define WEIGHT_FRAC_BITS 12
+#define MAX_DELAY_SAMPLES 100000000
+
+#define FLAG_VALUE (-128) // marks a flagged sample
+
+static inline int8_t clamp_int8(int32_t val)
+{
+    if(val > 127)
+        return 127;
+    if(val < -127)
+        return -127;
+    return static_cast<int8_t>(val);
+}
+
+static void cint8_rotate_scalar(int8_t * dst, const int8_t * src
+        , size_t n_bytes, Cint8_weight w)
+{
+    const int32_t round = 1 << (WEIGHT_FRAC_BITS - 1);
+    for(size_t i=0; i+2<=n_bytes; i+=2)
+    {
+        int32_t re = src[i];
+        int32_t im = src[i+1];
+        dst[i] = (re == FLAG_VALUE) ? FLAG_VALUE : clamp_int8(
+                (re * w.re - im * w.im + round) >> WEIGHT_FRAC_BITS);
+        dst[i+1] = (im == FLAG_VALUE) ? FLAG_VALUE : clamp_int8(
+                (re * w.im + im * w.re + round) >> WEIGHT_FRAC_BITS);
+    }
+}
+
+#if defined(__x86_64__)
+// Samples are widened to 16 bits so that one multiply-add per output does
+// re*wr - im*wi (or re*wi + im*wr) for each complex value
+__attribute__((target("avx2")))
+static void cint8_rotate_avx2(int8_t * dst, const int8_t * src
+        , size_t n_bytes, Cint8_weight w)
+{
+    const __m256i w_re = _mm256_set1_epi32(static_cast<uint16_t>(w.re)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(-w.im)) << 16));
+    const __m256i w_im = _mm256_set1_epi32(static_cast<uint16_t>(w.im)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(w.re)) << 16));
+    const __m256i round = _mm256_set1_epi32(1 << (WEIGHT_FRAC_BITS - 1));
+    const __m128i floor = _mm_set1_epi8(-127);
+    const __m128i flag = _mm_set1_epi8(FLAG_VALUE);
+    size_t i = 0;
+    for(; i+16<=n_bytes; i+=16)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m256i x = _mm256_cvtepi8_epi16(in);
+        __m256i re = _mm256_srai_epi32(_mm256_add_epi32(
+                    _mm256_madd_epi16(x, w_re), round), WEIGHT_FRAC_BITS);
+        __m256i im = _mm256_srai_epi32(_mm256_add_epi32(
+                    _mm256_madd_epi16(x, w_im), round), WEIGHT_FRAC_BITS);
+        // Results fit 16 bits: interleave re/im back into sample order
+        __m256i y = _mm256_blend_epi16(re, _mm256_slli_epi32(im, 16), 0xaa);
+        // Saturate to 8 bits; packs works per 128-bit lane so gather the
+        // two useful quadwords
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi16(y, y), 0x08);
+        __m128i out = _mm_max_epi8(_mm256_castsi256_si128(p), floor);
+        out = _mm_blendv_epi8(out, flag, _mm_cmpeq_epi8(in, flag));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+    cint8_rotate_scalar(dst + i, src + i, n_bytes - i, w);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void cint8_rotate_avx512(int8_t * dst, const int8_t * src
+        , size_t n_bytes, Cint8_weight w)
+{
+    const __m512i w_re = _mm512_set1_epi32(static_cast<uint16_t>(w.re)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(-w.im)) << 16));
+    const __m512i w_im = _mm512_set1_epi32(static_cast<uint16_t>(w.im)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(w.re)) << 16));
+    const __m512i round = _mm512_set1_epi32(1 << (WEIGHT_FRAC_BITS - 1));
+    const __m256i floor = _mm256_set1_epi8(-127);
+    const __m256i flag = _mm256_set1_epi8(FLAG_VALUE);
+    // Zero-masked forms with all lanes enabled are the plain instructions,
+    // but avoid GCC 12's bogus maybe-uninitialized warnings
+    const __mmask16 all32 = 0xffff;
+    size_t i = 0;
+    for(; i+32<=n_bytes; i+=32)
+    {
+        __m256i in = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(src + i));
+        __m512i x = _mm512_cvtepi8_epi16(in);
+        __m512i re = _mm512_maskz_srai_epi32(all32, _mm512_add_epi32(
+                    _mm512_madd_epi16(x, w_re), round), WEIGHT_FRAC_BITS);
+        __m512i im = _mm512_maskz_srai_epi32(all32, _mm512_add_epi32(
+                    _mm512_madd_epi16(x, w_im), round), WEIGHT_FRAC_BITS);
+        __m512i y = _mm512_mask_blend_epi16(0xaaaaaaaa, re
+                , _mm512_maskz_slli_epi32(all32, im, 16));
+        // Saturating narrow keeps sample order
+        __m256i out = _mm256_max_epi8(
+                _mm512_maskz_cvtsepi16_epi8(0xffffffff, y), floor);
+        out = _mm256_blendv_epi8(out, flag, _mm256_cmpeq_epi8(in, flag));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), out);
+    }
+    cint8_rotate_scalar(dst + i, src + i, n_bytes - i, w);
+}
+#endif
+
+Simd_level best_simd_level()
+{
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx512bw"))
+        return Simd_level::AVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return Simd_level::AVX2;
+#endif
+    return Simd_level::SCALAR;
+}
+
+const char * simd_level_name(Simd_level level)
+{
+    switch(level)
+    {
+        case Simd_level::AVX512:
+            return "avx512";
+        case Simd_level::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+void cint8_rotate(int8_t * dst, const int8_t * src, size_t n_bytes
+        , Cint8_weight w, Simd_level level)
+{
+#if defined(__x86_64__)
+    if(level == Simd_level::AVX512)
+    {
+        cint8_rotate_avx512(dst, src, n_bytes, w);
+        return;
+    }
+    if(level == Simd_level::AVX2)
+    {
+        cint8_rotate_avx2(dst, src, n_bytes, w);
+        return;
+    }
+#endif
+    cint8_rotate_scalar(dst, src, n_bytes, w);
+}
+
+void cint8_rotate(int8_t * dst, const int8_t * src, size_t n_bytes
+        , Cint8_weight w)
+{
+    static const Simd_level level = best_simd_level();
+    cint8_rotate(dst, src, n_bytes, w, level);
+}
+
+// Convert gain and phase to a fixed point weight. Fails if the gain is too
+// big to represent (about 8)
+bool Sample_transform::make_weight(double gain, double phase_deg
+        , Cint8_weight & w)
+{
+    double scale = gain * (1 << WEIGHT_FRAC_BITS);
+    double phase = phase_deg * M_PI / 180.0;
+    long re = std::lround(scale * std::cos(phase));
+    long im = std::lround(scale * std::sin(phase));
+    if((gain < 0.0) || (re > 32767) || (re < -32767)
+            || (im > 32767) || (im < -32767))
+        return false;
+    w.re = static_cast<int16_t>(re);
+    w.im = static_cast<int16_t>(im);
+    return true;
+}
+
+bool Sample_transform::load_config(std::string file)
+{
+    std::ifstream in(file);
+    if(!in.is_open())
+    {
+        std::cout << "Unable to open file: '" << file << "'" << std::endl;
+        return false;
+    }
+    std::string line;
+    uint32_t line_no = 0;
+    while(std::getline(in, line))
+    {
+        ++line_no;
+        size_t hash = line.find('#');
+        if(hash != std::string::npos)
+            line.erase(hash);
+        if(line.find_first_not_of(" \t\r") == std::string::npos)
+            continue; // blank line
+
+        std::istringstream fields(line);
+        uint32_t station;
+        double gain;
+        double phase_deg;
+        int64_t delay;
+        std::string extra;
+        Station_xform xf;
+        if(!(fields >> station >> gain >> phase_deg >> delay)
+                || (fields >> extra) || (station > 0xffff)
+                || (delay > MAX_DELAY_SAMPLES) || (delay < -MAX_DELAY_SAMPLES)
+                || !make_weight(gain, phase_deg, xf.weight))
+        {
+            std::cout << "Error - bad transform on line " << line_no
+                << " of '" << file << "': " << line << std::endl;
+            return false;
+        }
+        xf.delay = static_cast<int32_t>(delay);
+        set_station(station, xf);
+    }
+    std::cout << "Sample transforms for " << m_stations.size()
+        << " stations (" << simd_level_name(best_simd_level()) << ")"
+        << std::endl;
+    return true;
+}
+
+void Sample_transform::set_station(uint16_t station, const Station_xform & xf)
+{
+    m_stations[station] = xf;
+}
+
+// Transform for a station, or nullptr if its data is sent unchanged
+const Station_xform * Sample_transform::find(uint16_t station)
+{
+    auto it = m_stations.find(station);
+    if(it == m_stations.end())
+        return nullptr;
+    return &it->second;
+}
+
+size_t Sample_transform::size()
+{
+    return m_stations.size();
+}
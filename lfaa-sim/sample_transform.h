@@ -0,0 +1,63 @@
+/* Per-station transform of LFAA sample data: a complex gain (gain and phase
+ * rotation) and a delay of a whole number of samples, so that test vectors
+ * for beamformer and correlator tests can be varied without regenerating
+ * them in the model.
+ *
+ * Payloads are complex 8-bit samples, real then imaginary, both polarisations
+ * of a sample adjacent (4 bytes per sample). The gain is applied in 4.12
+ * fixed point with rounding and the result is saturated to +/-127. Values of
+ * -128 (flagged) pass through unchanged, and no new ones are created.
+ *
+ * Config file: one station per line, '#' starts a comment
+ *   <station_id> <gain> <phase_degrees> <delay_samples>
+ */
+
+#ifndef SAMPLE_TRANSFORM_H
+#define SAMPLE_TRANSFORM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <map>
+
+#define CINT8_SAMPLE_BYTES 4 // two polarisations, re+im each
+
+// Complex weight in 4.12 fixed point (4096 = 1.0)
+struct Cint8_weight
+{
+    int16_t re;
+    int16_t im;
+};
+
+enum class Simd_level{SCALAR, AVX2, AVX512};
+
+// Multiply 'n_bytes' of complex int8 data by 'w'. dst and src may be the same
+void cint8_rotate(int8_t * dst, const int8_t * src, size_t n_bytes
+        , Cint8_weight w);
+// As above, using a particular implementation (eg for benchmarks)
+void cint8_rotate(int8_t * dst, const int8_t * src, size_t n_bytes
+        , Cint8_weight w, Simd_level level);
+Simd_level best_simd_level();
+const char * simd_level_name(Simd_level level);
+
+struct Station_xform
+{
+    Cint8_weight weight;
+    int32_t delay; // samples, positive delays the signal
+};
+
+class Sample_transform
+{
+    private:
+        std::map<uint16_t, Station_xform> m_stations;
+
+    public:
+        static bool make_weight(double gain, double phase_deg
+                , Cint8_weight & w);
+        bool load_config(std::string file);
+        void set_station(uint16_t station, const Station_xform & xf);
+        const Station_xform * find(uint16_t station);
+        size_t size();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "sender_control.h"
+
+Sender_control::Sender_control()
+    : m_head(0)
+    , m_tail(0)
+    , pkts_sent(0)
+    , bytes_sent(0)
+    , frames_sent(0)
+    , pkts_filtered(0)
+    , pkts_impaired(0)
+    , pkts_dropped(0)
+    , repeat(0)
+    , is_paused(false)
+    , speed(1.0)
+{
+}
+
+Sender_control::~Sender_control()
+{
+    // Free filters that were posted but never picked up
+    Control_cmd cmd;
+    while(fetch(cmd))
+    {
+        if(cmd.type == Control_type::STATIONS)
+            delete cmd.filter;
+    }
+}
+
+// Controller side: queue a command. Fails if the mailbox is full.
+bool Sender_control::post(const Control_cmd & cmd)
+{
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    if(head - m_tail.load(std::memory_order_acquire) >= CONTROL_MAILBOX_LEN)
+        return false;
+    m_mailbox[head % CONTROL_MAILBOX_LEN] = cmd;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Sender side: cheap check for waiting commands
+bool Sender_control::is_pending()
+{
+    return m_head.load(std::memory_order_acquire)
+        != m_tail.load(std::memory_order_relaxed);
+}
+
+// Sender side: take the oldest command, if there is one
+bool Sender_control::fetch(Control_cmd & cmd)
+{
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if(m_head.load(std::memory_order_acquire) == tail)
+        return false;
+    cmd = m_mailbox[tail % CONTROL_MAILBOX_LEN];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,59 @@
+/* Shared state between a running Lfaa_sender and whatever is controlling it
+ * (see Control_server).
+ *
+ * Commands go through a small single-producer single-consumer mailbox that
+ * the sender checks at each frame boundary, so the send loop never blocks on
+ * a lock. Live counters are published by the sender with relaxed atomic
+ * stores for the controller to read at any time.
+ */
+
+#ifndef SENDER_CONTROL_H
+#define SENDER_CONTROL_H
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+#define CONTROL_MAILBOX_LEN 16
+
+enum class Control_type{PAUSE, RESUME, RATE, STATIONS, BURST};
+
+// Set of station IDs whose packets are sent
+typedef std::vector<bool> Station_filter;
+
+struct Control_cmd
+{
+    Control_type type;
+    double rate;              // RATE: new speed factor
+    uint32_t count;           // BURST: number of packets to drop
+    Station_filter * filter;  // STATIONS: new filter, or nullptr for all.
+                              // Ownership passes to the receiver.
+};
+
+class Sender_control
+{
+    private:
+        Control_cmd m_mailbox[CONTROL_MAILBOX_LEN];
+        std::atomic<uint32_t> m_head; // next slot to write (controller)
+        std::atomic<uint32_t> m_tail; // next slot to read (sender)
+
+    public:
+        // Live counters, written only by the sender
+        std::atomic<uint64_t> pkts_sent;
+        std::atomic<uint64_t> bytes_sent;
+        std::atomic<uint64_t> frames_sent;
+        std::atomic<uint64_t> pkts_filtered;
+        std::atomic<uint64_t> pkts_impaired;
+        std::atomic<uint64_t> pkts_dropped;
+        std::atomic<uint32_t> repeat;
+        std::atomic<bool> is_paused;
+        std::atomic<double> speed;
+
+        Sender_control();
+        ~Sender_control();
+        bool post(const Control_cmd & cmd);
+        bool fetch(Control_cmd & cmd);
+        bool is_pending();
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "shm_segment.h"
+#include "bigfile.h"
+#include <iostream> // for cin cout cerr
+#include <cstring> // for memcpy memcmp strerror
+#include <errno.h>
+#include <fcntl.h> // for open
+#include <unistd.h> // for close ftruncate pread
+#include <sys/file.h> // for flock
+#include <sys/mman.h> // for mmap shm_open
+#include <sys/stat.h> // for fstat
+#include <sys/vfs.h> // for fstatfs
+
+#define SHM_MAGIC "LFAASHM1"
+
+// Segment description, at the start of the segment. Header records and
+// payload each start on a page boundary (huge page on hugetlbfs).
+struct Shm_layout
+{
+    char magic[8];
+    // Size and modification time of the files the segment was loaded from
+    uint64_t hdr_src_size;
+    uint64_t hdr_src_mtime_ns;
+    uint64_t data_src_size;
+    uint64_t data_src_mtime_ns;
+    uint64_t hdr_offset;
+    uint64_t hdr_len;
+    uint64_t payload_offset;
+    uint64_t payload_len;
+    uint64_t total_len;
+    uint64_t is_complete; // written last, once the contents are in place
+};
+
+static uint64_t round_up(uint64_t val, uint64_t align)
+{
+    return ((val + align - 1) / align) * align;
+}
+
+// Identify a model file by its size and modification time
+static bool source_id(std::string file, uint64_t & size, uint64_t & mtime_ns)
+{
+    struct stat st;
+    if(stat(file.c_str(), &st) < 0)
+    {
+        std::cout << "Unable to open file: '" << file << "'" << std::endl;
+        return false;
+    }
+    size = st.st_size;
+    mtime_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000
+        + st.st_mtim.tv_nsec;
+    return true;
+}
+
+Shm_segment::Shm_segment()
+    : m_is_created(false)
+    , m_hdr(nullptr)
+    , m_hdr_len(0)
+    , m_hdr_map_len(0)
+    , m_payload(nullptr)
+    , m_payload_len(0)
+    , m_payload_map_len(0)
+{
+}
+
+Shm_segment::~Shm_segment()
+{
+    if(m_hdr != nullptr)
+        munmap(m_hdr, m_hdr_map_len);
+    if(m_payload != nullptr)
+        munmap(m_payload, m_payload_map_len);
+}
+
+// Open the named segment, filling it from the model files if this is the
+// first process to use it
+bool Shm_segment::open(std::string name, std::string hdr_file
+        , std::string data_file)
+{
+    m_name = name;
+    Shm_layout src;
+    memset(&src, 0, sizeof(src));
+    memcpy(src.magic, SHM_MAGIC, sizeof(src.magic));
+    if(!source_id(hdr_file, src.hdr_src_size, src.hdr_src_mtime_ns)
+            || !source_id(data_file, src.data_src_size, src.data_src_mtime_ns))
+        return false;
+
+    bool is_path = (name.find('/') != std::string::npos);
+    int fd = is_path ? ::open(name.c_str(), O_RDWR | O_CREAT, 0644)
+        : shm_open(("/" + name).c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        std::cerr << "ERROR opening shared memory '" << name << "': "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Whoever gets the lock first fills the segment, the rest wait for it
+    int rv;
+    do {
+        rv = flock(fd, LOCK_EX);
+    } while((rv < 0) && (errno == EINTR));
+    struct stat st;
+    struct statfs sfs;
+    if((rv < 0) || (fstat(fd, &st) < 0) || (fstatfs(fd, &sfs) < 0))
+    {
+        std::cerr << "ERROR locking shared memory '" << name << "': "
+            << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    bool is_ok = true;
+    if(st.st_size == 0)
+    {
+        // hugetlbfs reports its huge page size as the block size
+        uint64_t align = (sfs.f_bsize > 4096) ? sfs.f_bsize : 4096;
+        is_ok = fill(fd, align, src, hdr_file, data_file);
+        if(!is_ok)
+            (void) ftruncate(fd, 0); // let the next process try again
+        m_is_created = is_ok;
+    }
+    if(is_ok)
+    {
+        Shm_layout lay;
+        if((pread(fd, &lay, sizeof(lay), 0) != sizeof(lay))
+                || (memcmp(lay.magic, src.magic, sizeof(lay.magic)) != 0)
+                || (lay.is_complete == 0))
+        {
+            std::cout << "Error - '" << name << "' is not a complete"
+                << " lfaa-sim shared memory segment" << std::endl;
+            is_ok = false;
+        }
+        else if((lay.hdr_src_size != src.hdr_src_size)
+                || (lay.hdr_src_mtime_ns != src.hdr_src_mtime_ns)
+                || (lay.data_src_size != src.data_src_size)
+                || (lay.data_src_mtime_ns != src.data_src_mtime_ns))
+        {
+            std::cout << "Error - shared memory '" << name << "' was loaded"
+                << " from different model files; remove it to reload"
+                << std::endl;
+            is_ok = false;
+        }
+        else
+        {
+            is_ok = map(fd, lay);
+        }
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd); // mappings stay valid
+    if(is_ok)
+    {
+        std::cout << (m_is_created ? "Loaded" : "Attached to")
+            << " shared memory '" << name << "' (" << m_hdr_len << " + "
+            << m_payload_len << " bytes)" << std::endl;
+    }
+    return is_ok;
+}
+
+// Read the model files into a new segment
+bool Shm_segment::fill(int fd, uint64_t align, const Shm_layout & src
+        , std::string hdr_file, std::string data_file)
+{
+    Bigfile hdr(hdr_file);
+    Bigfile data(data_file);
+    if(!hdr.read() || !data.read())
+    {
+        std::cout << "Error - Unable to read model files into shared memory"
+            << std::endl;
+        return false;
+    }
+
+    Shm_layout lay = src;
+    lay.hdr_offset = align;
+    lay.hdr_len = hdr.size();
+    lay.payload_offset = lay.hdr_offset + round_up(lay.hdr_len, align);
+    lay.payload_len = data.size();
+    lay.total_len = lay.payload_offset + round_up(lay.payload_len, align);
+    if(ftruncate(fd, lay.total_len) < 0)
+    {
+        std::cerr << "ERROR sizing shared memory '" << m_name << "': "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    void * seg = mmap(nullptr, lay.total_len, PROT_READ | PROT_WRITE
+            , MAP_SHARED, fd, 0);
+    if(seg == MAP_FAILED)
+    {
+        std::cerr << "ERROR mapping shared memory '" << m_name << "': "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    char * base = static_cast<char *>(seg);
+    memcpy(base + lay.hdr_offset, hdr.get(), lay.hdr_len);
+    memcpy(base + lay.payload_offset, data.get(), lay.payload_len);
+    lay.is_complete = 1;
+    memcpy(base, &lay, sizeof(lay));
+    munmap(seg, lay.total_len);
+    return true;
+}
+
+// Map the header records copy-on-write and the payload read-only
+bool Shm_segment::map(int fd, const Shm_layout & lay)
+{
+    m_hdr_len = lay.hdr_len;
+    m_payload_len = lay.payload_len;
+    if(m_hdr_len != 0)
+    {
+        m_hdr_map_len = lay.payload_offset - lay.hdr_offset;
+        void * p = mmap(nullptr, m_hdr_map_len, PROT_READ | PROT_WRITE
+                , MAP_PRIVATE, fd, lay.hdr_offset);
+        if(p == MAP_FAILED)
+        {
+            std::cerr << "ERROR mapping shared headers: " << strerror(errno)
+                << std::endl;
+            return false;
+        }
+        m_hdr = static_cast<char *>(p);
+    }
+    if(m_payload_len != 0)
+    {
+        m_payload_map_len = lay.total_len - lay.payload_offset;
+        void * p = mmap(nullptr, m_payload_map_len, PROT_READ, MAP_SHARED, fd
+                , lay.payload_offset);
+        if(p == MAP_FAILED)
+        {
+            std::cerr << "ERROR mapping shared payload: " << strerror(errno)
+                << std::endl;
+            return false;
+        }
+        m_payload = static_cast<char *>(p);
+    }
+    return true;
+}
+
+// True if this process filled the segment, false if it was already loaded
+bool Shm_segment::is_created()
+{
+    return m_is_created;
+}
+
+char * Shm_segment::get_hdr()
+{
+    return m_hdr;
+}
+
+uint64_t Shm_segment::get_hdr_len()
+{
+    return m_hdr_len;
+}
+
+char * Shm_segment::get_payload()
+{
+    return m_payload;
+}
+
+uint64_t Shm_segment::get_payload_len()
+{
+    return m_payload_len;
+}
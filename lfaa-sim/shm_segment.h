@@ -0,0 +1,54 @@
+/* This class holds the model's header and data files in a named shared
+ * memory segment, so several simulator processes on one host can send from a
+ * single copy of the data.
+ *
+ * The first process to open the segment reads (and decompresses) the files
+ * into it; later processes find it already filled and just map it. A name
+ * without '/' is a POSIX shared memory object (/dev/shm), a path is opened as
+ * a file, eg on a hugetlbfs mount. The segment outlives the processes, so
+ * remove it once the model files change or are no longer needed.
+ *
+ * Each process maps the header records copy-on-write, because headers are
+ * modified per process (checksums, timestamps), and maps the payload
+ * read-only so it is never duplicated.
+ */
+
+#ifndef SHM_SEGMENT_H
+#define SHM_SEGMENT_H
+
+#include <string>
+#include <cstdint>
+
+struct Shm_layout;
+
+class Shm_segment
+{
+    private:
+        std::string m_name;
+        bool m_is_created;
+        char * m_hdr;
+        uint64_t m_hdr_len;
+        uint64_t m_hdr_map_len;
+        char * m_payload;
+        uint64_t m_payload_len;
+        uint64_t m_payload_map_len;
+
+        bool fill(int fd, uint64_t align, const Shm_layout & src
+                , std::string hdr_file, std::string data_file);
+        bool map(int fd, const Shm_layout & lay);
+
+    public:
+        Shm_segment();
+        ~Shm_segment();
+        Shm_segment(const Shm_segment&) = delete; // no copy
+        Shm_segment& operator=(const Shm_segment &) = delete; // no assign
+        bool open(std::string name, std::string hdr_file
+                , std::string data_file);
+        bool is_created();
+        char * get_hdr();
+        uint64_t get_hdr_len();
+        char * get_payload();
+        uint64_t get_payload_len();
+};
+
+#endif
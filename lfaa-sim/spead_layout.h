@@ -0,0 +1,140 @@
+/* Layouts of the model's header records for each LFAA SPEAD format.
+ *
+ * Each record holds fixed fields describing the packet, then the Ethernet,
+ * IP, UDP and SPEAD headers as they go on the wire. Formats differ only in
+ * the SPEAD header, so a layout is a set of compile time offsets into it.
+ * Code that walks the records is written as templates on the layout, and
+ * the layout is chosen once when the header file is loaded.
+ *
+ *  v1: 8 items, 72 byte SPEAD header, 148 byte record (the original format,
+ *      as the Matlab model writes it)
+ *  v2: provisional, for a model that adds a 48-bit scan ID item before the
+ *      sample offset item: 9 items, 80 byte SPEAD header, 156 byte record.
+ *      No model writes it yet, so check it against the real format before
+ *      relying on it. The simulator doesn't interpret the scan ID, so the
+ *      layout only needs the fields that keep their v1 offsets.
+ */
+
+#ifndef SPEAD_LAYOUT_H
+#define SPEAD_LAYOUT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring> // for memcpy
+#include "inet_csum.h"
+
+#define ETH_HDR_LEN 14
+#define IP_HDR_LEN 20
+#define UDP_HDR_LEN 8
+#define SPEAD_NUM_ITEMS_OFFSET 7 // low byte of the SPEAD header's item count
+#define SPEAD_ITEM_VALUE_MASK 0xffffffffffffULL // 48-bit item values
+
+enum class Spead_version{AUTO, V1, V2};
+
+// Structure in the model-generated header file
+template<uint32_t SPEAD_LEN>
+struct Lfaa_record
+{
+    uint8_t data_offset[8];
+    uint8_t hdr_data_len_bytes[4]; // FIXME length of hdr or payload??
+    uint8_t send_time_ns[8];// TODO move to front of struct for better alignment
+    uint8_t reserved[12];
+    uint8_t eth_hdr[ETH_HDR_LEN];
+    uint8_t ip_hdr[IP_HDR_LEN];
+    uint8_t udp_hdr[UDP_HDR_LEN];
+    uint8_t spead_hdr[SPEAD_LEN];
+    uint8_t unused_pad[2];
+} __attribute__((packed)) ; // note: GCC-specific keyword (avoids padding)
+
+struct Spead_v1
+{
+    static constexpr uint32_t SPEAD_LEN = 72;
+    static constexpr uint32_t NUM_ITEMS = 8;
+    static constexpr uint32_t CHANNEL = 10;   // logical channel, 16 bits
+    static constexpr uint32_t COUNTER = 12;   // packet counter, 32 bits
+    static constexpr uint32_t SYNC_TIME = 24; // item: UNIX seconds
+    static constexpr uint32_t TIMESTAMP = 32; // item: ns since sync time
+    static constexpr uint32_t STATION = 60;   // station ID, 16 bits
+    typedef Lfaa_record<SPEAD_LEN> Record;
+};
+static_assert(sizeof(Spead_v1::Record) == 148, "must match Matlab size");
+
+struct Spead_v2
+{
+    static constexpr uint32_t SPEAD_LEN = 80;
+    static constexpr uint32_t NUM_ITEMS = 9;
+    static constexpr uint32_t CHANNEL = 10;
+    static constexpr uint32_t COUNTER = 12;
+    static constexpr uint32_t SYNC_TIME = 24;
+    static constexpr uint32_t TIMESTAMP = 32;
+    static constexpr uint32_t STATION = 60;
+    typedef Lfaa_record<SPEAD_LEN> Record;
+};
+static_assert(sizeof(Spead_v2::Record) == 156, "must be 148 + one item");
+
+template<class L>
+inline uint16_t spead_channel(const typename L::Record & rec)
+{
+    return (rec.spead_hdr[L::CHANNEL] << 8) | rec.spead_hdr[L::CHANNEL+1];
+}
+
+template<class L>
+inline uint16_t spead_station(const typename L::Record & rec)
+{
+    return (rec.spead_hdr[L::STATION] << 8) | rec.spead_hdr[L::STATION+1];
+}
+
+template<class L>
+inline uint32_t spead_counter(const typename L::Record & rec)
+{
+    const uint8_t * p = &rec.spead_hdr[L::COUNTER];
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8)
+        | p[3];
+}
+
+// Work out the SPEAD format of a header file from the item count in its
+// first record
+inline Spead_version detect_spead_version(const char * hdr
+        , uint64_t hdr_data_len)
+{
+    const uint32_t spead_offset = offsetof(Spead_v1::Record, spead_hdr);
+    if(hdr_data_len < sizeof(Spead_v2::Record))
+        return Spead_version::V1;
+    uint8_t num_items = hdr[spead_offset + SPEAD_NUM_ITEMS_OFFSET];
+    if((num_items == Spead_v2::NUM_ITEMS)
+            && ((hdr_data_len % sizeof(Spead_v2::Record)) == 0))
+        return Spead_version::V2;
+    return Spead_version::V1;
+}
+
+// Recompute IPv4 header and UDP checksums for a raw frame so that the model's
+// headers go on the wire unchanged apart from the checksum fields
+template<class L>
+void fill_record_checksums(typename L::Record & rec, const void * payload
+        , size_t len)
+{
+    rec.ip_hdr[10] = 0;
+    rec.ip_hdr[11] = 0;
+    uint16_t ip_csum = csum_fold(csum_partial(rec.ip_hdr, IP_HDR_LEN, 0));
+    memcpy(&rec.ip_hdr[10], &ip_csum, 2);
+
+    // UDP pseudo-header: source & dest addresses, protocol, UDP length
+    uint8_t pseudo[12];
+    memcpy(pseudo, &rec.ip_hdr[12], 8);
+    pseudo[8] = 0;
+    pseudo[9] = rec.ip_hdr[9];
+    pseudo[10] = rec.udp_hdr[4];
+    pseudo[11] = rec.udp_hdr[5];
+    rec.udp_hdr[6] = 0;
+    rec.udp_hdr[7] = 0;
+    uint64_t sum = csum_partial(pseudo, sizeof(pseudo), 0);
+    sum = csum_partial(rec.udp_hdr, UDP_HDR_LEN, sum);
+    sum = csum_partial(rec.spead_hdr, L::SPEAD_LEN, sum);
+    sum = csum_partial(payload, len, sum);
+    uint16_t udp_csum = csum_fold(sum);
+    if(udp_csum == 0)
+        udp_csum = 0xffff; // zero means "no checksum" for UDP over IPv4
+    memcpy(&rec.udp_hdr[6], &udp_csum, 2);
+}
+
+#endif
@@ -0,0 +1,412 @@
+#include "stream_source.h"
+#include <iostream> // for cin cout cerr
+#include <cstring> // for memcpy memset strerror
+#include <errno.h>
+#include <fcntl.h> // for open
+#include <unistd.h> // for read close unlink
+#include <poll.h>
+#include <time.h> // for nanosleep
+#include <sys/un.h> // for sockaddr_un
+
+#define STREAM_POLL_NS 50000     // ring empty/full: check again after 50usec
+#define STREAM_READ_POLL_MS 100  // how often a blocked read checks for stop
+#define NO_PAYLOAD 0xffffffffffffffffULL // data_offset of an all-zero payload
+
+static_assert((STREAM_RING_LEN & (STREAM_RING_LEN - 1)) == 0
+        , "ring length must be a power of two");
+
+static uint64_t big_endian_64bit(const uint8_t * ptr)
+{
+    uint64_t val = 0;
+    for(int i=0; i<8; i++)
+        val = (val << 8) | ptr[i];
+    return val;
+}
+
+static uint32_t big_endian_32bit(const uint8_t * ptr)
+{
+    return (static_cast<uint32_t>(ptr[0]) << 24) | (ptr[1] << 16)
+        | (ptr[2] << 8) | ptr[3];
+}
+
+static void poll_sleep()
+{
+    timespec ts = {0, STREAM_POLL_NS};
+    nanosleep(&ts, nullptr);
+}
+
+Stream_source::Stream_source()
+    : m_fd(-1)
+    , m_listen_sock(-1)
+    , m_is_raw(false)
+    , m_version(Spead_version::AUTO)
+    , m_head(0)
+    , m_tail(0)
+    , m_is_done(false)
+    , m_stop(false)
+    , m_is_failed(false)
+    , m_bytes_read(0)
+    , m_full_waits(0)
+    , m_empty_waits(0)
+{
+    memset(&m_dest, 0, sizeof(m_dest));
+}
+
+Stream_source::~Stream_source()
+{
+    stop();
+    if(m_fd > STDIN_FILENO)
+        close(m_fd);
+    if(m_listen_sock >= 0)
+    {
+        close(m_listen_sock);
+        unlink(m_path.c_str());
+    }
+}
+
+// Where packets come from: "-" for stdin, "unix:path" to listen on a Unix
+// stream socket for one producer, or any other path for a FIFO or file
+bool Stream_source::open(std::string spec)
+{
+    if(spec == "-")
+    {
+        m_fd = STDIN_FILENO;
+        return true;
+    }
+    if(spec.compare(0, 5, "unix:") != 0)
+    {
+        std::cout << "Waiting for stream '" << spec << "'" << std::endl;
+        m_fd = ::open(spec.c_str(), O_RDONLY); // a FIFO blocks for a writer
+        if(m_fd < 0)
+        {
+            std::cout << "Unable to open stream: '" << spec << "': "
+                << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::string path = spec.substr(5);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Stream socket path too long: " << path << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    m_listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_listen_sock < 0)
+    {
+        std::cerr << "ERROR creating stream socket: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+    unlink(path.c_str()); // left behind by an earlier run
+    if((bind(m_listen_sock, reinterpret_cast<struct sockaddr *>(&addr)
+                    , sizeof(addr)) < 0)
+            || (listen(m_listen_sock, 1) < 0))
+    {
+        std::cerr << "ERROR opening stream socket '" << path << "': "
+            << strerror(errno) << std::endl;
+        close(m_listen_sock);
+        m_listen_sock = -1;
+        return false;
+    }
+    m_path = path;
+    std::cout << "Stream socket: " << path << std::endl;
+    return true;
+}
+
+bool Stream_source::set_dest(char * destination, uint16_t port)
+{
+    memset(&m_dest, 0, sizeof(m_dest));
+    m_dest.sin_family = AF_INET;
+    if(inet_pton(AF_INET, destination, &m_dest.sin_addr.s_addr) <= 0)
+    {
+        std::cout << "Bad IP address: " << destination << std::endl;
+        return false;
+    }
+    m_dest.sin_port = htons(port);
+    return true;
+}
+
+// Allocate the ring and start reading. 'version' AUTO detects the SPEAD
+// format from the first record.
+bool Stream_source::start(bool is_raw, Spead_version version)
+{
+    m_is_raw = is_raw;
+    m_version = version;
+    try
+    {
+        m_ring = std::make_unique<Stream_pkt[]>(STREAM_RING_LEN);
+        m_mmsg = std::make_unique<struct mmsghdr[]>(STREAM_RING_LEN);
+    }
+    catch (std::bad_alloc &ba)
+    {
+        std::cerr << "Couldn't allocate RAM for stream: " << ba.what()
+            << std::endl;
+        return false;
+    }
+    // Message headers never change: only what their iovecs point at does
+    for(uint32_t slot=0; slot<STREAM_RING_LEN; slot++)
+    {
+        struct msghdr * mh = &m_mmsg[slot].msg_hdr;
+        memset(&m_mmsg[slot], 0, sizeof(struct mmsghdr));
+        mh->msg_name = m_is_raw ? nullptr : &m_dest;
+        mh->msg_namelen = m_is_raw ? 0 : sizeof(m_dest);
+        mh->msg_iov = m_ring[slot].iov;
+        mh->msg_iovlen = 2;
+    }
+    m_thread = std::thread(&Stream_source::ingest, this);
+    return true;
+}
+
+void Stream_source::stop()
+{
+    if(!m_thread.joinable())
+        return;
+    m_stop = true;
+    m_thread.join();
+}
+
+// Wait for a producer to connect to the stream socket
+bool Stream_source::accept_producer()
+{
+    struct pollfd pfd = {m_listen_sock, POLLIN, 0};
+    while(!m_stop)
+    {
+        int rv = poll(&pfd, 1, STREAM_READ_POLL_MS);
+        if((rv < 0) && (errno != EINTR))
+            break;
+        if(rv <= 0)
+            continue;
+        m_fd = accept(m_listen_sock, nullptr, nullptr);
+        if(m_fd >= 0)
+            return true;
+        break;
+    }
+    if(!m_stop)
+        std::cerr << "ERROR accepting stream producer: " << strerror(errno)
+            << std::endl;
+    return false;
+}
+
+// Read exactly 'len' bytes. Fails at end of stream, on error or when stopped
+bool Stream_source::read_full(void * buf, size_t len)
+{
+    char * p = static_cast<char *>(buf);
+    struct pollfd pfd = {m_fd, POLLIN, 0};
+    while(len > 0)
+    {
+        if(m_stop)
+            return false;
+        int rv = poll(&pfd, 1, STREAM_READ_POLL_MS);
+        if((rv == 0) || ((rv < 0) && (errno == EINTR)))
+            continue;
+        ssize_t got = (rv < 0) ? -1 : read(m_fd, p, len);
+        if((got < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+            continue;
+        if(got < 0)
+            std::cerr << "ERROR reading stream: " << strerror(errno)
+                << std::endl;
+        if(got <= 0)
+            return false;
+        p += got;
+        len -= got;
+        m_bytes_read += got;
+    }
+    return true;
+}
+
+void Stream_source::ingest()
+{
+    if((m_listen_sock >= 0) && !accept_producer())
+    {
+        m_is_failed = !m_stop;
+        m_is_done.store(true, std::memory_order_release);
+        return;
+    }
+    // Records start the same in every format, so read the smallest and
+    // look at the SPEAD item count if the format must be detected
+    uint8_t first[sizeof(Spead_v1::Record)];
+    uint64_t bytes_before = m_bytes_read;
+    if(read_full(first, sizeof(first)))
+    {
+        if(m_version == Spead_version::AUTO)
+        {
+            uint8_t num_items = first[offsetof(Spead_v1::Record, spead_hdr)
+                + SPEAD_NUM_ITEMS_OFFSET];
+            m_version = (num_items == Spead_v2::NUM_ITEMS)
+                ? Spead_version::V2 : Spead_version::V1;
+        }
+        std::cout << "Stream contains SPEAD v"
+            << ((m_version == Spead_version::V2) ? 2 : 1) << " headers"
+            << std::endl;
+        bool is_ok = (m_version == Spead_version::V2)
+            ? ingest_t<Spead_v2>(first, sizeof(first))
+            : ingest_t<Spead_v1>(first, sizeof(first));
+        m_is_failed = !is_ok;
+    }
+    else if(m_bytes_read != bytes_before)
+    {
+        std::cerr << "ERROR stream ended part way through a header record"
+            << std::endl;
+        m_is_failed = true;
+    }
+    m_is_done.store(true, std::memory_order_release);
+}
+
+// Read packets into the ring until the stream ends. 'first' holds the start
+// of the first record.
+template<class L>
+bool Stream_source::ingest_t(uint8_t * first, size_t first_len)
+{
+    const uint32_t hdr_len = m_is_raw
+        ? (ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN + L::SPEAD_LEN)
+        : L::SPEAD_LEN;
+    const uint32_t overhead = m_is_raw ? 0 : (IP_HDR_LEN + UDP_HDR_LEN);
+    for(uint64_t seq=0; ; seq++)
+    {
+        // Wait for the sender to free a slot
+        if(seq - m_tail.load(std::memory_order_acquire) >= STREAM_RING_LEN)
+        {
+            ++m_full_waits;
+            while(seq - m_tail.load(std::memory_order_acquire)
+                    >= STREAM_RING_LEN)
+            {
+                if(m_stop)
+                    return true;
+                poll_sleep();
+            }
+        }
+
+        Stream_pkt & pkt = m_ring[seq & (STREAM_RING_LEN - 1)];
+        typename L::Record * rec
+            = reinterpret_cast<typename L::Record *>(pkt.rec);
+        uint64_t bytes_before = m_bytes_read;
+        if(seq == 0)
+        {
+            memcpy(pkt.rec, first, first_len);
+            if(!read_full(pkt.rec + first_len, sizeof(*rec) - first_len))
+            {
+                std::cerr << "ERROR stream ended part way through a header"
+                    << " record" << std::endl;
+                return false;
+            }
+        }
+        else if(!read_full(pkt.rec, sizeof(*rec)))
+        {
+            if(m_bytes_read == bytes_before)
+                return true; // clean end, between packets
+            std::cerr << "ERROR stream ended part way through a header"
+                << " record" << std::endl;
+            return false;
+        }
+
+        uint64_t offset = big_endian_64bit(rec->data_offset);
+        uint32_t len = big_endian_32bit(rec->hdr_data_len_bytes);
+        if(len > STREAM_MAX_PAYLOAD)
+        {
+            std::cerr << "ERROR stream packet " << seq << " has a " << len
+                << " byte payload (max " << STREAM_MAX_PAYLOAD << ")"
+                << std::endl;
+            return false;
+        }
+        if(offset == NO_PAYLOAD)
+            memset(pkt.payload, 0, len);
+        else if(!read_full(pkt.payload, len))
+        {
+            std::cerr << "ERROR stream ended part way through packet " << seq
+                << "'s payload" << std::endl;
+            return false;
+        }
+
+        if(m_is_raw)
+        {
+            uint32_t udp_len = (rec->udp_hdr[4] << 8) | rec->udp_hdr[5];
+            if(udp_len != (UDP_HDR_LEN + L::SPEAD_LEN + len))
+            {
+                std::cerr << "ERROR stream packet " << seq << " UDP length="
+                    << udp_len << " but frame carries "
+                    << (UDP_HDR_LEN + L::SPEAD_LEN + len) << std::endl;
+                return false;
+            }
+            fill_record_checksums<L>(*rec, pkt.payload, len);
+        }
+        pkt.iov[0].iov_base = m_is_raw ? rec->eth_hdr : rec->spead_hdr;
+        pkt.iov[0].iov_len = hdr_len;
+        pkt.iov[1].iov_base = pkt.payload;
+        pkt.iov[1].iov_len = len;
+        pkt.send_ns = big_endian_64bit(rec->send_time_ns);
+        pkt.counter = spead_counter<L>(*rec);
+        pkt.station = spead_station<L>(*rec);
+        pkt.wire_bytes = overhead + hdr_len + len;
+
+        m_head.store(seq + 1, std::memory_order_release);
+    }
+}
+
+// Wait until packet 'seq' (counting from zero) has arrived. Returns false if
+// the stream ended first.
+bool Stream_source::wait_pkt(uint64_t seq)
+{
+    if(seq < m_head.load(std::memory_order_acquire))
+        return true;
+    ++m_empty_waits;
+    while(true)
+    {
+        // Done is set after the last packet, so check it first
+        bool is_done = m_is_done.load(std::memory_order_acquire);
+        if(seq < m_head.load(std::memory_order_acquire))
+            return true;
+        if(is_done)
+            return false;
+        poll_sleep();
+    }
+}
+
+Stream_pkt & Stream_source::get_pkt(uint64_t seq)
+{
+    return m_ring[seq & (STREAM_RING_LEN - 1)];
+}
+
+struct mmsghdr & Stream_source::get_mmsg(uint64_t seq)
+{
+    return m_mmsg[seq & (STREAM_RING_LEN - 1)];
+}
+
+// Give back the slots of all packets before 'seq'
+void Stream_source::release(uint64_t seq)
+{
+    m_tail.store(seq, std::memory_order_release);
+}
+
+// Whether the stream was cut short or had a bad packet in it
+bool Stream_source::is_failed()
+{
+    return m_is_failed;
+}
+
+uint64_t Stream_source::get_pkts_read()
+{
+    return m_head.load(std::memory_order_acquire);
+}
+
+uint64_t Stream_source::get_bytes_read()
+{
+    return m_bytes_read;
+}
+
+// Times the model got ahead of sending and had to wait for ring space
+uint64_t Stream_source::get_full_waits()
+{
+    return m_full_waits;
+}
+
+// Times sending caught up with the model and had to wait for packets
+uint64_t Stream_source::get_empty_waits()
+{
+    return m_empty_waits;
+}
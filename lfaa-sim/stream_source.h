@@ -0,0 +1,90 @@
+/* This class reads LFAA simulation packets as they are generated, instead of
+ * from complete header and data files, so that generation and sending
+ * overlap and nothing needs to go to disk.
+ *
+ * The stream is the model's header records, each one followed directly by
+ * its payload (hdr_data_len_bytes of sample data). A record whose
+ * data_offset is all ones has a zero payload and no bytes follow it. It can
+ * come from stdin ("-"), a FIFO or file, or a producer connecting to a Unix
+ * stream socket ("unix:path").
+ *
+ * An ingest thread reads packets into a fixed ring of preallocated slots
+ * with their message headers ready to send. The ring is single-producer
+ * single-consumer and lock-free: the sender reads packets up to m_head and
+ * hands slots back by moving m_tail on. Either side sleep-polls briefly if
+ * the ring is empty or full.
+ */
+
+#ifndef STREAM_SOURCE_H
+#define STREAM_SOURCE_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <memory>       // for unique_ptr
+#include <sys/types.h>  // for sendmsg
+#include <sys/socket.h> // for iovec and msghdr
+#include <arpa/inet.h>  // for sockaddr_in
+#include "spead_layout.h"
+
+#define STREAM_RING_LEN 4096 // packets, must be a power of two
+#define STREAM_MAX_PAYLOAD 8192
+
+struct Stream_pkt
+{
+    uint8_t rec[sizeof(Spead_v2::Record)]; // header record as received
+    char payload[STREAM_MAX_PAYLOAD];
+    uint64_t send_ns;   // model send time
+    uint32_t counter;   // SPEAD packet counter: packets of a frame share it
+    uint32_t wire_bytes;// bytes in IP packet, or Ethernet frame when raw
+    uint16_t station;
+    struct iovec iov[2];
+};
+
+class Stream_source
+{
+    private:
+        int m_fd;
+        int m_listen_sock;
+        std::string m_path; // of the Unix socket, removed when done
+        bool m_is_raw;
+        Spead_version m_version;
+        struct sockaddr_in m_dest;
+        std::unique_ptr<Stream_pkt[]> m_ring;
+        std::unique_ptr<struct mmsghdr[]> m_mmsg; // one per ring slot
+        std::atomic<uint64_t> m_head; // packets written (ingest thread)
+        std::atomic<uint64_t> m_tail; // packets released (sender)
+        std::atomic<bool> m_is_done;  // no more packets will be written
+        std::atomic<bool> m_stop;
+        bool m_is_failed; // set by the ingest thread before m_is_done
+        std::thread m_thread;
+        uint64_t m_bytes_read;
+        uint64_t m_full_waits;  // ingest found the ring full
+        uint64_t m_empty_waits; // sender found it empty
+
+        void ingest();
+        template<class L> bool ingest_t(uint8_t * first, size_t first_len);
+        bool read_full(void * buf, size_t len);
+        bool accept_producer();
+
+    public:
+        Stream_source();
+        ~Stream_source();
+        Stream_source(const Stream_source&) = delete; // no copy
+        Stream_source& operator=(const Stream_source &) = delete; // no assign
+        bool open(std::string spec);
+        bool set_dest(char * destination, uint16_t port);
+        bool start(bool is_raw, Spead_version version);
+        void stop();
+        bool wait_pkt(uint64_t seq);
+        Stream_pkt & get_pkt(uint64_t seq);
+        struct mmsghdr & get_mmsg(uint64_t seq);
+        void release(uint64_t seq);
+        bool is_failed();
+        uint64_t get_pkts_read();
+        uint64_t get_bytes_read();
+        uint64_t get_full_waits();
+        uint64_t get_empty_waits();
+};
+
+#endif
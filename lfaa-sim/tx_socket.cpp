@@ -0,0 +1,251 @@
+#include "tx_socket.h"
+#include <iostream> // for cin cout cerr
+#include <cstring> // for strerror
+#include <errno.h>
+#include <unistd.h> // for close
+#include <fcntl.h> // for fcntl
+#include <poll.h> // for ppoll
+#include <time.h> // for nanosleep
+#include <net/if.h> // for if_nametoindex
+#include <netinet/in.h>
+#include <linux/if_packet.h> // for sockaddr_ll
+
+#define SEND_RETRIES 4           // attempts before a packet is dropped
+#define SEND_BACKOFF_NS 20000    // first wait 20usec, doubling each retry
+#define SEND_BATCH_WAIT_NS 200000 // most time waited per batch (~1/10 frame)
+#define SKB_OVERHEAD_BYTES 1024  // kernel's per-packet buffer accounting
+
+Tx_socket::Tx_socket()
+    : m_sock(-1)
+    , m_is_raw(false)
+    , m_retries(0)
+    , m_drops_full(0)
+    , m_drops_error(0)
+    , m_last_errno(0)
+{
+}
+
+Tx_socket::~Tx_socket()
+{
+    if(m_sock >= 0)
+        close(m_sock);
+}
+
+// Open a normal UDP socket. Destination comes from each message's msg_name
+bool Tx_socket::open_udp()
+{
+    m_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(m_sock < 0)
+    {
+        std::cerr << "ERROR creating socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_is_raw = false;
+    return set_nonblocking();
+}
+
+// Send UDP packets only out of one interface, whatever the routing table
+// says. Needs CAP_NET_RAW if the kernel is older than 5.7
+bool Tx_socket::bind_device(std::string ifname)
+{
+    if(setsockopt(m_sock, SOL_SOCKET, SO_BINDTODEVICE, ifname.c_str()
+                , ifname.size()) < 0)
+    {
+        std::cerr << "ERROR binding socket to '" << ifname << "': "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+    m_ifname = ifname;
+    return true;
+}
+
+// Open a raw packet socket bound to an interface. Messages must then contain
+// the whole Ethernet frame, and have no msg_name. Needs CAP_NET_RAW.
+bool Tx_socket::open_raw(std::string ifname)
+{
+    unsigned int ifindex = if_nametoindex(ifname.c_str());
+    if(ifindex == 0)
+    {
+        std::cerr << "ERROR unknown interface '" << ifname << "': "
+            << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Protocol 0: we only transmit, so don't have received frames queued
+    m_sock = socket(AF_PACKET, SOCK_RAW, 0);
+    if(m_sock < 0)
+    {
+        std::cerr << "ERROR creating raw socket: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0;
+    addr.sll_ifindex = ifindex;
+    if(bind(m_sock, reinterpret_cast<struct sockaddr *>(&addr)
+                , sizeof(addr)) < 0)
+    {
+        std::cerr << "ERROR binding raw socket to '" << ifname << "': "
+            << strerror(errno) << std::endl;
+        close(m_sock);
+        m_sock = -1;
+        return false;
+    }
+
+    // Frames are sent exactly as built, without going via the qdisc layer
+    int one = 1;
+    setsockopt(m_sock, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+    m_is_raw = true;
+    m_ifname = ifname;
+    return set_nonblocking();
+}
+
+// Full socket queues are then reported instead of blocking the sender
+bool Tx_socket::set_nonblocking()
+{
+    int flags = fcntl(m_sock, F_GETFL, 0);
+    if((flags < 0) || (fcntl(m_sock, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        std::cerr << "ERROR making socket non-blocking: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Size the send buffer so a whole burst (one frame's packets) can be queued
+// at once, with room for the next burst behind it
+void Tx_socket::fit_send_buffer(uint64_t burst_bytes, uint32_t burst_pkts)
+{
+    uint64_t want = burst_bytes + (uint64_t)burst_pkts * SKB_OVERHEAD_BYTES;
+    int size = 0;
+    socklen_t len = sizeof(size);
+    if(getsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &size, &len) < 0)
+        return;
+    if((uint64_t)size >= 2 * want)
+        return;
+    // Kernel doubles the value given. SO_SNDBUFFORCE ignores the wmem_max
+    // limit but needs CAP_NET_ADMIN
+    int req = (want > 0x3fffffff) ? 0x3fffffff : static_cast<int>(want);
+    if(setsockopt(m_sock, SOL_SOCKET, SO_SNDBUFFORCE, &req, sizeof(req)) < 0)
+        setsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &req, sizeof(req));
+    len = sizeof(size);
+    getsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &size, &len);
+    std::cout << "Socket send buffer " << size << " bytes for bursts of "
+        << burst_bytes << " bytes" << std::endl;
+    if((uint64_t)size < want)
+        std::cout << "WARNING: send buffer is smaller than a burst, raise"
+            << " net.core.wmem_max" << std::endl;
+}
+
+bool Tx_socket::is_raw()
+{
+    return m_is_raw;
+}
+
+// Interface the socket is bound to, empty if none
+std::string Tx_socket::get_ifname()
+{
+    return m_ifname;
+}
+
+int Tx_socket::get_fd()
+{
+    return m_sock;
+}
+
+// Wait up to wait_ns (under a second) before retrying a send the kernel
+// had no room for. EAGAIN clears when the socket is writable again; ENOBUFS
+// (device queue full) doesn't show in poll(), so always back off for the
+// whole delay.
+bool Tx_socket::wait_writable(uint64_t wait_ns)
+{
+    timespec ts = {0, static_cast<long>(wait_ns)};
+    if(errno == EAGAIN)
+    {
+        struct pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLOUT;
+        return (ppoll(&pfd, 1, &ts, nullptr) >= 0);
+    }
+    nanosleep(&ts, nullptr);
+    return true;
+}
+
+// Send a batch of messages with as few system calls as possible. Returns the
+// number sent; messages that couldn't be sent are counted as drops.
+unsigned int Tx_socket::send_batch(struct mmsghdr * msgs, unsigned int n)
+{
+    unsigned int done = 0;
+    unsigned int sent = 0;
+    unsigned int attempt = 0;
+    uint64_t wait_left_ns = SEND_BATCH_WAIT_NS;
+    while(done < n)
+    {
+        int rv = sendmmsg(m_sock, &msgs[done], n - done, 0);
+        if(rv >= 0)
+        {
+            done += rv;
+            sent += rv;
+            attempt = 0;
+            continue;
+        }
+        if(errno == EINTR)
+            continue;
+        if((errno == EAGAIN) || (errno == ENOBUFS))
+        {
+            if(wait_left_ns == 0)
+            {
+                // Waited long enough for this batch: later frames are due
+                m_drops_full += n - done;
+                m_last_errno = errno;
+                break;
+            }
+            if(attempt < SEND_RETRIES)
+            {
+                uint64_t wait_ns = SEND_BACKOFF_NS << attempt++;
+                if(wait_ns > wait_left_ns)
+                    wait_ns = wait_left_ns;
+                wait_left_ns -= wait_ns;
+                ++m_retries;
+                wait_writable(wait_ns);
+                continue;
+            }
+            ++m_drops_full;
+        }
+        else
+        {
+            ++m_drops_error;
+        }
+        // give up on this message and carry on with the rest
+        m_last_errno = errno;
+        ++done;
+        attempt = 0;
+    }
+    return sent;
+}
+
+uint64_t Tx_socket::get_retries()
+{
+    return m_retries;
+}
+
+uint64_t Tx_socket::get_drops_full()
+{
+    return m_drops_full;
+}
+
+uint64_t Tx_socket::get_drops_error()
+{
+    return m_drops_error;
+}
+
+// Error that caused the most recent drop (0 if none)
+int Tx_socket::get_last_errno()
+{
+    return m_last_errno;
+}
@@ -0,0 +1,52 @@
+/* This class owns the socket that LFAA simulation packets are sent through.
+ * Packets either go via the kernel UDP stack, or as complete Ethernet frames
+ * on a raw (AF_PACKET) socket bound to a network interface.
+ *
+ * The socket is non-blocking. When the kernel can't queue a packet (EAGAIN,
+ * ENOBUFS) sending is retried a few times, backing off in between. The
+ * waiting is bounded per batch, so a full queue costs at most a fraction of
+ * a frame period: once that is used up, the rest of the batch is dropped.
+ * Retries and drops are counted.
+ */
+
+#ifndef TX_SOCKET_H
+#define TX_SOCKET_H
+
+#include <string>
+#include <sys/types.h>  // for sendmsg
+#include <sys/socket.h> // for msghdr
+
+class Tx_socket
+{
+    private:
+        int m_sock;
+        bool m_is_raw;
+        std::string m_ifname;
+        uint64_t m_retries;
+        uint64_t m_drops_full;  // kernel queue still full after retrying
+        uint64_t m_drops_error; // any other send error
+        int m_last_errno;
+
+        bool set_nonblocking();
+        bool wait_writable(uint64_t wait_ns);
+
+    public:
+        Tx_socket();
+        ~Tx_socket();
+        Tx_socket(const Tx_socket&) = delete; // no copy
+        Tx_socket& operator=(const Tx_socket &) = delete; // no assign
+        bool open_udp();
+        bool bind_device(std::string ifname);
+        bool open_raw(std::string ifname);
+        bool is_raw();
+        std::string get_ifname();
+        int get_fd();
+        void fit_send_buffer(uint64_t burst_bytes, uint32_t burst_pkts);
+        unsigned int send_batch(struct mmsghdr * msgs, unsigned int n);
+        uint64_t get_retries();
+        uint64_t get_drops_full();
+        uint64_t get_drops_error();
+        int get_last_errno();
+};
+
+#endif
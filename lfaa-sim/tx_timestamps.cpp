@@ -0,0 +1,230 @@
+#include "tx_timestamps.h"
+#include <iostream> // for cin cout cerr
+#include <iomanip> // for setw
+#include <algorithm> // for sort
+#include <cstring> // for strerror
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h> // for SOF_TIMESTAMPING_*
+#include <linux/errqueue.h> // for sock_extended_err scm_timestamping
+
+#define RING_LEN (1 << 20) // packets that can be in flight to the NIC
+#define DRAIN_MSEC 200 // time allowed for the last timestamps to arrive
+#define WORST_FRAMES 10
+
+Tx_timestamps::Tx_timestamps()
+    : m_sock(-1)
+    , m_next_id(0)
+    , m_stop(false)
+    , m_num_matched(0)
+    , m_num_missed(0)
+{
+}
+
+Tx_timestamps::~Tx_timestamps()
+{
+    stop();
+}
+
+// Turn on software TX timestamps for the socket and start harvesting them
+bool Tx_timestamps::start(int sock, uint32_t num_frames)
+{
+    uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+        | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        std::cerr << "ERROR enabling TX timestamps: " << strerror(errno)
+            << std::endl;
+        return false;
+    }
+    try
+    {
+        m_ring = std::make_unique<Expected[]>(RING_LEN);
+    }
+    catch (std::bad_alloc &ba)
+    {
+        std::cerr << "Couldn't allocate RAM for TX timestamps: " << ba.what()
+            << std::endl;
+        return false;
+    }
+    m_sock = sock;
+    m_frames.assign(num_frames, Frame_stats{0, 0.0, 0});
+    m_stop = false;
+    m_thread = std::thread(&Tx_timestamps::harvest, this);
+    return true;
+}
+
+// Record when the next packet the socket accepted was due to go
+// (CLOCK_REALTIME)
+void Tx_timestamps::expect(uint64_t sched_ns, uint16_t station, uint32_t frame)
+{
+    uint32_t id = m_next_id.load(std::memory_order_relaxed);
+    Expected & e = m_ring[id % RING_LEN];
+    e.station = station;
+    e.frame = frame;
+    e.sched_ns = sched_ns;
+    e.id = id;
+    m_next_id.store(id + 1, std::memory_order_release);
+}
+
+// Wait a little for the last timestamps, then stop the harvesting thread
+void Tx_timestamps::stop()
+{
+    if(!m_thread.joinable())
+        return;
+    timespec ts = {0, DRAIN_MSEC * 1000000};
+    nanosleep(&ts, nullptr);
+    m_stop = true;
+    m_thread.join();
+}
+
+void Tx_timestamps::harvest()
+{
+    struct pollfd pfd;
+    pfd.fd = m_sock;
+    pfd.events = 0; // POLLERR is always reported
+    while(!m_stop)
+    {
+        int rv = poll(&pfd, 1, 10);
+        if((rv > 0) && (pfd.revents & POLLERR))
+        {
+            while(read_error_queue())
+                ;
+        }
+        match_early();
+    }
+    while(read_error_queue())
+        ;
+    match_early();
+    // Timestamps for packets never expected
+    m_num_missed += m_early.size();
+    m_early.clear();
+}
+
+// Match timestamps held back, now that more packets may have been expected
+void Tx_timestamps::match_early()
+{
+    size_t kept = 0;
+    for(size_t i=0; i<m_early.size(); i++)
+    {
+        if(!match(m_early[i].id, m_early[i].wire_ns))
+            m_early[kept++] = m_early[i];
+    }
+    m_early.resize(kept);
+}
+
+// Read one timestamp from the error queue. Returns false when it's empty.
+bool Tx_timestamps::read_error_queue()
+{
+    char ctrl[512];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    if(recvmsg(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        return false;
+
+    struct scm_timestamping * tss = nullptr;
+    struct sock_extended_err * serr = nullptr;
+    for(struct cmsghdr * cm = CMSG_FIRSTHDR(&msg); cm != nullptr
+            ; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if((cm->cmsg_level == SOL_SOCKET)
+                && (cm->cmsg_type == SCM_TIMESTAMPING))
+            tss = reinterpret_cast<struct scm_timestamping *>(CMSG_DATA(cm));
+        else
+        {
+            // IP_RECVERR
+            struct sock_extended_err * e =
+                reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
+            if(e->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                serr = e;
+        }
+    }
+    if((tss == nullptr) || (serr == nullptr))
+        return true;
+
+    uint32_t id = serr->ee_data;
+    uint64_t wire_ns = tss->ts[0].tv_sec * 1000000000ULL + tss->ts[0].tv_nsec;
+    if(!match(id, wire_ns))
+        m_early.push_back(Early{id, wire_ns});
+    return true;
+}
+
+// Record the schedule error of the packet with the given id. Returns false
+// if the packet hasn't been expected yet
+bool Tx_timestamps::match(uint32_t id, uint64_t wire_ns)
+{
+    uint32_t next_id = m_next_id.load(std::memory_order_acquire);
+    if(static_cast<int32_t>(id - next_id) >= 0)
+        return false;
+    Expected & e = m_ring[id % RING_LEN];
+    if(e.id != id)
+    {
+        // overwritten before its timestamp arrived
+        ++m_num_missed;
+        return true;
+    }
+    int64_t err_ns = static_cast<int64_t>(wire_ns - e.sched_ns);
+    m_stations[e.station].err_ns.push_back(err_ns);
+    if(e.frame < m_frames.size())
+    {
+        Frame_stats & f = m_frames[e.frame];
+        if((f.count == 0) || (err_ns > f.max_ns))
+            f.max_ns = err_ns;
+        f.sum_ns += err_ns;
+        f.count++;
+    }
+    ++m_num_matched;
+    return true;
+}
+
+// Print schedule error distributions: per station, then the worst frames
+void Tx_timestamps::report()
+{
+    std::cout << "\nTX timestamps: " << m_num_matched << " of "
+        << m_next_id.load() << " packets";
+    if(m_num_missed != 0)
+        std::cout << " (" << m_num_missed << " overrun)";
+    std::cout << std::endl;
+    if(m_num_matched == 0)
+        return;
+
+    std::cout << "Wire time minus scheduled time (usec):" << std::endl;
+    std::cout << " station   packets      min      p50      p99      max"
+        << std::endl;
+    for(auto & st: m_stations)
+    {
+        std::vector<int64_t> & v = st.second.err_ns;
+        std::sort(v.begin(), v.end());
+        std::cout << std::setw(8) << st.first << std::setw(10) << v.size()
+            << std::fixed << std::setprecision(1)
+            << std::setw(9) << v.front() / 1e3
+            << std::setw(9) << v[v.size()/2] / 1e3
+            << std::setw(9) << v[(v.size()*99)/100] / 1e3
+            << std::setw(9) << v.back() / 1e3 << std::endl;
+    }
+
+    std::vector<uint32_t> worst;
+    for(uint32_t f=0; f<m_frames.size(); f++)
+    {
+        if(m_frames[f].count != 0)
+            worst.push_back(f);
+    }
+    std::sort(worst.begin(), worst.end(), [this](uint32_t a, uint32_t b)
+            { return m_frames[a].max_ns > m_frames[b].max_ns; });
+    if(worst.size() > WORST_FRAMES)
+        worst.resize(WORST_FRAMES);
+    std::cout << "   frame   packets     mean      max  (worst frames)"
+        << std::endl;
+    for(auto f: worst)
+    {
+        std::cout << std::setw(8) << f << std::setw(10) << m_frames[f].count
+            << std::setw(9) << m_frames[f].sum_ns / m_frames[f].count / 1e3
+            << std::setw(9) << m_frames[f].max_ns / 1e3 << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6);
+}
@@ -0,0 +1,80 @@
+/* This class measures when packets actually leave, using the kernel's
+ * software transmit timestamps (SO_TIMESTAMPING), and compares that with
+ * when the model scheduled them to be sent.
+ *
+ * The sender calls expect() for each packet the socket accepted, in send
+ * order, once the send has returned. A side thread reads timestamps from the
+ * socket's error queue and matches them to the expected packets by the
+ * per-socket counter (SOF_TIMESTAMPING_OPT_ID), which the kernel only
+ * advances for datagrams it accepts. A timestamp can arrive before its
+ * packet has been expected, so it's held until then.
+ *
+ * Only UDP sockets are supported.
+ */
+
+#ifndef TX_TIMESTAMPS_H
+#define TX_TIMESTAMPS_H
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <memory> // for unique_ptr
+
+class Tx_timestamps
+{
+    private:
+        // Packet waiting for its timestamp
+        struct Expected
+        {
+            uint32_t id;
+            uint16_t station;
+            uint32_t frame;
+            uint64_t sched_ns; // CLOCK_REALTIME
+        };
+        // Timestamp that arrived before its packet was expected
+        struct Early
+        {
+            uint32_t id;
+            uint64_t wire_ns;
+        };
+        // Schedule error distribution for one station
+        struct Station_stats
+        {
+            std::vector<int64_t> err_ns;
+        };
+        // Schedule error summary for one frame of the capture
+        struct Frame_stats
+        {
+            uint64_t count;
+            double sum_ns;
+            int64_t max_ns;
+        };
+
+        int m_sock;
+        std::unique_ptr<Expected[]> m_ring;
+        std::atomic<uint32_t> m_next_id;
+        std::atomic<bool> m_stop;
+        std::thread m_thread;
+        uint64_t m_num_matched;
+        uint64_t m_num_missed;
+        std::map<uint16_t, Station_stats> m_stations;
+        std::vector<Frame_stats> m_frames;
+        std::vector<Early> m_early;
+
+        void harvest();
+        bool read_error_queue();
+        bool match(uint32_t id, uint64_t wire_ns);
+        void match_early();
+
+    public:
+        Tx_timestamps();
+        ~Tx_timestamps();
+        bool start(int sock, uint32_t num_frames);
+        void expect(uint64_t sched_ns, uint16_t station, uint32_t frame);
+        void stop();
+        void report();
+};
+
+#endif